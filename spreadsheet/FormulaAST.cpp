@@ -1,14 +1,23 @@
 #include "FormulaAST.h"
 
+#ifdef SPREADSHEET_ANTLR_ORACLE
 #include "FormulaBaseListener.h"
 #include "FormulaLexer.h"
 #include "FormulaParser.h"
+#endif
 
+#include <algorithm>
 #include <cassert>
+#include <cctype>
+#include <climits>
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
 #include <memory>
 #include <optional>
 #include <sstream>
+#include <string_view>
 
 namespace ASTImpl {
 
@@ -67,17 +76,224 @@ constexpr PrecedenceRule PRECEDENCE_RULES[EP_END][EP_END] = {
     /* EP_ATOM */ {PR_NONE, PR_NONE, PR_NONE, PR_NONE, PR_NONE, PR_NONE},
 };
 
+// Собирает постфиксную программу и следит за глубиной стека вычислений
+class ProgramBuilder {
+public:
+    void Emit(Instruction instruction) {
+        switch (instruction.op) {
+            case Instruction::Op::PushNumber:
+            case Instruction::Op::PushCell:
+                max_depth_ = std::max(max_depth_, ++depth_);
+                break;
+            case Instruction::Op::Negate:
+            case Instruction::Op::AggregateRange:
+                break;
+            case Instruction::Op::BeginAggregate:
+                max_aggregate_depth_ = std::max(max_aggregate_depth_, ++aggregate_depth_);
+                break;
+            case Instruction::Op::EndAggregate:
+                --aggregate_depth_;
+                max_depth_ = std::max(max_depth_, ++depth_);
+                break;
+            default:
+                --depth_;
+        }
+        program_.push_back(instruction);
+    }
+
+    // Операция над двумя числами сворачивается в число. Если правый операнд -
+    // число или ячейка, он встраивается в саму операцию; умножение и деление
+    // на 1 и вычитание +0 не меняют значение и опускаются.
+    void EmitBinaryOp(Instruction::Op op) {
+        using Op = Instruction::Op;
+
+        const size_t size = program_.size();
+        if (size >= 2 && program_[size - 1].op == Op::PushNumber
+            && program_[size - 2].op == Op::PushNumber) {
+            double& lhs = program_[size - 2].number;
+            lhs = FoldBinaryOp(op, lhs, program_[size - 1].number);
+            program_.pop_back();
+            --depth_;
+            return;
+        }
+
+        if (!program_.empty()) {
+            Instruction& last = program_.back();
+            const bool is_number = last.op == Op::PushNumber;
+            const bool is_cell = last.op == Op::PushCell;
+
+            if (is_number && IsIdentityOperand(op, last.number)) {
+                program_.pop_back();
+                --depth_;
+                return;
+            }
+
+            if (is_number || is_cell) {
+                switch (op) {
+                    case Op::Add:
+                        last.op = is_number ? Op::AddNumber : Op::AddCell;
+                        break;
+                    case Op::Subtract:
+                        last.op = is_number ? Op::SubtractNumber : Op::SubtractCell;
+                        break;
+                    case Op::Multiply:
+                        last.op = is_number ? Op::MultiplyNumber : Op::MultiplyCell;
+                        break;
+                    case Op::Divide:
+                        last.op = is_number ? Op::DivideNumber : Op::DivideCell;
+                        break;
+                    default:
+                        assert(false);
+                }
+                --depth_;
+                return;
+            }
+        }
+        EmitOp(op);
+    }
+
+    // Отрицание числа сворачивается, двойное отрицание сокращается
+    void EmitNegate() {
+        using Op = Instruction::Op;
+
+        if (!program_.empty()) {
+            Instruction& last = program_.back();
+            if (last.op == Op::PushNumber) {
+                last.number = -last.number;
+                return;
+            }
+            if (last.op == Op::Negate) {
+                program_.pop_back();
+                return;
+            }
+        }
+        EmitOp(Op::Negate);
+    }
+
+    void EmitNumber(double value) {
+        Instruction instruction{Instruction::Op::PushNumber, {}};
+        instruction.number = value;
+        Emit(instruction);
+    }
+
+    void EmitCell(Position offset) {
+        Instruction instruction{Instruction::Op::PushCell, {}};
+        instruction.cell = Instruction::PackOffset(offset);
+        Emit(instruction);
+    }
+
+    void EmitRange(const Range& range) {
+        Instruction instruction{Instruction::Op::AggregateRange, {}};
+        instruction.index = static_cast<std::uint32_t>(ranges_.size());
+        ranges_.push_back(range);
+        Emit(instruction);
+    }
+
+    // Функция от одних чисел вычисляется сразу и заменяется числом
+    void EmitEndAggregate(AggregateFunction function) {
+        using Op = Instruction::Op;
+
+        size_t begin = program_.size();
+        while (begin >= 2 && program_[begin - 1].op == Op::AggregateValue
+               && program_[begin - 2].op == Op::PushNumber) {
+            begin -= 2;
+        }
+        if (begin >= 1 && program_[begin - 1].op == Op::BeginAggregate) {
+            RangeAggregate aggregate;
+            for (size_t i = begin; i < program_.size(); i += 2) {
+                aggregate.Add(&program_[i].number, 1);
+            }
+            program_.resize(begin - 1);
+            --aggregate_depth_;
+            EmitNumber(aggregate.GetResult(function));
+            return;
+        }
+
+        Instruction instruction{Instruction::Op::EndAggregate, {}};
+        instruction.function = function;
+        Emit(instruction);
+    }
+
+    void EmitOp(Instruction::Op op) {
+        Emit(Instruction{op, {}});
+    }
+
+    std::vector<Instruction> MoveProgram() {
+        program_.shrink_to_fit();
+        return std::move(program_);
+    }
+
+    std::vector<Range> MoveRanges() {
+        ranges_.shrink_to_fit();
+        return std::move(ranges_);
+    }
+
+    size_t GetMaxDepth() const {
+        return max_depth_;
+    }
+
+    size_t GetMaxAggregateDepth() const {
+        return max_aggregate_depth_;
+    }
+
+private:
+    // Те же правила, что и при выполнении программы, в том числе деление на ноль
+    static double FoldBinaryOp(Instruction::Op op, double lhs, double rhs) {
+        switch (op) {
+            case Instruction::Op::Add:
+                return lhs + rhs;
+            case Instruction::Op::Subtract:
+                return lhs - rhs;
+            case Instruction::Op::Multiply:
+                return lhs * rhs;
+            case Instruction::Op::Divide:
+                return rhs == 0 ? MakeErrorValue(FormulaError::Category::Div0) : lhs / rhs;
+            default:
+                assert(false);
+                return 0.0;
+        }
+    }
+
+    // x*1, x/1 и x-(+0) равны x для любого x, включая -0 и ошибки
+    static bool IsIdentityOperand(Instruction::Op op, double rhs) {
+        switch (op) {
+            case Instruction::Op::Multiply:
+            case Instruction::Op::Divide:
+                return rhs == 1.0;
+            case Instruction::Op::Subtract:
+                return rhs == 0.0 && !std::signbit(rhs);
+            default:
+                return false;
+        }
+    }
+
+    std::vector<Instruction> program_;
+    std::vector<Range> ranges_;
+    size_t depth_ = 0;
+    size_t max_depth_ = 0;
+    size_t aggregate_depth_ = 0;
+    size_t max_aggregate_depth_ = 0;
+};
+
 class Expr {
 public:
     virtual ~Expr() = default;
-    virtual void Print(std::ostream& out) const = 0;
-    virtual void DoPrintFormula(std::ostream& out, ExprPrecedence precedence) const = 0;
-    virtual double Evaluate(std::function<double(Position)>& args) const = 0;
+    // Ссылки хранятся как смещения от якоря; печатаются абсолютные позиции
+    virtual void Print(std::ostream& out, Position anchor) const = 0;
+    virtual void DoPrintFormula(std::ostream& out, ExprPrecedence precedence,
+                                Position anchor) const = 0;
+    virtual void Compile(ProgramBuilder& builder) const = 0;
+
+    // Аргумент агрегатной функции: значение выражения добавляется в открытый накопитель
+    virtual void CompileArgument(ProgramBuilder& builder) const {
+        Compile(builder);
+        builder.EmitOp(Instruction::Op::AggregateValue);
+    }
 
     // higher is tighter
     virtual ExprPrecedence GetPrecedence() const = 0;
 
-    void PrintFormula(std::ostream& out, ExprPrecedence parent_precedence,
+    void PrintFormula(std::ostream& out, ExprPrecedence parent_precedence, Position anchor,
                       bool right_child = false) const {
         auto precedence = GetPrecedence();
         auto mask = right_child ? PR_RIGHT : PR_LEFT;
@@ -86,7 +302,7 @@ public:
             out << '(';
         }
 
-        DoPrintFormula(out, precedence);
+        DoPrintFormula(out, precedence, anchor);
 
         if (parens_needed) {
             out << ')';
@@ -111,18 +327,19 @@ public:
         , rhs_(std::move(rhs)) {
     }
 
-    void Print(std::ostream& out) const override {
+    void Print(std::ostream& out, Position anchor) const override {
         out << '(' << static_cast<char>(type_) << ' ';
-        lhs_->Print(out);
+        lhs_->Print(out, anchor);
         out << ' ';
-        rhs_->Print(out);
+        rhs_->Print(out, anchor);
         out << ')';
     }
 
-    void DoPrintFormula(std::ostream& out, ExprPrecedence precedence) const override {
-        lhs_->PrintFormula(out, precedence);
+    void DoPrintFormula(std::ostream& out, ExprPrecedence precedence,
+                        Position anchor) const override {
+        lhs_->PrintFormula(out, precedence, anchor);
         out << static_cast<char>(type_);
-        rhs_->PrintFormula(out, precedence,  true);
+        rhs_->PrintFormula(out, precedence, anchor, true);
     }
 
     ExprPrecedence GetPrecedence() const override {
@@ -142,26 +359,23 @@ public:
         }
     }
 
-    double Evaluate(std::function<double(Position)>& args) const override {
+    void Compile(ProgramBuilder& builder) const override {
+        lhs_->Compile(builder);
+        rhs_->Compile(builder);
 
-         switch (type_) {
-                
+        switch (type_) {
             case Add:
-                return lhs_->Evaluate(args) + rhs_->Evaluate(args);
-                
+                builder.EmitBinaryOp(Instruction::Op::Add);
+                break;
             case Subtract:
-                return lhs_->Evaluate(args) - rhs_->Evaluate(args);
-                
+                builder.EmitBinaryOp(Instruction::Op::Subtract);
+                break;
             case Multiply:
-                return lhs_->Evaluate(args) * rhs_->Evaluate(args);
-            
+                builder.EmitBinaryOp(Instruction::Op::Multiply);
+                break;
             case Divide:
-                
-                if (rhs_->Evaluate(args) == 0) 
-                    throw FormulaError(FormulaError::Category::Div0);
-                
-                return lhs_->Evaluate(args) / rhs_->Evaluate(args); 
-                
+                builder.EmitBinaryOp(Instruction::Op::Divide);
+                break;
             default:
                 throw std::invalid_argument("Unidentified operation type");
         }
@@ -186,31 +400,31 @@ public:
         , operand_(std::move(operand)) {
     }
 
-    void Print(std::ostream& out) const override {
+    void Print(std::ostream& out, Position anchor) const override {
         out << '(' << static_cast<char>(type_) << ' ';
-        operand_->Print(out);
+        operand_->Print(out, anchor);
         out << ')';
     }
 
-    void DoPrintFormula(std::ostream& out, ExprPrecedence precedence) const override {
+    void DoPrintFormula(std::ostream& out, ExprPrecedence precedence,
+                        Position anchor) const override {
         out << static_cast<char>(type_);
-        operand_->PrintFormula(out, precedence);
+        operand_->PrintFormula(out, precedence, anchor);
     }
 
     ExprPrecedence GetPrecedence() const override {
         return EP_UNARY;
     }
 
-// Реализуйте метод Evaluate() для унарных операций.
-    double Evaluate(std::function<double(Position)>& args) const override {
+    void Compile(ProgramBuilder& builder) const override {
+        operand_->Compile(builder);
+
         switch (type_) {
-                
             case UnaryPlus:
-                return operand_->Evaluate(args);
-                
+                break;
             case UnaryMinus:
-                return -operand_->Evaluate(args); 
-            
+                builder.EmitNegate();
+                break;
             default:
                 throw std::invalid_argument("Unidentified operation type");
         }
@@ -226,41 +440,144 @@ public:
     
     explicit CellExpr(const Position* cell) : cell_(cell) {}
  
-    void Print(std::ostream& out) const override {
-        if (!cell_->IsValid()) {
+    void Print(std::ostream& out, Position anchor) const override {
+        const Position pos = FromOffset(*cell_, anchor);
+        if (!pos.IsValid()) {
             out << FormulaError::Category::Ref;
         } else {
-            out << cell_->ToString();
+            out << pos.ToString();
         }
     }
  
-    void DoPrintFormula(std::ostream& out, ExprPrecedence) const override {
-        Print(out);
+    void DoPrintFormula(std::ostream& out, ExprPrecedence, Position anchor) const override {
+        Print(out, anchor);
     }
     
     ExprPrecedence GetPrecedence() const override {
         return EP_ATOM;
     }
  
-    double Evaluate(std::function<double(Position)>& args) const override {
-        return args(*cell_);
+    void Compile(ProgramBuilder& builder) const override {
+        builder.EmitCell(*cell_);
     }
  
 private:
     const Position* cell_;
 };
 
+// Диапазон A1:B2; допустим только как аргумент агрегатной функции
+class RangeExpr final : public Expr {
+public:
+    explicit RangeExpr(Range range) : range_(range) {}
+
+    void Print(std::ostream& out, Position anchor) const override {
+        out << FromOffset(range_, anchor).ToString();
+    }
+
+    void DoPrintFormula(std::ostream& out, ExprPrecedence, Position anchor) const override {
+        Print(out, anchor);
+    }
+
+    ExprPrecedence GetPrecedence() const override {
+        return EP_ATOM;
+    }
+
+    void Compile(ProgramBuilder&) const override {
+        throw std::invalid_argument("Range outside of a function");
+    }
+
+    void CompileArgument(ProgramBuilder& builder) const override {
+        builder.EmitRange(range_);
+    }
+
+private:
+    Range range_;
+};
+
+constexpr std::pair<std::string_view, AggregateFunction> FUNCTIONS[] = {
+    {"SUM", AggregateFunction::Sum},
+    {"AVERAGE", AggregateFunction::Average},
+    {"MIN", AggregateFunction::Min},
+    {"MAX", AggregateFunction::Max},
+    {"COUNT", AggregateFunction::Count},
+};
+
+std::optional<AggregateFunction> FindFunction(std::string_view name) {
+    for (const auto& [function_name, function] : FUNCTIONS) {
+        if (function_name == name) {
+            return function;
+        }
+    }
+    return std::nullopt;
+}
+
+std::string_view GetFunctionName(AggregateFunction function) {
+    for (const auto& [function_name, known_function] : FUNCTIONS) {
+        if (known_function == function) {
+            return function_name;
+        }
+    }
+    assert(false);
+    return {};
+}
+
+class FunctionExpr final : public Expr {
+public:
+    explicit FunctionExpr(AggregateFunction function, std::vector<std::unique_ptr<Expr>> args)
+        : function_(function)
+        , args_(std::move(args)) {
+    }
+
+    void Print(std::ostream& out, Position anchor) const override {
+        out << '(' << GetFunctionName(function_);
+        for (const auto& arg : args_) {
+            out << ' ';
+            arg->Print(out, anchor);
+        }
+        out << ')';
+    }
+
+    void DoPrintFormula(std::ostream& out, ExprPrecedence precedence,
+                        Position anchor) const override {
+        out << GetFunctionName(function_) << '(';
+        for (size_t i = 0; i < args_.size(); ++i) {
+            if (i > 0) {
+                out << ',';
+            }
+            args_[i]->PrintFormula(out, precedence, anchor);
+        }
+        out << ')';
+    }
+
+    ExprPrecedence GetPrecedence() const override {
+        return EP_ATOM;
+    }
+
+    void Compile(ProgramBuilder& builder) const override {
+        builder.EmitOp(Instruction::Op::BeginAggregate);
+        for (const auto& arg : args_) {
+            arg->CompileArgument(builder);
+        }
+        builder.EmitEndAggregate(function_);
+    }
+
+private:
+    AggregateFunction function_;
+    std::vector<std::unique_ptr<Expr>> args_;
+};
+
 class NumberExpr final : public Expr {
 public:
     explicit NumberExpr(double value)
         : value_(value) {
     }
 
-    void Print(std::ostream& out) const override {
+    void Print(std::ostream& out, Position /* anchor */) const override {
         out << value_;
     }
 
-    void DoPrintFormula(std::ostream& out, ExprPrecedence /* precedence */) const override {
+    void DoPrintFormula(std::ostream& out, ExprPrecedence /* precedence */,
+                        Position /* anchor */) const override {
         out << value_;
     }
 
@@ -268,15 +585,319 @@ public:
         return EP_ATOM;
     }
 
-// Для чисел метод возвращает значение числа.
-    double Evaluate(std::function<double(Position)>&) const override {
-        return value_;
+    void Compile(ProgramBuilder& builder) const override {
+        builder.EmitNumber(value_);
     }
 
 private:
     double value_;
 };
 
+// Лексер по правилам Formula.g4. Работает поверх исходной строки и ничего не аллоцирует.
+class Lexer {
+public:
+    enum class TokenType {
+        Number,
+        Cell,
+        Name,
+        Add,
+        Sub,
+        Mul,
+        Div,
+        LeftParen,
+        RightParen,
+        Colon,
+        Comma,
+        End,
+    };
+
+    struct Token {
+        TokenType type;
+        std::string_view text;
+    };
+
+    explicit Lexer(std::string_view input)
+        : input_(input) {
+    }
+
+    Token Next() {
+        while (pos_ < input_.size() && IsSpace(input_[pos_])) {
+            ++pos_;
+        }
+        if (pos_ == input_.size()) {
+            return {TokenType::End, {}};
+        }
+
+        const size_t start = pos_;
+        const char c = input_[pos_];
+        switch (c) {
+            case '+':
+                return Single(TokenType::Add);
+            case '-':
+                return Single(TokenType::Sub);
+            case '*':
+                return Single(TokenType::Mul);
+            case '/':
+                return Single(TokenType::Div);
+            case '(':
+                return Single(TokenType::LeftParen);
+            case ')':
+                return Single(TokenType::RightParen);
+            case ':':
+                return Single(TokenType::Colon);
+            case ',':
+                return Single(TokenType::Comma);
+            default:
+                break;
+        }
+
+        // CELL: [A-Z]+[0-9]+, FUNC: [A-Z]+
+        if (IsUpper(c)) {
+            SkipWhile(IsUpper);
+            const auto type = SkipWhile(IsDigit) ? TokenType::Cell : TokenType::Name;
+            return {type, input_.substr(start, pos_ - start)};
+        }
+
+        // NUMBER: UINT EXPONENT? | UINT? '.' UINT EXPONENT?
+        if (IsDigit(c) || c == '.') {
+            const bool has_int = SkipWhile(IsDigit);
+            if (pos_ < input_.size() && input_[pos_] == '.'
+                && pos_ + 1 < input_.size() && IsDigit(input_[pos_ + 1])) {
+                ++pos_;
+                SkipWhile(IsDigit);
+            } else if (!has_int) {
+                Fail(start);
+            }
+            SkipExponent();
+            return {TokenType::Number, input_.substr(start, pos_ - start)};
+        }
+
+        Fail(start);
+    }
+
+private:
+    std::string_view input_;
+    size_t pos_ = 0;
+
+    static bool IsSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+    }
+    static bool IsUpper(char c) {
+        return c >= 'A' && c <= 'Z';
+    }
+    static bool IsDigit(char c) {
+        return c >= '0' && c <= '9';
+    }
+
+    Token Single(TokenType type) {
+        return {type, input_.substr(pos_++, 1)};
+    }
+
+    template <typename Predicate>
+    bool SkipWhile(Predicate predicate) {
+        const size_t start = pos_;
+        while (pos_ < input_.size() && predicate(input_[pos_])) {
+            ++pos_;
+        }
+        return pos_ != start;
+    }
+
+    // EXPONENT: [eE] [-+]? UINT; если за 'e' нет цифр, экспонента не часть числа
+    void SkipExponent() {
+        size_t pos = pos_;
+        if (pos == input_.size() || (input_[pos] != 'e' && input_[pos] != 'E')) {
+            return;
+        }
+        ++pos;
+        if (pos < input_.size() && (input_[pos] == '+' || input_[pos] == '-')) {
+            ++pos;
+        }
+        if (pos < input_.size() && IsDigit(input_[pos])) {
+            pos_ = pos;
+            SkipWhile(IsDigit);
+        }
+    }
+
+    [[noreturn]] void Fail(size_t pos) const {
+        throw ParsingError("Error when lexing: unexpected symbol '"
+                           + std::string(1, input_[pos]) + "'");
+    }
+};
+
+// Парсер рекурсивным спуском. Приоритеты совпадают с Formula.g4:
+// унарные операции связывают сильнее умножения и деления, а те - сильнее
+// сложения и вычитания; бинарные операции левоассоциативны.
+// Позиции ссылок сразу переводятся в смещения от anchor.
+class Parser {
+public:
+    explicit Parser(std::string_view input, Position anchor)
+        : lexer_(input)
+        , token_(lexer_.Next())
+        , anchor_(anchor) {
+    }
+
+    std::unique_ptr<Expr> ParseMain() {
+        auto root = ParseSum();
+        Expect(Lexer::TokenType::End);
+        return root;
+    }
+
+    std::forward_list<Position> MoveCells() {
+        return std::move(cells_);
+    }
+
+private:
+    using TokenType = Lexer::TokenType;
+
+    Lexer lexer_;
+    Lexer::Token token_;
+    Position anchor_;
+    std::forward_list<Position> cells_;
+
+    void Advance() {
+        token_ = lexer_.Next();
+    }
+
+    void Expect(TokenType type) {
+        if (token_.type != type) {
+            Fail();
+        }
+        Advance();
+    }
+
+    [[noreturn]] void Fail() const {
+        if (token_.type == TokenType::End) {
+            throw ParsingError("Error when parsing: unexpected end of formula");
+        }
+        throw ParsingError("Error when parsing: " + std::string(token_.text));
+    }
+
+    std::unique_ptr<Expr> ParseSum() {
+        auto lhs = ParseProduct();
+        while (token_.type == TokenType::Add || token_.type == TokenType::Sub) {
+            const auto type = token_.type == TokenType::Add ? BinaryOpExpr::Add
+                                                            : BinaryOpExpr::Subtract;
+            Advance();
+            lhs = std::make_unique<BinaryOpExpr>(type, std::move(lhs), ParseProduct());
+        }
+        return lhs;
+    }
+
+    std::unique_ptr<Expr> ParseProduct() {
+        auto lhs = ParseUnary();
+        while (token_.type == TokenType::Mul || token_.type == TokenType::Div) {
+            const auto type = token_.type == TokenType::Mul ? BinaryOpExpr::Multiply
+                                                            : BinaryOpExpr::Divide;
+            Advance();
+            lhs = std::make_unique<BinaryOpExpr>(type, std::move(lhs), ParseUnary());
+        }
+        return lhs;
+    }
+
+    std::unique_ptr<Expr> ParseUnary() {
+        if (token_.type == TokenType::Add || token_.type == TokenType::Sub) {
+            const auto type = token_.type == TokenType::Add ? UnaryOpExpr::UnaryPlus
+                                                            : UnaryOpExpr::UnaryMinus;
+            Advance();
+            return std::make_unique<UnaryOpExpr>(type, ParseUnary());
+        }
+        return ParseAtom();
+    }
+
+    std::unique_ptr<Expr> ParseAtom() {
+        switch (token_.type) {
+            case TokenType::LeftParen: {
+                Advance();
+                auto expr = ParseSum();
+                Expect(TokenType::RightParen);
+                return expr;
+            }
+            case TokenType::Number: {
+                auto node = std::make_unique<NumberExpr>(ParseNumber(token_.text));
+                Advance();
+                return node;
+            }
+            case TokenType::Cell:
+                cells_.push_front(ToOffset(ParsePosition(), anchor_));
+                return std::make_unique<CellExpr>(&cells_.front());
+            case TokenType::Name:
+                return ParseFunction();
+            default:
+                Fail();
+        }
+    }
+
+    Position ParsePosition() {
+        auto value = Position::FromString(token_.text);
+        if (!value.IsValid()) {
+            throw FormulaException("Invalid position: " + std::string(token_.text));
+        }
+        Advance();
+        return value;
+    }
+
+    // FUNC '(' arg (',' arg)* ')'
+    std::unique_ptr<Expr> ParseFunction() {
+        const auto function = FindFunction(token_.text);
+        if (!function) {
+            throw ParsingError("Unknown function: " + std::string(token_.text));
+        }
+        Advance();
+        Expect(TokenType::LeftParen);
+
+        std::vector<std::unique_ptr<Expr>> args;
+        args.push_back(ParseArgument());
+        while (token_.type == TokenType::Comma) {
+            Advance();
+            args.push_back(ParseArgument());
+        }
+        Expect(TokenType::RightParen);
+        return std::make_unique<FunctionExpr>(*function, std::move(args));
+    }
+
+    // arg: CELL ':' CELL | expr
+    std::unique_ptr<Expr> ParseArgument() {
+        if (token_.type == TokenType::Cell) {
+            Lexer lookahead = lexer_;
+            if (lookahead.Next().type == TokenType::Colon) {
+                const auto first = ParsePosition();
+                Advance();
+                if (token_.type != TokenType::Cell) {
+                    Fail();
+                }
+                const auto last = ParsePosition();
+                const auto range = Range::FromCorners(first, last);
+                return std::make_unique<RangeExpr>(
+                    Range{ToOffset(range.first, anchor_), ToOffset(range.last, anchor_)});
+            }
+        }
+        return ParseSum();
+    }
+
+    // Переполнение, как и при чтении через std::istream, считается ошибкой
+    static double ParseNumber(std::string_view text) {
+        constexpr size_t BUFFER_SIZE = 64;
+        char buffer[BUFFER_SIZE];
+        std::string long_text;
+        const char* str = buffer;
+        if (text.size() < BUFFER_SIZE) {
+            std::copy(text.begin(), text.end(), buffer);
+            buffer[text.size()] = '\0';
+        } else {
+            long_text = text;
+            str = long_text.c_str();
+        }
+
+        const double value = std::strtod(str, nullptr);
+        if (value == HUGE_VAL) {
+            throw ParsingError("Invalid number: " + std::string(text));
+        }
+        return value;
+    }
+};
+
+#ifdef SPREADSHEET_ANTLR_ORACLE
+
 class ParseASTListener final : public FormulaBaseListener {
 public:
     std::unique_ptr<Expr> MoveRoot() {
@@ -361,6 +982,35 @@ public:
         args_.push_back(std::move(node));
     }
 
+    void exitRange(FormulaParser::RangeContext* ctx) override {
+        Position corners[2];
+        for (size_t i = 0; i < 2; ++i) {
+            auto value_str = ctx->CELL(i)->getSymbol()->getText();
+            corners[i] = Position::FromString(value_str);
+            if (!corners[i].IsValid()) {
+                throw FormulaException("Invalid position: " + value_str);
+            }
+        }
+        args_.push_back(std::make_unique<RangeExpr>(Range::FromCorners(corners[0], corners[1])));
+    }
+
+    void exitFunction(FormulaParser::FunctionContext* ctx) override {
+        auto name = ctx->FUNC()->getSymbol()->getText();
+        const auto function = FindFunction(name);
+        if (!function) {
+            throw ParsingError("Unknown function: " + name);
+        }
+
+        const size_t arg_count = ctx->arg().size();
+        assert(args_.size() >= arg_count);
+        std::vector<std::unique_ptr<Expr>> args(
+            std::make_move_iterator(args_.end() - arg_count),
+            std::make_move_iterator(args_.end()));
+        args_.resize(args_.size() - arg_count);
+
+        args_.push_back(std::make_unique<FunctionExpr>(*function, std::move(args)));
+    }
+
     void visitErrorNode(antlr4::tree::ErrorNode* node) override {
         throw ParsingError("Error when parsing: " + node->getSymbol()->getText());
     }
@@ -380,10 +1030,61 @@ public:
     }
 };
 
+#endif  // SPREADSHEET_ANTLR_ORACLE
+
 }  // namespace
 }  // namespace ASTImpl
 
 FormulaAST ParseFormulaAST(std::istream& in) {
+    std::string in_str{std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+    return ParseFormulaAST(in_str);
+}
+
+FormulaAST ParseFormulaAST(const std::string& in_str) {
+    return ParseFormulaAST(in_str, Position{0, 0});
+}
+
+FormulaAST ParseFormulaAST(const std::string& in_str, Position anchor) {
+    try {
+        ASTImpl::Parser parser(in_str, anchor);
+        auto root = parser.ParseMain();
+        return FormulaAST(std::move(root), parser.MoveCells());
+    } catch (const std::exception& exc) {
+        std::throw_with_nested(FormulaException(exc.what()));
+    }
+}
+
+// Лексемы через пробел; ссылки на ячейки заменены смещениями от anchor
+std::string GetFormulaShape(std::string_view expression, Position anchor) {
+    using TokenType = ASTImpl::Lexer::TokenType;
+    try {
+        ASTImpl::Lexer lexer(expression);
+        std::string shape;
+        shape.reserve(expression.size() + 16);
+
+        for (auto token = lexer.Next(); token.type != TokenType::End; token = lexer.Next()) {
+            const Position pos = token.type == TokenType::Cell ? Position::FromString(token.text)
+                                                               : Position::NONE;
+            if (pos.IsValid()) {
+                const Position offset = ToOffset(pos, anchor);
+                shape += '$';
+                shape += std::to_string(offset.row);
+                shape += ',';
+                shape += std::to_string(offset.col);
+            } else {
+                shape += token.text;
+            }
+            shape += ' ';
+        }
+        return shape;
+    } catch (const std::exception& exc) {
+        std::throw_with_nested(FormulaException(exc.what()));
+    }
+}
+
+#ifdef SPREADSHEET_ANTLR_ORACLE
+
+static FormulaAST ParseFormulaASTWithAntlr(std::istream& in) {
     using namespace antlr4;
 
     ANTLRInputStream input(in);
@@ -407,31 +1108,234 @@ FormulaAST ParseFormulaAST(std::istream& in) {
     return FormulaAST(listener.MoveRoot(), listener.MoveCells());
 }
 
-FormulaAST ParseFormulaAST(const std::string& in_str) {
+FormulaAST ParseFormulaASTWithAntlr(const std::string& in_str) {
     std::istringstream in(in_str);
     try {
-        return ParseFormulaAST(in);
+        return ParseFormulaASTWithAntlr(in);
     } catch (const std::exception& exc) {
         std::throw_with_nested(FormulaException(exc.what()));
     }
 }
 
+#endif  // SPREADSHEET_ANTLR_ORACLE
+
+namespace {
+constexpr std::uint64_t ERROR_NAN_BITS = 0x7FF8'0000'0000'0000;
+constexpr std::uint64_t ERROR_PAYLOAD_MASK = 0xFF;
+}  // namespace
+
+double MakeErrorValue(FormulaError::Category category) {
+    const std::uint64_t bits = ERROR_NAN_BITS | (static_cast<std::uint64_t>(category) + 1);
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+FormulaError GetErrorValue(double value) {
+    std::uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    switch (bits & ERROR_PAYLOAD_MASK) {
+        case static_cast<std::uint64_t>(FormulaError::Category::Ref) + 1:
+            return FormulaError::Category::Ref;
+        case static_cast<std::uint64_t>(FormulaError::Category::Value) + 1:
+            return FormulaError::Category::Value;
+        default:
+            return FormulaError::Category::Div0;
+    }
+}
+
+// Четыре независимые цепочки накопления: итерации не ждут результата друг друга,
+// и компилятор раскладывает цепочки по SIMD-регистрам без -ffast-math.
+// NaN не проходит сравнения, поэтому ошибки не портят min/max и считаются отдельно.
+void RangeAggregate::Add(const double* values, std::size_t size) {
+    constexpr std::size_t LANES = 4;
+    double sums[LANES] = {};
+    double mins[LANES] = {min, min, min, min};
+    double maxs[LANES] = {max, max, max, max};
+    std::size_t nans[LANES] = {};
+
+    std::size_t i = 0;
+    for (; i + LANES <= size; i += LANES) {
+        for (std::size_t lane = 0; lane < LANES; ++lane) {
+            const double value = values[i + lane];
+            sums[lane] += value;
+            mins[lane] = value < mins[lane] ? value : mins[lane];
+            maxs[lane] = value > maxs[lane] ? value : maxs[lane];
+            nans[lane] += value != value;
+        }
+    }
+    for (; i < size; ++i) {
+        const double value = values[i];
+        sums[0] += value;
+        mins[0] = value < mins[0] ? value : mins[0];
+        maxs[0] = value > maxs[0] ? value : maxs[0];
+        nans[0] += value != value;
+    }
+
+    sum += (sums[0] + sums[1]) + (sums[2] + sums[3]);
+    min = std::min({mins[0], mins[1], mins[2], mins[3]});
+    max = std::max({maxs[0], maxs[1], maxs[2], maxs[3]});
+    count += size;
+    errors += nans[0] + nans[1] + nans[2] + nans[3];
+}
+
+// Ошибка любого значения становится результатом; она уже лежит в sum как NaN
+double RangeAggregate::GetResult(AggregateFunction function) const {
+    if (function == AggregateFunction::Count) {
+        return static_cast<double>(count - errors);
+    }
+    if (errors > 0) {
+        return sum;
+    }
+
+    switch (function) {
+        case AggregateFunction::Sum:
+            return sum;
+        case AggregateFunction::Average:
+            return count == 0 ? MakeErrorValue(FormulaError::Category::Div0)
+                              : sum / static_cast<double>(count);
+        case AggregateFunction::Min:
+            return count == 0 ? 0.0 : min;
+        case AggregateFunction::Max:
+            return count == 0 ? 0.0 : max;
+        default:
+            assert(false);
+            return 0.0;
+    }
+}
+
+std::uint32_t Instruction::PackOffset(Position offset) {
+    return static_cast<std::uint32_t>(static_cast<std::uint16_t>(offset.row)) << 16
+        | static_cast<std::uint16_t>(offset.col);
+}
+
+Position Instruction::UnpackOffset(std::uint32_t packed) {
+    return {static_cast<std::int16_t>(packed >> 16), static_cast<std::int16_t>(packed & 0xFFFF)};
+}
+
 FormulaAST::FormulaAST(std::unique_ptr<ASTImpl::Expr> root_expr, std::forward_list<Position> cells) 
     : root_expr_(std::move(root_expr)), cells_(std::move(cells)) {
-        
+
+        ASTImpl::ProgramBuilder builder;
+        root_expr_->Compile(builder);
+        program_ = builder.MoveProgram();
+        ranges_ = builder.MoveRanges();
+        stack_size_ = builder.GetMaxDepth();
+        aggregate_depth_ = builder.GetMaxAggregateDepth();
+
         cells_.sort();
 }
 
-void FormulaAST::Print(std::ostream& out) const {
-    root_expr_->Print(out);
+void FormulaAST::Print(std::ostream& out, Position anchor) const {
+    root_expr_->Print(out, anchor);
 }
 
-void FormulaAST::PrintFormula(std::ostream& out) const {
-    root_expr_->PrintFormula(out, ASTImpl::EP_ATOM);
+void FormulaAST::PrintFormula(std::ostream& out, Position anchor) const {
+    root_expr_->PrintFormula(out, ASTImpl::EP_ATOM, anchor);
 }
 
-double FormulaAST::Execute(std::function<double(Position)>& args) const {
-    return root_expr_->Evaluate(args);
+double FormulaAST::Execute(const CellReader& reader, Position anchor) const {
+    using Op = Instruction::Op;
+
+    // короткие формулы считаются на стеке вызова, длинные - в куче
+    constexpr size_t SMALL_STACK_SIZE = 32;
+    double small_stack[SMALL_STACK_SIZE] = {};
+    std::vector<double> large_stack;
+    double* stack = small_stack;
+    if (stack_size_ > SMALL_STACK_SIZE) {
+        large_stack.resize(stack_size_);
+        stack = large_stack.data();
+    }
+
+    // накопители вложенных агрегатных функций
+    constexpr size_t SMALL_AGGREGATES_SIZE = 4;
+    RangeAggregate small_aggregates[SMALL_AGGREGATES_SIZE];
+    std::vector<RangeAggregate> large_aggregates;
+    RangeAggregate* aggregates = small_aggregates;
+    if (aggregate_depth_ > SMALL_AGGREGATES_SIZE) {
+        large_aggregates.resize(aggregate_depth_);
+        aggregates = large_aggregates.data();
+    }
+
+    const double div0 = MakeErrorValue(FormulaError::Category::Div0);
+
+    double* top = stack;
+    RangeAggregate* aggregate = aggregates;
+    for (const Instruction& instruction : program_) {
+        switch (instruction.op) {
+            case Op::PushNumber:
+                *top++ = instruction.number;
+                break;
+            case Op::PushCell:
+                *top++ = reader(FromOffset(Instruction::UnpackOffset(instruction.cell), anchor));
+                break;
+            case Op::Add:
+                --top;
+                top[-1] += *top;
+                break;
+            case Op::Subtract:
+                --top;
+                top[-1] -= *top;
+                break;
+            case Op::Multiply:
+                --top;
+                top[-1] *= *top;
+                break;
+            case Op::Divide:
+                --top;
+                top[-1] = *top == 0 ? div0 : top[-1] / *top;
+                break;
+            case Op::Negate:
+                top[-1] = -top[-1];
+                break;
+            case Op::AddNumber:
+                top[-1] += instruction.number;
+                break;
+            case Op::AddCell:
+                top[-1] += reader(FromOffset(Instruction::UnpackOffset(instruction.cell), anchor));
+                break;
+            case Op::SubtractNumber:
+                top[-1] -= instruction.number;
+                break;
+            case Op::SubtractCell:
+                top[-1] -= reader(FromOffset(Instruction::UnpackOffset(instruction.cell), anchor));
+                break;
+            case Op::MultiplyNumber:
+                top[-1] *= instruction.number;
+                break;
+            case Op::MultiplyCell:
+                top[-1] *= reader(FromOffset(Instruction::UnpackOffset(instruction.cell), anchor));
+                break;
+            case Op::DivideNumber:
+                top[-1] = instruction.number == 0 ? div0 : top[-1] / instruction.number;
+                break;
+            case Op::DivideCell: {
+                const double divisor = reader(FromOffset(Instruction::UnpackOffset(instruction.cell), anchor));
+                top[-1] = divisor == 0 ? div0 : top[-1] / divisor;
+                break;
+            }
+            case Op::BeginAggregate:
+                *aggregate++ = RangeAggregate{};
+                break;
+            case Op::AggregateValue:
+                --top;
+                aggregate[-1].Add(top, 1);
+                break;
+            case Op::AggregateRange:
+                reader(FromOffset(ranges_[instruction.index], anchor), aggregate[-1]);
+                break;
+            case Op::EndAggregate:
+                --aggregate;
+                *top++ = aggregate->GetResult(instruction.function);
+                break;
+        }
+    }
+
+    assert(top == stack + 1);
+    return *stack;
 }
 
+FormulaAST::FormulaAST(FormulaAST&&) noexcept = default;
+FormulaAST& FormulaAST::operator=(FormulaAST&&) noexcept = default;
 FormulaAST::~FormulaAST() = default;
\ No newline at end of file
@@ -1,11 +1,13 @@
 #pragma once
 
-#include "FormulaLexer.h"
 #include "common.h"
 
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
 #include <forward_list>
-#include <functional>
 #include <stdexcept>
+#include <vector>
 
 namespace ASTImpl {
     class Expr;
@@ -15,25 +17,185 @@ class ParsingError : public std::runtime_error {
     using std::runtime_error::runtime_error;
 };
 
+// Ошибки вычисления передаются прямо в double: это тихий NaN, в младших битах
+// которого записана категория ошибки (NaN-boxing). Арифметика сохраняет
+// полезную нагрузку NaN, поэтому ошибка доходит до результата без исключений.
+double MakeErrorValue(FormulaError::Category category);
+
+inline bool IsErrorValue(double value) {
+    return value != value;
+}
+
+// NaN без известной категории (например, inf - inf) считается ошибкой Div0
+FormulaError GetErrorValue(double value);
+
+// Ссылки формулы хранятся как смещения от якоря - позиции, относительно которой
+// формула разобрана. Формулы одной формы в разных ячейках (=B2*C2 в D2, =B3*C3 в D3)
+// получают одинаковые смещения и могут разделять одну программу.
+inline Position ToOffset(Position pos, Position anchor) {
+    return {pos.row - anchor.row, pos.col - anchor.col};
+}
+
+inline Position FromOffset(Position offset, Position anchor) {
+    return {offset.row + anchor.row, offset.col + anchor.col};
+}
+
+inline Range FromOffset(const Range& offset, Position anchor) {
+    return {FromOffset(offset.first, anchor), FromOffset(offset.last, anchor)};
+}
+
+// Встроенные агрегатные функции над диапазонами и списками аргументов
+enum class AggregateFunction : std::uint8_t {
+    Sum,
+    Average,
+    Min,
+    Max,
+    Count,
+};
+
+// Накопитель агрегатных функций. Значения подаются блоками из непрерывной памяти,
+// ошибки (NaN) учитываются в сумме и счётчике ошибок без ветвлений.
+struct RangeAggregate {
+    double sum = 0.0;
+    double min = HUGE_VAL;
+    double max = -HUGE_VAL;
+    std::size_t count = 0;
+    std::size_t errors = 0;
+
+    void Add(const double* values, std::size_t size);
+    double GetResult(AggregateFunction function) const;
+};
+
+// Невладеющая ссылка на функции чтения ячеек: double(Position) возвращает значение
+// ячейки, void(const Range&, RangeAggregate&) добавляет в накопитель значения
+// непустых ячеек диапазона. В отличие от std::function не аллоцирует память
+// и не копирует функторы.
+class CellReader {
+public:
+    template <typename Func>
+    explicit CellReader(const Func& func)
+        : context_(&func)
+        , read_([](const void* context, Position pos) {
+            return (*static_cast<const Func*>(context))(pos);
+        })
+        , range_context_(nullptr)
+        , read_range_([](const void*, const Range&, RangeAggregate&) {
+            throw std::logic_error("Range reader is not set");
+        }) {
+    }
+
+    template <typename Func, typename RangeFunc>
+    CellReader(const Func& func, const RangeFunc& range_func)
+        : context_(&func)
+        , read_([](const void* context, Position pos) {
+            return (*static_cast<const Func*>(context))(pos);
+        })
+        , range_context_(&range_func)
+        , read_range_([](const void* context, const Range& range, RangeAggregate& aggregate) {
+            (*static_cast<const RangeFunc*>(context))(range, aggregate);
+        }) {
+    }
+
+    double operator()(Position pos) const {
+        return read_(context_, pos);
+    }
+
+    void operator()(const Range& range, RangeAggregate& aggregate) const {
+        read_range_(range_context_, range, aggregate);
+    }
+
+private:
+    const void* context_;
+    double (*read_)(const void*, Position);
+    const void* range_context_;
+    void (*read_range_)(const void*, const Range&, RangeAggregate&);
+};
+
+// Инструкция байткода формулы. Программа записана в постфиксной форме:
+// константы и смещения ячеек хранятся прямо в инструкции.
+struct Instruction {
+    enum class Op : std::uint8_t {
+        PushNumber,
+        PushCell,
+        Add,
+        Subtract,
+        Multiply,
+        Divide,
+        Negate,
+        // бинарная операция, правый операнд которой записан в самой инструкции
+        AddNumber,
+        AddCell,
+        SubtractNumber,
+        SubtractCell,
+        MultiplyNumber,
+        MultiplyCell,
+        DivideNumber,
+        DivideCell,
+        // агрегатная функция: открывает накопитель, добавляет в него значение
+        // с вершины стека или диапазон ranges[index], закрывает с результатом на стеке
+        BeginAggregate,
+        AggregateValue,
+        AggregateRange,
+        EndAggregate,
+    };
+
+    // по 16 бит со знаком на смещение строки и столбца
+    static std::uint32_t PackOffset(Position offset);
+    static Position UnpackOffset(std::uint32_t packed);
+
+    Op op;
+    union {
+        double number;
+        std::uint32_t cell;
+        std::uint32_t index;
+        AggregateFunction function;
+    };
+};
+
 class FormulaAST {
 public:
     explicit FormulaAST(std::unique_ptr<ASTImpl::Expr> root_expr,
                         std::forward_list<Position> cells);
-    FormulaAST(FormulaAST&&) = default;
-    FormulaAST& operator=(FormulaAST&&) = default;
+    FormulaAST(FormulaAST&&) noexcept;
+    FormulaAST& operator=(FormulaAST&&) noexcept;
     ~FormulaAST();
 
-    double Execute(std::function<double(Position)>& args) const;
-    void Print(std::ostream& out) const;
-    void PrintFormula(std::ostream& out) const;
+    // Возвращает число либо ошибку, упакованную в NaN (см. MakeErrorValue).
+    // reader получает абсолютные позиции: смещения ссылок плюс anchor.
+    double Execute(const CellReader& reader, Position anchor = {0, 0}) const;
+    void Print(std::ostream& out, Position anchor = {0, 0}) const;
+    void PrintFormula(std::ostream& out, Position anchor = {0, 0}) const;
 
+    // Смещения ячеек, отсортированные по возрастанию
     std::forward_list<Position>& GetCells() {return cells_;}
     const std::forward_list<Position>& GetCells() const {return cells_;}
 
+    // Смещения диапазонов в порядке появления в программе, возможны повторы
+    const std::vector<Range>& GetRanges() const {return ranges_;}
+
+    const std::vector<Instruction>& GetProgram() const {return program_;}
+
 private:
     std::unique_ptr<ASTImpl::Expr> root_expr_;
     std::forward_list<Position> cells_;
+
+    std::vector<Instruction> program_;
+    std::vector<Range> ranges_;
+    size_t stack_size_ = 0;
+    size_t aggregate_depth_ = 0;
 };
 
 FormulaAST ParseFormulaAST(std::istream& in);
-FormulaAST ParseFormulaAST(const std::string& in_str);
\ No newline at end of file
+FormulaAST ParseFormulaAST(const std::string& in_str);
+// Ссылки хранятся как смещения от anchor
+FormulaAST ParseFormulaAST(const std::string& in_str, Position anchor);
+
+// Форма формулы: её лексемы, в которых ссылки заменены смещениями от anchor.
+// Формулы с одинаковой формой разбираются в одинаковые деревья и программы.
+// Бросает FormulaException, если выражение не разбивается на лексемы.
+std::string GetFormulaShape(std::string_view expression, Position anchor);
+
+#ifdef SPREADSHEET_ANTLR_ORACLE
+// Разбор исходным конвейером ANTLR. Оставлен как эталон для сравнения в тестах.
+FormulaAST ParseFormulaASTWithAntlr(const std::string& in_str);
+#endif
\ No newline at end of file
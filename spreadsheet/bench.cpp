@@ -0,0 +1,922 @@
+#include <malloc.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common.h"
+#include "dependency_graph.h"
+#include "formula.h"
+#include "log_duration.h"
+#include "sheet.h"
+#include "sheet_file.h"
+#include "sheet_import.h"
+#include "sheet_snapshot.h"
+
+namespace {
+
+Position operator"" _pos(const char* str, std::size_t) {
+    return Position::FromString(str);
+}
+
+constexpr int BENCH_ROWS = 1000;
+constexpr int BENCH_COLS = 200;
+
+// Байты кучи, занятые сейчас (glibc)
+size_t GetHeapInUse() {
+    return mallinfo2().uordblks;
+}
+
+// Резидентная память процесса в байтах (Linux)
+size_t GetResidentMemory() {
+    std::ifstream statm("/proc/self/statm");
+    size_t pages = 0;
+    size_t resident = 0;
+    statm >> pages >> resident;
+    return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+std::vector<Position> MakeDenseBlock() {
+    std::vector<Position> positions;
+    positions.reserve(BENCH_ROWS * BENCH_COLS);
+    for (int row = 0; row < BENCH_ROWS; ++row) {
+        for (int col = 0; col < BENCH_COLS; ++col) {
+            positions.push_back({row, col});
+        }
+    }
+    return positions;
+}
+
+// Сравнивает прежнее хранилище ячеек (хеш-таблица) с блочным
+void BenchmarkCellStorage() {
+    using HashStorage = std::unordered_map<Position, CellPtr, Table::PHasher>;
+
+    Sheet sheet;
+    auto payload = std::make_shared<Cell>(sheet);
+
+    auto sequential = MakeDenseBlock();
+    auto random = sequential;
+    std::shuffle(random.begin(), random.end(), std::mt19937{42});
+
+    std::cerr << "--- cell storage, " << sequential.size() << " cells ---" << std::endl;
+
+    HashStorage hash_storage;
+    TileGrid<CellPtr> tile_storage;
+    {
+        LOG_DURATION("hash map: insert");
+        for (const auto pos : random) {
+            hash_storage[pos] = payload;
+        }
+    }
+    {
+        LOG_DURATION("tile grid: insert");
+        for (const auto pos : random) {
+            tile_storage.Set(pos, payload);
+        }
+    }
+
+    const auto lookup_all = [](const auto& positions, const auto& find) {
+        size_t found = 0;
+        for (int pass = 0; pass < 10; ++pass) {
+            for (const auto pos : positions) {
+                found += find(pos) != nullptr;
+            }
+        }
+        return found;
+    };
+    const auto hash_find = [&hash_storage](Position pos) -> const Cell* {
+        auto it = hash_storage.find(pos);
+        return it == hash_storage.end() ? nullptr : it->second.get();
+    };
+    const auto tile_find = [&tile_storage](Position pos) -> const Cell* {
+        return tile_storage.Get(pos).get();
+    };
+
+    size_t found = 0;
+    {
+        LOG_DURATION("hash map: sequential lookup x10");
+        found += lookup_all(sequential, hash_find);
+    }
+    {
+        LOG_DURATION("tile grid: sequential lookup x10");
+        found += lookup_all(sequential, tile_find);
+    }
+    {
+        LOG_DURATION("hash map: random lookup x10");
+        found += lookup_all(random, hash_find);
+    }
+    {
+        LOG_DURATION("tile grid: random lookup x10");
+        found += lookup_all(random, tile_find);
+    }
+    {
+        LOG_DURATION("tile grid: row-major ForEach x10");
+        for (int pass = 0; pass < 10; ++pass) {
+            tile_storage.ForEach([&found](Position, const CellPtr& cell) {
+                found += cell != nullptr;
+            });
+        }
+    }
+    std::cerr << "(found " << found << ")" << std::endl;
+}
+
+void BenchmarkSheet() {
+    std::cerr << "--- sheet, " << BENCH_ROWS << "x" << BENCH_COLS << " ---" << std::endl;
+
+    auto sheet = CreateSheet();
+    {
+        LOG_DURATION("SetCell: numbers and formulas");
+        for (int row = 0; row < BENCH_ROWS; ++row) {
+            sheet->SetCell({row, 0}, std::to_string(row));
+            for (int col = 1; col < BENCH_COLS; ++col) {
+                sheet->SetCell({row, col}, "=" + Position{row, col - 1}.ToString() + "+1");
+            }
+        }
+    }
+    {
+        LOG_DURATION("GetValue: all cells");
+        double sum = 0;
+        for (int row = 0; row < BENCH_ROWS; ++row) {
+            for (int col = 1; col < BENCH_COLS; ++col) {
+                sum += std::get<double>(sheet->GetCell({row, col})->GetValue());
+            }
+        }
+        std::cerr << "(sum " << sum << ")" << std::endl;
+    }
+    {
+        std::ostringstream out;
+        LOG_DURATION("PrintValues");
+        sheet->PrintValues(out);
+    }
+}
+
+void BenchmarkFormulaEvaluation() {
+    constexpr int ITERATIONS = 1'000'000;
+    std::cerr << "--- formula evaluation, " << ITERATIONS << " runs ---" << std::endl;
+
+    auto sheet = CreateSheet();
+    sheet->SetCell("A1"_pos, "3");
+    sheet->SetCell("B1"_pos, "=A1*2");
+    sheet->SetCell("C1"_pos, "7");
+
+    auto formula = ParseFormula("A1*2+B1/3-(C1+4)*-1.5");
+    double sum = 0;
+    {
+        LOG_DURATION("Evaluate: small formula with references");
+        for (int i = 0; i < ITERATIONS; ++i) {
+            sum += std::get<double>(formula->Evaluate(*sheet));
+        }
+    }
+    auto constant = ParseFormula("(2*3.5+1)/4*(1+2+3+4)-8");
+    {
+        LOG_DURATION("Evaluate: constant formula");
+        for (int i = 0; i < ITERATIONS; ++i) {
+            sum += std::get<double>(constant->Evaluate(*sheet));
+        }
+    }
+    std::cerr << "(sum " << sum << ")" << std::endl;
+}
+
+// Столбец #DIV/0!, от которого зависят ещё два столбца формул
+void BenchmarkErrorPropagation() {
+    constexpr int ROWS = 10'000;
+    std::cerr << "--- error propagation, " << ROWS << " rows x 3 columns ---" << std::endl;
+
+    auto sheet = CreateSheet();
+    for (int row = 0; row < ROWS; ++row) {
+        const auto row_str = std::to_string(row + 1);
+        sheet->SetCell({row, 0}, "=1/0");
+        sheet->SetCell({row, 1}, "=A" + row_str + "+1");
+        sheet->SetCell({row, 2}, "=B" + row_str + "*2+A" + row_str);
+    }
+
+    size_t errors = 0;
+    {
+        LOG_DURATION("GetValue: error cells");
+        for (int row = 0; row < ROWS; ++row) {
+            for (int col = 0; col < 3; ++col) {
+                errors += std::holds_alternative<FormulaError>(sheet->GetCell({row, col})->GetValue());
+            }
+        }
+    }
+    auto formula = ParseFormula("A1+B1*C1");
+    {
+        LOG_DURATION("Evaluate: formula over error cells x1M");
+        for (int i = 0; i < 1'000'000; ++i) {
+            errors += std::holds_alternative<FormulaError>(formula->Evaluate(*sheet));
+        }
+    }
+    std::cerr << "(errors " << errors << ")" << std::endl;
+}
+
+// Широкий лист: независимые столбцы, в каждом цепочка формул
+void BenchmarkParallelRecalculation() {
+    constexpr int ROWS = 200;
+    constexpr int COLS = 2'000;
+    const size_t threads = std::max(2u, std::thread::hardware_concurrency());
+    std::cerr << "--- recalculation, " << COLS << " independent columns x " << ROWS
+              << " rows ---" << std::endl;
+
+    Sheet sheet;
+    for (int col = 0; col < COLS; ++col) {
+        sheet.SetCell({0, col}, std::to_string(col));
+        for (int row = 1; row < ROWS; ++row) {
+            const auto up = Position{row - 1, col}.ToString();
+            sheet.SetCell({row, col}, "=" + up + "*1.0001+" + up + "/7");
+        }
+    }
+
+    for (const size_t thread_count : {size_t(1), threads}) {
+        sheet.SetRecalculationThreads(thread_count);
+        for (int col = 0; col < COLS; ++col) {
+            sheet.SetCell({0, col}, std::to_string(col + thread_count));
+        }
+        LOG_DURATION("Recalculate, " + std::to_string(thread_count) + " thread(s)");
+        sheet.Recalculate();
+    }
+}
+
+// Время установки формулы не должно расти вместе с числом зависимых ячеек
+void BenchmarkSetFormulaLatency() {
+    constexpr int WIDTH = 100;
+    constexpr int UPDATES = 1'000;
+    auto chain_pos = [](int i) {
+        return Position{i / WIDTH, i % WIDTH};
+    };
+
+    for (const int length : {1'000, 10'000, 100'000}) {
+        std::cerr << "--- set formula, chain of " << length << " cells ---" << std::endl;
+        Sheet sheet;
+        sheet.SetCell(chain_pos(0), "1");
+        for (int i = 1; i < length; ++i) {
+            sheet.SetCell(chain_pos(i), "=" + chain_pos(i - 1).ToString() + "+1");
+        }
+
+        const auto head = chain_pos(0).ToString();
+        LOG_DURATION("SetCell at chain head x" + std::to_string(UPDATES));
+        for (int i = 0; i < UPDATES; ++i) {
+            sheet.SetCell(chain_pos(1), "=" + head + "+" + std::to_string(i));
+        }
+    }
+}
+
+// Сетка ромбовидных зависимостей: правка входа и чтение одной ячейки на выходе
+void BenchmarkEditInDependencyWeb() {
+    constexpr int LAYERS = 200;
+    constexpr int WIDTH = 50;
+    constexpr int EDITS = 200;
+    std::cerr << "--- edits in a dependency web, " << LAYERS << " layers x " << WIDTH
+              << " cells ---" << std::endl;
+
+    Sheet sheet;
+    for (int col = 0; col < WIDTH; ++col) {
+        sheet.SetCell({0, col}, std::to_string(col));
+    }
+    for (int row = 1; row < LAYERS; ++row) {
+        for (int col = 0; col < WIDTH; ++col) {
+            sheet.SetCell({row, col}, "=" + Position{row - 1, col}.ToString() + "/2+" +
+                                          Position{row - 1, (col + 1) % WIDTH}.ToString() + "/2");
+        }
+    }
+    const Position output{LAYERS - 1, 0};
+    sheet.GetCell(output)->GetValue();
+
+    LogDuration::Clock::duration writes{};
+    {
+        LOG_DURATION("SetCell + GetValue of one output x" + std::to_string(EDITS));
+        for (int i = 0; i < EDITS; ++i) {
+            const auto start = LogDuration::Clock::now();
+            sheet.SetCell({0, i % WIDTH}, std::to_string(i));
+            writes += LogDuration::Clock::now() - start;
+            sheet.GetCell(output)->GetValue();
+        }
+    }
+    std::cerr << "  of which SetCell: "
+              << std::chrono::duration_cast<std::chrono::microseconds>(writes).count() / 1000.0
+              << " ms" << std::endl;
+}
+
+// Импорт блока ячеек по одной и одним пакетом
+void BenchmarkBatchImport() {
+    constexpr int ROWS = 1'000;
+    constexpr int COLS = 100;
+    std::cerr << "--- import, " << ROWS * COLS << " cells ---" << std::endl;
+
+    std::vector<std::pair<Position, std::string>> cells;
+    cells.reserve(ROWS * COLS);
+    for (int row = 0; row < ROWS; ++row) {
+        for (int col = 0; col < COLS; ++col) {
+            if (row == 0 || col % 2 == 0) {
+                cells.push_back({{row, col}, std::to_string(row * col)});
+            } else {
+                cells.push_back({{row, col}, "=" + Position{row - 1, col}.ToString() + "+" +
+                                                 Position{row, col - 1}.ToString()});
+            }
+        }
+    }
+
+    {
+        Sheet sheet;
+        LOG_DURATION("SetCell one by one");
+        for (const auto& [pos, text] : cells) {
+            sheet.SetCell(pos, text);
+        }
+    }
+    {
+        Sheet sheet;
+        auto batch = cells;
+        LOG_DURATION("SetCells");
+        sheet.SetCells(std::move(batch));
+    }
+}
+
+// Память и обход графа зависимостей: каждая формула ссылается на соседние ячейки
+void BenchmarkRangeAggregates() {
+    constexpr int ROWS = 500;
+    constexpr int FORMULAS = 200;
+    constexpr int EDITS = 20;
+    std::cerr << "--- " << FORMULAS << " sums over " << ROWS << " cells, " << EDITS
+              << " edits ---" << std::endl;
+
+    std::string chain = "=A1";
+    for (int row = 1; row < ROWS; ++row) {
+        chain += "+" + Position{row, 0}.ToString();
+    }
+    const std::string range = "=SUM(A1:" + Position{ROWS - 1, 0}.ToString() + ")";
+
+    for (const auto& text : {chain, range}) {
+        const auto formula = ParseFormula(text.substr(1));
+        std::cerr << text.substr(0, 12) << "...: " << formula->GetReferencedCells().size()
+                  << " cell refs, " << formula->GetReferencedRanges().size() << " range refs"
+                  << std::endl;
+
+        Sheet sheet;
+        for (int row = 0; row < ROWS; ++row) {
+            sheet.SetCell({row, 0}, std::to_string(row));
+        }
+        {
+            LOG_DURATION("  set formulas");
+            for (int col = 1; col <= FORMULAS; ++col) {
+                sheet.SetCell({0, col}, text);
+            }
+        }
+        LOG_DURATION("  edit + recalculate");
+        for (int i = 0; i < EDITS; ++i) {
+            sheet.SetCell({i, 0}, std::to_string(i + 1));
+            sheet.Recalculate();
+        }
+    }
+}
+
+void BenchmarkFillDown() {
+    constexpr int ROWS = 16'000;
+    constexpr int COLS = 10;
+    std::cerr << "--- fill-down, " << ROWS * COLS << " formulas ---" << std::endl;
+
+    std::vector<std::pair<Position, std::string>> formulas;
+    formulas.reserve(ROWS * COLS);
+    for (int row = 0; row < ROWS; ++row) {
+        const auto r = std::to_string(row + 1);
+        for (int col = 0; col < COLS; ++col) {
+            formulas.push_back({{row, col + 3}, "=(A" + r + "*B" + r + "+C" + r + ")/"
+                                                    + std::to_string(col + 2)});
+        }
+    }
+
+    Sheet sheet;
+    for (int row = 0; row < ROWS; ++row) {
+        sheet.SetCell({row, 0}, std::to_string(row));
+        sheet.SetCell({row, 1}, "2");
+        sheet.SetCell({row, 2}, "1");
+    }
+    const size_t memory_before = GetHeapInUse();
+    {
+        LOG_DURATION("SetCell formulas");
+        for (const auto& [pos, text] : formulas) {
+            sheet.SetCell(pos, text);
+        }
+    }
+    std::cerr << "heap growth: " << (GetHeapInUse() - memory_before) / (1024 * 1024) << " MB"
+              << std::endl;
+}
+
+void BenchmarkPasteFormula() {
+    constexpr int CELLS = 100'000;
+    const std::string text = "=SUM(A1:A100)/COUNT(A1:A100)+(A1*A2-A3)/(A4+1)";
+    std::cerr << "--- paste, " << CELLS << " copies of one formula ---" << std::endl;
+
+    Sheet sheet;
+    for (int row = 0; row < 100; ++row) {
+        sheet.SetCell({row, 0}, std::to_string(row));
+    }
+    {
+        LOG_DURATION("SetCell formulas");
+        for (int row = 0; row < CELLS; ++row) {
+            sheet.SetCell({row / 8, 2 + row % 8}, text);
+        }
+    }
+}
+
+void BenchmarkEarlyCutoff() {
+    constexpr int ROWS = 2'000;
+    constexpr int FORMULAS = 500;
+    constexpr int EDITS = 200;
+    std::cerr << "--- edits behind a clamp, " << FORMULAS << " sums over " << ROWS
+              << " cells ---" << std::endl;
+
+    // A1 ограничивается в B1, от B1 зависят дорогие формулы
+    Sheet sheet;
+    sheet.SetCell({0, 0}, "0");
+    sheet.SetCell({0, 1}, "=MAX(A1,100)");
+    for (int row = 0; row < ROWS; ++row) {
+        sheet.SetCell({row, 3}, std::to_string(row % 7));
+    }
+    const auto range = "SUM(D1:D" + std::to_string(ROWS) + ")";
+    for (int row = 0; row < FORMULAS; ++row) {
+        sheet.SetCell({row, 5}, "=B1+" + range + "/" + std::to_string(row + 1));
+    }
+    double sum = 0.0;
+    {
+        LOG_DURATION("SetCell + GetValue of all sums x200");
+        for (int edit = 0; edit < EDITS; ++edit) {
+            sheet.SetCell({0, 0}, std::to_string(edit % 50));
+            for (int row = 0; row < FORMULAS; ++row) {
+                sum += std::get<double>(sheet.GetCell({row, 5})->GetValue());
+            }
+        }
+    }
+    std::cerr << "(sum " << sum << ")" << std::endl;
+}
+
+void BenchmarkSnapshots() {
+    constexpr int SNAPSHOTS = 100;
+    std::cerr << "--- snapshots, " << BENCH_ROWS << "x" << BENCH_COLS << " ---" << std::endl;
+
+    Sheet sheet;
+    for (int row = 0; row < BENCH_ROWS; ++row) {
+        sheet.SetCell({row, 0}, std::to_string(row));
+        for (int col = 1; col < BENCH_COLS; ++col) {
+            sheet.SetCell({row, col}, "=" + Position{row, col - 1}.ToString() + "+1");
+        }
+    }
+    std::vector<std::shared_ptr<const SheetSnapshot>> snapshots;
+    {
+        LOG_DURATION("Snapshot + SetCell x100");
+        for (int i = 0; i < SNAPSHOTS; ++i) {
+            snapshots.push_back(sheet.Snapshot());
+            sheet.SetCell({i, 0}, std::to_string(-i));
+        }
+    }
+    {
+        std::ostringstream out;
+        LOG_DURATION("PrintValues: snapshot");
+        snapshots.back()->PrintValues(out);
+    }
+    snapshots.clear();
+
+    // читатель печатает свежие снимки, пока таблица меняется
+    std::shared_ptr<const SheetSnapshot> published = sheet.Snapshot();
+    std::atomic<bool> done = false;
+    int prints = 0;
+    std::thread reader([&]() {
+        while (!done.load()) {
+            std::ostringstream out;
+            std::atomic_load(&published)->PrintValues(out);
+            ++prints;
+        }
+    });
+    {
+        LOG_DURATION("SetCell + Snapshot x1000 with a reader");
+        for (int i = 0; i < 1000; ++i) {
+            sheet.SetCell({i % BENCH_ROWS, 0}, std::to_string(i));
+            std::atomic_store(&published, sheet.Snapshot());
+        }
+    }
+    done = true;
+    reader.join();
+    std::cerr << "(" << prints << " prints)" << std::endl;
+}
+
+void BenchmarkForks() {
+    constexpr int FORKS = 200;
+    constexpr int REPLAYS = 3;
+    constexpr int EDITS = 3;
+    std::cerr << "--- what-if forks, " << BENCH_ROWS << "x" << BENCH_COLS << " ---" << std::endl;
+
+    auto fill = [](Sheet& sheet) {
+        for (int row = 0; row < BENCH_ROWS; ++row) {
+            sheet.SetCell({row, 0}, std::to_string(row));
+            for (int col = 1; col < BENCH_COLS; ++col) {
+                sheet.SetCell({row, col}, "=" + Position{row, col - 1}.ToString() + "+1");
+            }
+        }
+        const auto last = Position{BENCH_ROWS - 1, BENCH_COLS - 1}.ToString();
+        sheet.SetCell({0, BENCH_COLS}, "=SUM(" + Position{0, BENCH_COLS - 1}.ToString()
+                                           + ":" + last + ")");
+        sheet.Recalculate();
+    };
+    // сценарий меняет несколько входов и читает итог
+    auto what_if = [](Sheet& sheet, int scenario) {
+        for (int i = 0; i < EDITS; ++i) {
+            sheet.SetCell({(scenario * 31 + i * 97) % BENCH_ROWS, 0}, std::to_string(-scenario));
+        }
+        return sheet.GetCell({0, BENCH_COLS})->GetNumber().value_or(0.0);
+    };
+
+    Sheet sheet;
+    fill(sheet);
+    double total = 0.0;
+    {
+        LOG_DURATION("Rebuild + what-if x3");
+        for (int i = 0; i < REPLAYS; ++i) {
+            Sheet replay;
+            fill(replay);
+            total += what_if(replay, i);
+        }
+    }
+    {
+        LOG_DURATION("Fork + what-if x200");
+        for (int i = 0; i < FORKS; ++i) {
+            auto fork = sheet.Fork();
+            total += what_if(*fork, i);
+        }
+    }
+    {
+        LOG_DURATION("what-if in place x200");
+        for (int i = 0; i < FORKS; ++i) {
+            total += what_if(sheet, i);
+        }
+    }
+    std::cerr << "(" << total << ")" << std::endl;
+}
+
+void BenchmarkSheetFile() {
+    constexpr int ROWS = 10'000;
+    constexpr int COLS = 100;
+    std::cerr << "--- sheet file, " << ROWS * COLS << " cells ---" << std::endl;
+    const auto path = (std::filesystem::temp_directory_path() / "spreadsheet_bench.sheet").string();
+
+    std::vector<std::pair<Position, std::string>> cells;
+    for (int row = 0; row < ROWS; ++row) {
+        cells.emplace_back(Position{row, 0}, std::to_string(row));
+        for (int col = 1; col < COLS; ++col) {
+            cells.emplace_back(Position{row, col}, "=" + Position{row, col - 1}.ToString() + "*2+1");
+        }
+    }
+    Sheet sheet;
+    {
+        LOG_DURATION("SetCells");
+        sheet.SetCells(cells);
+    }
+    {
+        LOG_DURATION("Save with values");
+        SheetFile::Save(sheet, path);
+    }
+    std::cerr << "(" << std::filesystem::file_size(path) / (1 << 20) << " MB)" << std::endl;
+    {
+        SheetFile::Loaded loaded;
+        {
+            LOG_DURATION("Load mapped");
+            loaded = SheetFile::Load(path);
+        }
+        std::cerr << "(" << *loaded.sheet->GetCell({ROWS - 1, COLS - 1})->GetNumber() << ")"
+                  << std::endl;
+    }
+    {
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        file.seekp(12);
+        const uint32_t version = 0;
+        file.write(reinterpret_cast<const char*>(&version), sizeof(version));
+    }
+    {
+        SheetFile::Loaded loaded;
+        {
+            LOG_DURATION("Load rebuilt + Recalculate");
+            loaded = SheetFile::Load(path);
+            loaded.sheet->Recalculate();
+        }
+    }
+    std::remove(path.c_str());
+}
+
+void BenchmarkTextImport() {
+    constexpr int ROWS = 10'000;
+    constexpr int COLS = 100;
+    std::cerr << "--- text import, " << ROWS * COLS << " cells ---" << std::endl;
+
+    std::string text;
+    for (int row = 0; row < ROWS; ++row) {
+        for (int col = 0; col < COLS; ++col) {
+            if (col > 0) {
+                text += '\t';
+            }
+            if (col % 2 == 0) {
+                text += std::to_string(row * 0.5 + col);
+            } else {
+                text += "=" + Position{row, col - 1}.ToString() + "*2+1";
+            }
+        }
+        text += '\n';
+    }
+    {
+        LOG_DURATION("split + SetCells");
+        std::vector<std::pair<Position, std::string>> cells;
+        std::istringstream input(text);
+        std::string line;
+        for (int row = 0; std::getline(input, line); ++row) {
+            std::istringstream fields(line);
+            std::string field;
+            for (int col = 0; std::getline(fields, field, '\t'); ++col) {
+                if (!field.empty()) {
+                    cells.emplace_back(Position{row, col}, std::move(field));
+                }
+            }
+        }
+        Sheet sheet;
+        sheet.SetCells(std::move(cells));
+    }
+    std::unique_ptr<Sheet> sheet;
+    {
+        LOG_DURATION("SheetImporter");
+        std::istringstream input(text);
+        sheet = SheetImporter::Import(input);
+    }
+}
+
+// Печать обходом всех клеток области со значениями через поток, как раньше
+void PrintValuesByCells(const Sheet& sheet, std::ostream& output) {
+    const Size size = sheet.GetPrintableSize();
+    for (int r = 0; r < size.rows; ++r) {
+        for (int c = 0; c < size.cols; ++c) {
+            if (c > 0) {
+                output << "\t";
+            }
+            const auto* cell = sheet.GetCell({r, c});
+            if (cell && !cell->GetText().empty()) {
+                std::visit([&](const auto& value) { output << value; }, cell->GetValue());
+            }
+        }
+        output << "\n";
+    }
+}
+
+void BenchmarkPrint() {
+    constexpr int ROWS = 10'000;
+    constexpr int COLS = 100;
+    std::cerr << "--- print, " << ROWS * COLS << " cells ---" << std::endl;
+
+    Sheet sheet;
+    std::vector<std::pair<Position, std::string>> cells;
+    for (int row = 0; row < ROWS; ++row) {
+        for (int col = 0; col < COLS; ++col) {
+            if (col % 2 == 0) {
+                cells.emplace_back(Position{row, col}, std::to_string(row * 0.5 + col));
+            } else {
+                cells.emplace_back(Position{row, col}, "=" + Position{row, col - 1}.ToString() + "/3");
+            }
+        }
+    }
+    sheet.SetCells(std::move(cells));
+    sheet.Recalculate();
+
+    {
+        LOG_DURATION("GetPrintableSize x1000");
+        Size size;
+        for (int i = 0; i < 1000; ++i) {
+            size = sheet.GetPrintableSize();
+        }
+        std::cerr << "size " << size.rows << "x" << size.cols << std::endl;
+    }
+
+    std::ostringstream output;
+    {
+        LOG_DURATION("values by cells");
+        PrintValuesByCells(sheet, output);
+    }
+    const size_t size = output.str().size();
+    output.str({});
+    {
+        LOG_DURATION("PrintValues");
+        sheet.PrintValues(output);
+    }
+    output.str({});
+    {
+        LOG_DURATION("PrintTexts");
+        sheet.PrintTexts(output);
+    }
+    std::cerr << "output " << size << " bytes" << std::endl;
+
+    // окно 50x200 после правки, от которой зависят все формулы окна
+    sheet.SetCell("A5001"_pos, "1");
+    const Range window{{5000, 0}, {5049, 199}};
+    output.str({});
+    {
+        LOG_DURATION("window by cells");
+        sheet.SheetInterface::PrintValues(output, window);
+    }
+    sheet.SetCell("A5001"_pos, "2");
+    output.str({});
+    {
+        LOG_DURATION("window PrintValues");
+        sheet.PrintValues(output, window);
+    }
+
+    // редкие ячейки в большой области
+    Sheet sparse;
+    for (int i = 0; i < 1000; ++i) {
+        sparse.SetCell({i * 10, (i * 37) % 1000}, "=" + std::to_string(i) + "/7");
+    }
+    output.str({});
+    {
+        LOG_DURATION("sparse values by cells");
+        PrintValuesByCells(sparse, output);
+    }
+    output.str({});
+    {
+        LOG_DURATION("sparse PrintValues");
+        sparse.PrintValues(output);
+    }
+}
+
+// Формулы, ссылающиеся на пустые ячейки: ссылки хранятся только в графе
+void BenchmarkEmptyReferences() {
+    constexpr int COUNT = 200'000;
+    std::cerr << "--- references to empty cells, " << COUNT << " formulas ---" << std::endl;
+
+    const size_t heap_before = GetHeapInUse();
+    Sheet sheet;
+    {
+        LOG_DURATION("set formulas");
+        for (int i = 0; i < COUNT; ++i) {
+            const Position ref{i / 100 + 5000, i % 100};
+            sheet.SetCell({i / 100, i % 100}, "=" + ref.ToString() + "*2");
+        }
+    }
+    std::cerr << "heap " << (GetHeapInUse() - heap_before) / COUNT << " bytes per formula"
+              << std::endl;
+    {
+        LOG_DURATION("clear formulas");
+        for (int i = 0; i < COUNT; ++i) {
+            sheet.ClearCell({i / 100, i % 100});
+        }
+    }
+    std::cerr << "heap after clear " << (GetHeapInUse() - heap_before) / COUNT
+              << " bytes per formula" << std::endl;
+}
+
+// Память ячеек: блоки арены таблицы против отдельных выделений на каждый объект
+void BenchmarkCellMemory() {
+    constexpr int ROWS = 10'000;
+    constexpr int COLS = 100;
+    std::cerr << "--- cell memory, " << ROWS * COLS << " cells ---" << std::endl;
+
+    auto make_cells = [](int generation) {
+        std::vector<std::pair<Position, std::string>> cells;
+        cells.reserve(ROWS * COLS);
+        for (int row = 0; row < ROWS; ++row) {
+            for (int col = 0; col < COLS; ++col) {
+                if (col % 2 == 0) {
+                    cells.emplace_back(Position{row, col}, std::to_string(row + col + generation));
+                } else {
+                    cells.emplace_back(Position{row, col},
+                                       "=" + Position{row, col - 1}.ToString() + "*2");
+                }
+            }
+        }
+        return cells;
+    };
+
+    const size_t heap_before = GetHeapInUse();
+    const size_t rss_before = GetResidentMemory();
+    auto sheet = std::make_unique<Sheet>();
+    // блоки арены отображаются в обход кучи и учитываются отдельно
+    auto report = [&](const char* stage) {
+        const size_t arena = sheet->GetCellArena().GetStatistics().slabs * CellArena::SLAB_SIZE;
+        std::cerr << stage << ": heap + arena "
+                  << (GetHeapInUse() - heap_before + arena) / (ROWS * COLS)
+                  << " bytes per cell, rss growth "
+                  << (GetResidentMemory() - rss_before) / (1024 * 1024) << " MB" << std::endl;
+    };
+    {
+        LOG_DURATION("SetCells");
+        sheet->SetCells(make_cells(0));
+    }
+    report("loaded");
+    {
+        LOG_DURATION("replace all cells x3");
+        for (int generation = 1; generation <= 3; ++generation) {
+            sheet->SetCells(make_cells(generation));
+        }
+    }
+    report("replaced");
+    {
+        LOG_DURATION("destroy sheet");
+        sheet.reset();
+    }
+}
+
+void BenchmarkDependencyGraph() {
+    constexpr int ROWS = 10'000;
+    constexpr int COLS = 40;
+    constexpr int REFS = 5;
+    std::cerr << "--- dependency graph, " << ROWS * COLS << " formulas x " << REFS
+              << " references ---" << std::endl;
+
+    DependencyGraph graph;
+    {
+        LOG_DURATION("SetReferences");
+        std::vector<Position> refs(REFS);
+        for (int row = 1; row < ROWS; ++row) {
+            for (int col = 0; col < COLS; ++col) {
+                for (int i = 0; i < REFS; ++i) {
+                    refs[i] = {row - 1, (col + i) % COLS};
+                }
+                graph.SetReferences({row, col}, refs);
+            }
+        }
+    }
+    auto report = [&graph]() {
+        std::cerr << "  " << graph.GetEdgeCount() << " edges, "
+                  << double(graph.GetEdgeMemory()) / graph.GetEdgeCount() << " bytes/edge + "
+                  << double(graph.GetNodeMemory()) / graph.GetEdgeCount()
+                  << " bytes/edge for node index" << std::endl;
+    };
+    report();
+    {
+        LOG_DURATION("Compact");
+        graph.Compact();
+    }
+    report();
+
+    size_t visited = 0;
+    {
+        LOG_DURATION("ForEachDependant: all cells x10");
+        for (int pass = 0; pass < 10; ++pass) {
+            for (int row = 0; row < ROWS; ++row) {
+                for (int col = 0; col < COLS; ++col) {
+                    graph.ForEachDependant({row, col}, [&visited](Position) {
+                        ++visited;
+                    });
+                }
+            }
+        }
+    }
+    std::cerr << "  " << visited << " dependants visited" << std::endl;
+}
+
+void BenchmarkFormulaParsing() {
+    constexpr int COUNT = 200'000;
+    std::cerr << "--- formula parsing, " << COUNT << " formulas ---" << std::endl;
+
+    std::vector<std::string> expressions;
+    expressions.reserve(COUNT);
+    for (int i = 0; i < COUNT; ++i) {
+        const int row = i % Position::MAX_ROWS;
+        expressions.push_back("A" + std::to_string(row + 1) + "*2.5+B" + std::to_string(row + 1)
+                              + "/(C1-1e-3)-(-D" + std::to_string(row + 1) + ")");
+    }
+
+    size_t cells = 0;
+    {
+        LOG_DURATION("ParseFormula");
+        for (const auto& expression : expressions) {
+            cells += ParseFormula(expression)->GetReferencedCells().size();
+        }
+    }
+    std::cerr << "(cells " << cells << ")" << std::endl;
+}
+
+}  // namespace
+
+int main() {
+    BenchmarkCellStorage();
+    BenchmarkSheet();
+    BenchmarkFormulaEvaluation();
+    BenchmarkFormulaParsing();
+    BenchmarkErrorPropagation();
+    BenchmarkParallelRecalculation();
+    BenchmarkSetFormulaLatency();
+    BenchmarkEditInDependencyWeb();
+    BenchmarkBatchImport();
+    BenchmarkTextImport();
+    BenchmarkPrint();
+    BenchmarkEmptyReferences();
+    BenchmarkCellMemory();
+    BenchmarkDependencyGraph();
+    BenchmarkRangeAggregates();
+    BenchmarkFillDown();
+    BenchmarkPasteFormula();
+    BenchmarkEarlyCutoff();
+    BenchmarkSnapshots();
+    BenchmarkForks();
+    BenchmarkSheetFile();
+    return 0;
+}
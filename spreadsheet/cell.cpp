@@ -1,29 +1,126 @@
 #include <cassert>
+#include <cctype>
+#include <charconv>
+#include <cmath>
 #include <iostream>
 #include <string>
 #include <optional>
 #include <limits>
+#include <sstream>
+#include <string_view>
 
 #include "cell.h"
+#include "sheet.h"
+
+namespace {
+
+// Значения неразличимы для зависимых ячеек: нули разного знака считаются разными,
+// так как печатаются по-разному
+bool IsSameValue(const Cell::Value& lhs, const Cell::Value& rhs) {
+
+    if (lhs.index() != rhs.index())
+        return false;
+
+    if (const auto* number = std::get_if<double>(&lhs))
+        return *number == std::get<double>(rhs)
+            && std::signbit(*number) == std::signbit(std::get<double>(rhs));
+
+    return lhs == rhs;
+}
+
+}  // namespace
 
 // --- Cell ---
 
+// Число читается std::from_chars. Поток пропускает ведущие пробелы и принимает '+',
+// поэтому такие строки по-прежнему читаются через std::istringstream
+std::optional<double> Cell::ParseNumber(std::string_view text) {
+
+    if (text.empty())
+        return std::nullopt;
+
+    const char first = text.front();
+    if (first != '+' && !std::isspace(static_cast<unsigned char>(first))) {
+        // inf и nan поток не читает
+        if (!std::isdigit(static_cast<unsigned char>(first)) && first != '.' && first != '-')
+            return std::nullopt;
+        if (first == '-' && text.size() > 1 && std::isalpha(static_cast<unsigned char>(text[1])))
+            return std::nullopt;
+
+        double num = 0.0;
+        const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), num);
+        if (error == std::errc() && end == text.data() + text.size())
+            return num;
+        if (error != std::errc::result_out_of_range)
+            return std::nullopt;
+    }
+
+    std::istringstream input{std::string(text)};
+    double num = 0.0;
+
+    if (input >> num && input.eof())
+        return num;
+
+    return std::nullopt;
+}
+
+template <typename T, typename... Args>
+std::unique_ptr<Cell::Impl> Cell::MakeImpl(Sheet& sheet, Args&&... args) {
+    return std::unique_ptr<Impl>(new (sheet.GetCellArena()) T(std::forward<Args>(args)...));
+}
+
+Cell::Cell(Sheet& sheet, Position position)
+    : impl_(MakeImpl<EmptyImpl>(sheet)), sheet_(sheet), position_(position)
+    , owner_token_(sheet.GetOwnerToken()) {}
+
+std::shared_ptr<Cell> Cell::Create(Sheet& sheet, Position position) {
+    return std::allocate_shared<Cell>(CellArenaAllocator<Cell>(sheet.GetCellArena()),
+                                      sheet, position);
+}
+
 void Cell::Set(std::string text) {
     
     if (text.empty()) {
-        impl_ = std::make_unique<EmptyImpl>();
+        impl_ = MakeImpl<EmptyImpl>(sheet_);
         
     } else if (text.size() >= 2 && text.at(0) == FORMULA_SIGN) {
-        impl_ = std::move(std::make_unique<FormulaImpl>(std::move(text), sheet_));
+        impl_ = MakeImpl<FormulaImpl>(sheet_, std::move(text), sheet_, position_);
         
     } else {
-        impl_ = std::move(std::make_unique<TextImpl>(std::move(text)));
+        std::string_view value = text;
+        if (value.front() == ESCAPE_SIGN)
+            value.remove_prefix(1);
+
+        if (auto number = ParseNumber(value))
+            impl_ = MakeImpl<NumberImpl>(sheet_, std::move(text), *number);
+        else
+            impl_ = MakeImpl<TextImpl>(sheet_, std::move(text));
+    }
+}
+
+void Cell::SetText(std::string text, std::optional<double> number) {
+
+    if (text.empty())
+        impl_ = MakeImpl<EmptyImpl>(sheet_);
+    else if (number)
+        impl_ = MakeImpl<NumberImpl>(sheet_, std::move(text), *number);
+    else
+        impl_ = MakeImpl<TextImpl>(sheet_, std::move(text));
+}
+
+void Cell::SetFormula(FormulaProgram program, std::optional<Value> value) {
+
+    auto impl = MakeImpl<FormulaImpl>(sheet_, std::move(program), sheet_, position_);
+    if (value) {
+        auto& formula_impl = static_cast<FormulaImpl&>(*impl);
+        formula_impl.cache_ = std::move(*value);
+        formula_impl.MarkVerified();
     }
-    InvalidateCache();
+    impl_ = std::move(impl);
 }
 
 void Cell::Clear() {
-    impl_ = std::make_unique<EmptyImpl>();
+    impl_ = MakeImpl<EmptyImpl>(sheet_);
 }
 
 Cell::Value Cell::GetValue() const {
@@ -34,13 +131,71 @@ std::string Cell::GetText() const {
     return impl_->GetText();
 }
 
+bool Cell::IsEmpty() const {
+    return !impl_->GetFormula() && impl_->GetPlainText().empty();
+}
+
+std::string_view Cell::GetPlainText() const {
+    return impl_->GetPlainText();
+}
+
+std::optional<double> Cell::GetNumber() const {
+    return impl_->GetNumber();
+}
+
 std::vector<Position> Cell::GetReferencedCells() const {
     return impl_->GetReferencedCells();
 }
 
-void Cell::InvalidateCache(){
-    impl_->InvalidateCache();
-}   
+std::vector<Range> Cell::GetReferencedRanges() const {
+    return impl_->GetReferencedRanges();
+}
+
+bool Cell::IsCacheValid() const {
+    return impl_->IsCacheValid();
+}
+
+bool Cell::IsCacheValid(uint64_t epoch) const {
+    return impl_->IsCacheValid(epoch);
+}
+
+uint64_t Cell::GetVerifiedAt() const {
+    return impl_->GetVerifiedAt();
+}
+
+void Cell::MarkVerified() const {
+    impl_->MarkVerified();
+}
+
+const FormulaInterface* Cell::GetFormula() const {
+    return impl_->GetFormula();
+}
+
+Cell::Value Cell::MakeFormulaValue(FormulaInterface::Value result) {
+
+    if (std::holds_alternative<double>(result)) {
+
+        double number = std::get<double>(result);
+        
+        if(number == std::numeric_limits<double>::infinity()
+        || number == -std::numeric_limits<double>::infinity())
+            return FormulaError(FormulaError::Category::Div0);
+        return number;
+    }
+    return std::get<FormulaError>(result);
+}
+
+bool Cell::Recalculate() const {
+    return impl_->Recalculate();
+}
+
+uint64_t Cell::GetChangedAt() const {
+    return changed_at_;
+}
+
+void Cell::SetChangedAt(uint64_t epoch) const {
+    changed_at_ = epoch;
+}
 
 // --- Cell::EmptyImpl ---
 
@@ -52,6 +207,10 @@ std::string Cell::EmptyImpl::GetText() const {
     return "";
 }
 
+std::unique_ptr<Cell::Impl> Cell::EmptyImpl::CopyFor(Sheet& sheet) const {
+    return MakeImpl<EmptyImpl>(sheet);
+}
+
 // --- Cell::TextImpl ---
 
 Cell::TextImpl::TextImpl(std::string text) 
@@ -73,49 +232,138 @@ std::string Cell::TextImpl::GetText() const {
     return text_;
 }
 
+std::string_view Cell::TextImpl::GetPlainText() const {
+    return text_;
+}
+
+std::unique_ptr<Cell::Impl> Cell::TextImpl::CopyFor(Sheet& sheet) const {
+    return MakeImpl<TextImpl>(sheet, text_);
+}
+
+// --- Cell::NumberImpl ---
+
+Cell::NumberImpl::NumberImpl(std::string text, double number)
+    : TextImpl(std::move(text)), number_(number) {}
+
+std::optional<double> Cell::NumberImpl::GetNumber() const {
+    return number_;
+}
+
+std::unique_ptr<Cell::Impl> Cell::NumberImpl::CopyFor(Sheet& sheet) const {
+    return MakeImpl<NumberImpl>(sheet, text_, number_);
+}
+
 // --- Cell::FormulaImpl ---
 
-Cell::FormulaImpl::FormulaImpl(std::string text, SheetInterface& sheet) 
-    : formula_ptr_(ParseFormula(text.substr(1))), sheet_(sheet) {}
+Cell::FormulaImpl::FormulaImpl(std::string text, Sheet& sheet, Position position) 
+    : formula_(sheet.GetFormulaCache().Parse(text.substr(1), position))
+    , sheet_(sheet), position_(position) {}
+
+Cell::FormulaImpl::FormulaImpl(FormulaProgram program, Sheet& sheet, Position position)
+    : formula_(std::move(program)), sheet_(sheet), position_(position) {}
 
+Cell::FormulaImpl::FormulaImpl(const FormulaImpl& other, Sheet& sheet)
+    : cache_(other.cache_), verified_at_(other.verified_at_)
+    , formula_(other.formula_), sheet_(sheet), position_(other.position_) {}
+
+// Непроверенный кеш проверяет таблица: сначала все непроверенные ссылки, затем эту ячейку.
+// Если кеш так и не проверен, ячейки нет в таблице: её заменила правка или копия после
+// Sheet::Fork(). Такой кеш может разделяться с копией таблицы, поэтому значение
+// вычисляется без запоминания.
 Cell::Value Cell::FormulaImpl::GetValue() const {   
 
-    if(isCacheValid){
-        return cache_;
-    }          
-    auto result = formula_ptr_->Evaluate(sheet_);
-    
-    if (std::holds_alternative<double>(result)) {
+    if(!IsCacheValid()){
+        sheet_.Recalculate(position_);
+    }
+    if(!IsCacheValid()){
+        return MakeFormulaValue(formula_.Evaluate(sheet_));
+    }
+    return cache_;
+}
 
-        double number = std::get<double>(result);
-        
-        if(number == std::numeric_limits<double>::infinity()
-        || number == -std::numeric_limits<double>::infinity())
-            cache_ = FormulaError(FormulaError::Category::Div0);
-        else
-            cache_ = number;
-    } else {
-        cache_ = std::get<FormulaError>(result);
+std::optional<double> Cell::FormulaImpl::GetNumber() const {
+
+    const Value* value = &cache_;
+    Value uncached;
+
+    if(!IsCacheValid()){
+        sheet_.Recalculate(position_);
     }
+    if(!IsCacheValid()){
+        uncached = MakeFormulaValue(formula_.Evaluate(sheet_));
+        value = &uncached;
+    }
+    if(const auto* number = std::get_if<double>(value))
+        return *number;
+    return std::nullopt;
+}
+
+bool Cell::FormulaImpl::Recalculate() const {
 
-    isCacheValid = true;
+    auto value = MakeFormulaValue(formula_.Evaluate(sheet_));
 
-    return cache_;  
-         
+    const bool changed = verified_at_ == 0 || !IsSameValue(cache_, value);
+    cache_ = std::move(value);
+    MarkVerified();
+
+    return changed;
 }
 
 std::string Cell::FormulaImpl::GetText() const {
-    return FORMULA_SIGN + formula_ptr_->GetExpression();
+    return FORMULA_SIGN + formula_.GetExpression();
 }
 
 std::vector<Position> Cell::FormulaImpl::GetReferencedCells() const{
-    return formula_ptr_->GetReferencedCells();
+    return formula_.GetReferencedCells();
+}
+
+std::vector<Range> Cell::FormulaImpl::GetReferencedRanges() const{
+    return formula_.GetReferencedRanges();
+}
+
+const FormulaInterface* Cell::FormulaImpl::GetFormula() const{
+    return &formula_;
 }
 
 Position Cell::GetPosition() const{
     return position_;
 }
 
-void Cell::FormulaImpl::InvalidateCache(){
-    isCacheValid = false;
+uint64_t Cell::GetOwnerToken() const{
+    return owner_token_;
+}
+
+void Cell::SetOwnerToken(uint64_t token){
+    owner_token_ = token;
+}
+
+bool Cell::IsCreatedBy(const Sheet& sheet) const{
+    return &sheet_ == &sheet;
+}
+
+std::shared_ptr<Cell> Cell::CopyFor(Sheet& sheet) const{
+    auto copy = Create(sheet, position_);
+    copy->impl_ = impl_->CopyFor(sheet);
+    copy->changed_at_ = changed_at_;
+    return copy;
+}
+
+bool Cell::FormulaImpl::IsCacheValid() const {
+    return IsCacheValid(sheet_.GetEpoch());
+}
+
+bool Cell::FormulaImpl::IsCacheValid(uint64_t epoch) const {
+    return verified_at_ == epoch;
+}
+
+std::unique_ptr<Cell::Impl> Cell::FormulaImpl::CopyFor(Sheet& sheet) const {
+    return MakeImpl<FormulaImpl>(sheet, *this, sheet);
+}
+
+uint64_t Cell::FormulaImpl::GetVerifiedAt() const {
+    return verified_at_;
+}
+
+void Cell::FormulaImpl::MarkVerified() const {
+    verified_at_ = sheet_.GetEpoch();
 }
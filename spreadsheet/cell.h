@@ -1,13 +1,19 @@
 #pragma once
 
+#include <cstdint>
 #include <set>
+#include "cell_arena.h"
 #include "common.h"
 #include "formula.h"
 
+class Sheet;
+
 class Cell : public CellInterface {
 public:
-    Cell(SheetInterface& sheet, Position position = Position::NONE) 
-        : impl_(std::make_unique<EmptyImpl>()), sheet_(sheet), position_(position) {}
+    Cell(Sheet& sheet, Position position = Position::NONE);
+    // Ячейка в памяти таблицы (см. Sheet::GetCellArena): ячейка, её блок управления
+    // и содержимое занимают слоты арены таблицы
+    static std::shared_ptr<Cell> Create(Sheet& sheet, Position position = Position::NONE);
    
     ~Cell() = default;
 
@@ -16,24 +22,82 @@ public:
     void Set(std::string text);
     void Clear();
 
+    // Содержимое, уже разобранное раньше (см. SheetFile): текст с числом, если он его
+    // записывает, и формула с вычисленным значением, которое считается проверенным
+    // в текущей эпохе таблицы. Ссылки формулы в граф не добавляются.
+    void SetText(std::string text, std::optional<double> number);
+    void SetFormula(FormulaProgram program, std::optional<Value> value = std::nullopt);
+
     Value GetValue() const override;
     std::string GetText() const override;
+    std::optional<double> GetNumber() const override;
     std::vector<Position> GetReferencedCells() const override;
-
-    void InvalidateCache();
+    // Текст ячейки пуст: пустая ячейка, на которую ссылаются формулы
+    bool IsEmpty() const;
+    // Текст ячейки без формулы, без копирования; у формулы и пустой ячейки пустой
+    std::string_view GetPlainText() const;
+    // Диапазоны, на которые ссылается формула
+    std::vector<Range> GetReferencedRanges() const;
+    // Формула ячейки или nullptr. Формула неизменяема и не зависит от кеша ячейки
+    const FormulaInterface* GetFormula() const;
+
+    // Число, которое записывает текст ячейки, по правилам чтения из std::istream
+    static std::optional<double> ParseNumber(std::string_view text);
+
+    // Значение ячейки по результату формулы: бесконечность считается делением на ноль
+    static Value MakeFormulaValue(FormulaInterface::Value result);
+
+    // Кеш формулы проверен в текущей эпохе таблицы
+    bool IsCacheValid() const;
+    // Кеш формулы проверен в эпоху epoch; у ячеек без формулы всегда true
+    bool IsCacheValid(uint64_t epoch) const;
+    // Эпоха последней проверки кеша формулы; 0 - формула ещё не вычислялась
+    uint64_t GetVerifiedAt() const;
+    // Подтверждает кеш в текущей эпохе без пересчёта
+    void MarkVerified() const;
+    // Пересчитывает значение формулы; ячейки, на которые она ссылается, уже должны быть проверены.
+    // Возвращает false, если значение совпало с прежним
+    bool Recalculate() const;
+
+    // Эпоха последнего изменения значения ячейки
+    uint64_t GetChangedAt() const;
+    void SetChangedAt(uint64_t epoch) const;
 
     Position GetPosition() const;
 
+    // Метка таблицы, которая может менять кеш ячейки. После Sheet::Fork() ячейки
+    // разделяются копиями таблицы и не меняются; таблица работает со своей копией.
+    uint64_t GetOwnerToken() const;
+    // Ячейка, которую больше не разделяют копии таблицы, переходит к sheet без копирования
+    void SetOwnerToken(uint64_t token);
+    // Ячейку создала таблица sheet: её вычисления идут через sheet
+    bool IsCreatedBy(const Sheet& sheet) const;
+    // Копия ячейки для sheet с тем же содержимым и состоянием кеша
+    std::shared_ptr<Cell> CopyFor(Sheet& sheet) const;
+
 private:
     
+    // Содержимое ячейки создаётся в арене таблицы: new (arena) XImpl(...)
     class Impl {
     public:
+        static void* operator new(size_t size, CellArena& arena) { return arena.Allocate(size); }
+        static void operator delete(void* ptr, CellArena&) { CellArena::Free(ptr); }
+        static void operator delete(void* ptr) { CellArena::Free(ptr); }
         
         virtual Value GetValue() const = 0;
         virtual std::string GetText() const = 0;
+        virtual std::string_view GetPlainText() const { return {}; }
+        virtual std::optional<double> GetNumber() const { return std::nullopt; }
         virtual std::vector<Position> GetReferencedCells() const { return {};};
-
-        virtual void InvalidateCache(){};
+        virtual std::vector<Range> GetReferencedRanges() const { return {};};
+        virtual const FormulaInterface* GetFormula() const { return nullptr; }
+
+        virtual bool IsCacheValid() const { return true; }
+        virtual bool IsCacheValid(uint64_t epoch) const { return true; }
+        virtual uint64_t GetVerifiedAt() const { return 0; }
+        virtual void MarkVerified() const {}
+        virtual bool Recalculate() const { return false; }
+        virtual std::unique_ptr<Impl> CopyFor(Sheet& sheet) const = 0;
         
         virtual ~Impl() = default;
     };
@@ -43,6 +107,7 @@ private:
         
         Value GetValue() const override;
         std::string GetText() const override;      
+        std::unique_ptr<Impl> CopyFor(Sheet& sheet) const override;
     };
     
     class TextImpl : public Impl {
@@ -51,36 +116,69 @@ private:
         explicit TextImpl(std::string text); 
         Value GetValue() const override;       
         std::string GetText() const override;
+        std::string_view GetPlainText() const override;
+        std::unique_ptr<Impl> CopyFor(Sheet& sheet) const override;
         
-    private:
+    protected:
         std::string text_;        
     };
+
+    // Текст, записывающий число: число разбирается один раз при записи в ячейку
+    class NumberImpl : public TextImpl {
+    public:
+
+        NumberImpl(std::string text, double number);
+        std::optional<double> GetNumber() const override;
+        std::unique_ptr<Impl> CopyFor(Sheet& sheet) const override;
+
+    private:
+        double number_;
+    };
     
     class FormulaImpl : public Impl {
     public:
         
-        explicit FormulaImpl(std::string text, SheetInterface& sheet);
+        explicit FormulaImpl(std::string text, Sheet& sheet, Position position);
+        FormulaImpl(FormulaProgram program, Sheet& sheet, Position position);
+        // Копия для другой таблицы: формула общая, кеш копируется
+        FormulaImpl(const FormulaImpl& other, Sheet& sheet);
         Value GetValue() const override;
         std::string GetText() const override;
+        std::optional<double> GetNumber() const override;
 
         std::vector<Position> GetReferencedCells() const override;
+        std::vector<Range> GetReferencedRanges() const override;
+        const FormulaInterface* GetFormula() const override;
 
-        void InvalidateCache() override;
+        bool IsCacheValid() const override;
+        bool IsCacheValid(uint64_t epoch) const override;
+        uint64_t GetVerifiedAt() const override;
+        void MarkVerified() const override;
+        bool Recalculate() const override;
+        std::unique_ptr<Impl> CopyFor(Sheet& sheet) const override;
 
         mutable Cell::Value cache_;
-        mutable bool isCacheValid = false;
+        mutable uint64_t verified_at_ = 0;
         
     private:
-        std::unique_ptr<FormulaInterface> formula_ptr_;  
+        Formula formula_;
 
-        SheetInterface& sheet_;      
+        Sheet& sheet_;
+        Position position_;
     };
     
     std::unique_ptr<Impl> impl_;
-    SheetInterface& sheet_;
+    Sheet& sheet_;
 
     Position position_;
+    uint64_t owner_token_;
+    mutable uint64_t changed_at_ = 0;
 
     bool CheckCircularDependecy(Impl& impl);
 
+    template <typename T, typename... Args>
+    static std::unique_ptr<Impl> MakeImpl(Sheet& sheet, Args&&... args);
+
 };
+
+using CellPtr = std::shared_ptr<Cell>;
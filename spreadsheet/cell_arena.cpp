@@ -0,0 +1,358 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#include "cell_arena.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#define SPREADSHEET_HAS_MMAP
+#endif
+
+namespace {
+
+// Участок памяти size байт, выровненный по alignment. Страницы участка
+// не занимают память, пока в них не пишут.
+void* MapChunk(size_t size, size_t alignment) {
+#ifdef SPREADSHEET_HAS_MMAP
+    void* mapped = mmap(nullptr, size + alignment, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+    auto* begin = static_cast<char*>(mapped);
+    const auto address = reinterpret_cast<std::uintptr_t>(begin);
+    auto* aligned = begin + (alignment - address % alignment) % alignment;
+    if (aligned != begin) {
+        munmap(begin, aligned - begin);
+    }
+    if (aligned + size != begin + size + alignment) {
+        munmap(aligned + size, begin + size + alignment - (aligned + size));
+    }
+    return aligned;
+#else
+    void* chunk = std::aligned_alloc(alignment, size);
+    if (!chunk) {
+        throw std::bad_alloc();
+    }
+    return chunk;
+#endif
+}
+
+void UnmapChunk(void* chunk, size_t size) {
+#ifdef SPREADSHEET_HAS_MMAP
+    munmap(chunk, size);
+#else
+    std::free(chunk);
+#endif
+}
+
+// Участки удалённых арен: следующая арена берёт их без отображения заново и без
+// обнуления страниц системой, поэтому короткоживущие таблицы (копии Sheet::Fork)
+// не платят за память заново. Пул ограничен MAX_POOLED_CHUNKS участками.
+class ChunkPool {
+public:
+    static constexpr size_t MAX_POOLED_CHUNKS = 32;
+
+    // Не удаляется: арены статических таблиц освобождаются при выходе в любом порядке
+    static ChunkPool& Instance() {
+        static auto* pool = new ChunkPool();
+        return *pool;
+    }
+
+    void* Take(size_t size, size_t alignment) {
+        {
+            std::lock_guard lock(mutex_);
+            if (!chunks_.empty()) {
+                void* chunk = chunks_.back();
+                chunks_.pop_back();
+                return chunk;
+            }
+        }
+        return MapChunk(size, alignment);
+    }
+
+    void Put(void* chunk, size_t size) {
+        {
+            std::lock_guard lock(mutex_);
+            if (chunks_.size() < MAX_POOLED_CHUNKS) {
+                chunks_.push_back(chunk);
+                return;
+            }
+        }
+        UnmapChunk(chunk, size);
+    }
+
+private:
+    std::mutex mutex_;
+    std::vector<void*> chunks_;
+};
+
+// Отдаёт системе страницы блока; блок остаётся отображённым
+void DiscardPages(void* slab, size_t size) {
+#ifdef SPREADSHEET_HAS_MMAP
+    madvise(slab, size, MADV_DONTNEED);
+#endif
+}
+
+}  // namespace
+
+CellArena* CellArena::Create() {
+    return new CellArena();
+}
+
+void CellArena::Release() {
+    released_.store(true, std::memory_order_relaxed);
+    auto& cache = GetThreadCache();
+    if (cache.arena == this) {
+        cache.Flush();
+    }
+    if (Unref()) {
+        delete this;
+    }
+}
+
+CellArena::~CellArena() {
+    for (void* chunk : chunks_) {
+        ChunkPool::Instance().Put(chunk, CHUNK_SIZE);
+    }
+}
+
+void* CellArena::Allocate(size_t size) {
+    if (size == 0 || size > MAX_SLOT_SIZE) {
+        throw std::bad_alloc();
+    }
+    const size_t slot_class = (size - 1) / GRANULARITY;
+
+    auto& cache = GetThreadCache();
+    if (cache.arena == this && cache.free[slot_class]) {
+        FreeSlot* slot = cache.free[slot_class];
+        cache.free[slot_class] = slot->next;
+        --cache.counts[slot_class];
+        --cache.total;
+        return slot;
+    }
+    if (cache.arena != this) {
+        cache.Flush();
+        if (!released_.load(std::memory_order_relaxed)) {
+            cache.arena = this;
+        }
+    }
+
+    std::lock_guard lock(mutex_);
+    void* slot = AllocateLocked(slot_class);
+    if (cache.arena == this) {
+        // слоты впрок: следующие выделения этого класса обойдутся без мьютекса. Список
+        // пополняется с конца, чтобы слоты выдавались в порядке адресов: ячейки, созданные
+        // подряд, лежат в памяти подряд, и обход таблицы идёт по памяти вперёд
+        FreeSlot** tail = &cache.free[slot_class];
+        try {
+            while (cache.counts[slot_class] < CACHE_SLOTS / 2) {
+                auto* spare = static_cast<FreeSlot*>(AllocateLocked(slot_class));
+                spare->next = nullptr;
+                *tail = spare;
+                tail = &spare->next;
+                ++cache.counts[slot_class];
+                ++cache.total;
+            }
+        } catch (const std::bad_alloc&) {
+        }
+    }
+    return slot;
+}
+
+void CellArena::Free(void* ptr) {
+    if (!ptr) {
+        return;
+    }
+    SlabHeader* slab = GetSlab(ptr);
+    CellArena* arena = slab->arena;
+    const size_t slot_class = slab->slot_class;
+
+    auto& cache = GetThreadCache();
+    const bool cached = cache.arena == arena
+        && !arena->released_.load(std::memory_order_relaxed);
+    if (cached && cache.counts[slot_class] < CACHE_SLOTS) {
+        auto* slot = static_cast<FreeSlot*>(ptr);
+        slot->next = cache.free[slot_class];
+        cache.free[slot_class] = slot;
+        ++cache.counts[slot_class];
+        ++cache.total;
+        return;
+    }
+
+    bool last = false;
+    {
+        std::lock_guard lock(arena->mutex_);
+        last = arena->FreeLocked(ptr);
+        // переполненный кеш класса возвращается арене целиком под тем же мьютексом
+        if (cached) {
+            while (FreeSlot* slot = cache.free[slot_class]) {
+                cache.free[slot_class] = slot->next;
+                last = arena->FreeLocked(slot);
+            }
+            cache.total -= cache.counts[slot_class];
+            cache.counts[slot_class] = 0;
+        }
+    }
+    if (last) {
+        delete arena;
+    }
+}
+
+void CellArena::FlushThreadCache() {
+    GetThreadCache().Flush();
+}
+
+CellArena::Statistics CellArena::GetStatistics() const {
+    std::lock_guard lock(mutex_);
+    Statistics statistics;
+    statistics.slabs = slabs_.size();
+    statistics.used_slots = refs_ - 1;
+    for (const auto& slots : classes_) {
+        statistics.free_slots += slots.free_count;
+    }
+    return statistics;
+}
+
+void CellArena::ThreadCache::Flush() {
+    // без слотов в кеше арена могла быть уже удалена
+    if (total == 0) {
+        arena = nullptr;
+        return;
+    }
+    bool last = false;
+    {
+        std::lock_guard lock(arena->mutex_);
+        for (size_t slot_class = 0; slot_class < CLASS_COUNT; ++slot_class) {
+            while (FreeSlot* slot = free[slot_class]) {
+                free[slot_class] = slot->next;
+                last = arena->FreeLocked(slot);
+            }
+            counts[slot_class] = 0;
+        }
+    }
+    if (last) {
+        delete arena;
+    }
+    total = 0;
+    arena = nullptr;
+}
+
+CellArena::SlabHeader* CellArena::GetSlab(void* slot) {
+    const auto address = reinterpret_cast<std::uintptr_t>(slot);
+    return reinterpret_cast<SlabHeader*>(address & ~(SLAB_SIZE - 1));
+}
+
+CellArena::ThreadCache& CellArena::GetThreadCache() {
+    thread_local ThreadCache cache;
+    return cache;
+}
+
+void* CellArena::AllocateLocked(size_t slot_class) {
+    auto& slots = classes_[slot_class];
+    if (slots.free) {
+        FreeSlot* slot = slots.free;
+        slots.free = slot->next;
+        --slots.free_count;
+        SlabHeader* slab = GetSlab(slot);
+        if (slab->used++ == 0 && slab != slots.current) {
+            --slots.empty_slabs;
+        }
+        ++refs_;
+        return slot;
+    }
+    const size_t slot_size = (slot_class + 1) * GRANULARITY;
+    if (slots.next + slot_size > slots.end) {
+        AddSlab(slot_class);
+    }
+    void* slot = slots.next;
+    slots.next += slot_size;
+    ++slots.current->used;
+    ++refs_;
+    return slot;
+}
+
+bool CellArena::FreeLocked(void* ptr) {
+    SlabHeader* slab = GetSlab(ptr);
+    const size_t slot_class = slab->slot_class;
+    auto& slots = classes_[slot_class];
+    auto* slot = static_cast<FreeSlot*>(ptr);
+    slot->next = slots.free;
+    slots.free = slot;
+    ++slots.free_count;
+    if (--slab->used == 0 && slab != slots.current) {
+        ++slots.empty_slabs;
+        // отпущенная арена освобождает блоки целиком вместе с последним слотом
+        if (!released_.load(std::memory_order_relaxed) && slots.empty_slabs >= MIN_TRIM_SLABS
+            && slots.empty_slabs * 8 >= slots.slabs) {
+            Trim(slot_class);
+        }
+    }
+    return --refs_ == 0;
+}
+
+void CellArena::AddSlab(size_t slot_class) {
+    if (spare_slabs_.empty()) {
+        chunks_.reserve(chunks_.size() + 1);
+        spare_slabs_.reserve(CHUNK_SIZE / SLAB_SIZE);
+        auto* chunk = static_cast<char*>(ChunkPool::Instance().Take(CHUNK_SIZE, SLAB_SIZE));
+        chunks_.push_back(chunk);
+        // блоки берутся с начала участка
+        for (size_t offset = CHUNK_SIZE; offset > 0; offset -= SLAB_SIZE) {
+            spare_slabs_.push_back(chunk + offset - SLAB_SIZE);
+        }
+    }
+    slabs_.reserve(slabs_.size() + 1);
+    void* memory = spare_slabs_.back();
+    spare_slabs_.pop_back();
+    slabs_.push_back(memory);
+    auto* slab = new (memory) SlabHeader{this, slot_class};
+
+    auto& slots = classes_[slot_class];
+    // прежний текущий блок мог освободиться раньше, чем был размечен до конца
+    if (slots.current && slots.current->used == 0) {
+        ++slots.empty_slabs;
+    }
+    ++slots.slabs;
+    slots.current = slab;
+    const size_t slot_size = (slot_class + 1) * GRANULARITY;
+    slots.next = static_cast<char*>(memory) + HEADER_SIZE;
+    slots.end = slots.next + (SLAB_SIZE - HEADER_SIZE) / slot_size * slot_size;
+}
+
+void CellArena::Trim(size_t slot_class) {
+    auto& slots = classes_[slot_class];
+    auto is_empty = [&slots](SlabHeader* slab) {
+        return slab->used == 0 && slab != slots.current;
+    };
+
+    FreeSlot** link = &slots.free;
+    while (*link) {
+        if (is_empty(GetSlab(*link))) {
+            *link = (*link)->next;
+            --slots.free_count;
+        } else {
+            link = &(*link)->next;
+        }
+    }
+
+    spare_slabs_.reserve(spare_slabs_.size() + slots.empty_slabs);
+    slabs_.erase(std::remove_if(slabs_.begin(), slabs_.end(), [&](void* memory) {
+        auto* slab = static_cast<SlabHeader*>(memory);
+        if (slab->slot_class != slot_class || !is_empty(slab)) {
+            return false;
+        }
+        DiscardPages(memory, SLAB_SIZE);
+        spare_slabs_.push_back(memory);
+        return true;
+    }), slabs_.end());
+    slots.slabs -= slots.empty_slabs;
+    slots.empty_slabs = 0;
+}
+
+bool CellArena::Unref() {
+    std::lock_guard lock(mutex_);
+    return --refs_ == 0;
+}
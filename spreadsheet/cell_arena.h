@@ -0,0 +1,161 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Память ячеек одной таблицы: объекты раскладываются по слотам фиксированных размеров
+// (классам, кратным GRANULARITY) в блоках по SLAB_SIZE байт. Освобождённый слот
+// попадает в список свободных своего класса и отдаётся следующему выделению того же
+// размера, поэтому замена содержимого ячеек не дробит кучу. Блок выровнен по своему
+// размеру, а его заголовок указывает на арену, поэтому слот освобождается по одному
+// указателю (Free) из любого потока.
+// Каждый поток держит небольшой кеш свободных слотов одной арены: выделение и
+// освобождение берут мьютекс арены только при его пополнении или переполнении,
+// поэтому потоки, собирающие ячейки параллельно, почти не ждут друг друга.
+// Слоты в кеше потока считаются занятыми.
+// Блоки нарезаются из отображённых участков по CHUNK_SIZE байт. Пока таблица держит
+// арену, блоки, в которых не осталось занятых слотов, отдают свои страницы системе
+// и ждут повторного использования, когда таких блоков в классе становится не меньше
+// восьмой части: после замены всех ячеек таблицы резидентная память не остаётся
+// на уровне пика.
+// Ячейки могут пережить таблицу (снимки, копии таблицы): таблица отпускает арену
+// (Release), а арена удаляется вместе с последним занятым слотом и возвращает
+// все блоки разом. Участки удалённых арен переходят следующим аренам процесса.
+class CellArena {
+public:
+    static constexpr size_t SLAB_SIZE = 64 << 10;
+    static constexpr size_t CHUNK_SIZE = 2 << 20;
+    static constexpr size_t GRANULARITY = 16;
+    static constexpr size_t MAX_SLOT_SIZE = 256;
+
+    struct Statistics {
+        size_t slabs = 0;
+        size_t used_slots = 0;
+        size_t free_slots = 0;
+    };
+
+    // Новая арена, которую держит вызывающий
+    static CellArena* Create();
+    // Отпускает арену, полученную от Create; слоты, освобождённые после этого,
+    // возвращаются арене сразу, минуя кеши потоков
+    void Release();
+
+    // size не больше MAX_SLOT_SIZE
+    void* Allocate(size_t size);
+    static void Free(void* ptr);
+
+    // Возвращает арене слоты из кеша вызывающего потока
+    static void FlushThreadCache();
+
+    Statistics GetStatistics() const;
+
+private:
+    static constexpr size_t CLASS_COUNT = MAX_SLOT_SIZE / GRANULARITY;
+
+    // блоков одного класса, после которых пустые блоки возвращаются системе
+    static constexpr size_t MIN_TRIM_SLABS = 4;
+    // наибольшее число слотов класса в кеше потока; пополняется половиной
+    static constexpr size_t CACHE_SLOTS = 32;
+
+    struct SlabHeader {
+        CellArena* arena;
+        size_t slot_class;
+        // занятые слоты блока
+        size_t used = 0;
+    };
+    // Слоты начинаются после заголовка с выравниванием GRANULARITY
+    static constexpr size_t HEADER_SIZE =
+        (sizeof(SlabHeader) + GRANULARITY - 1) / GRANULARITY * GRANULARITY;
+
+    struct FreeSlot {
+        FreeSlot* next;
+    };
+
+    // Класс слотов: свободные слоты и ещё не размеченный остаток последнего блока
+    // (current). Пустым считается блок без занятых слотов, кроме current.
+    struct SlotClass {
+        FreeSlot* free = nullptr;
+        SlabHeader* current = nullptr;
+        char* next = nullptr;
+        char* end = nullptr;
+        size_t free_count = 0;
+        size_t slabs = 0;
+        size_t empty_slabs = 0;
+    };
+
+    // Кеш потока: свободные слоты арены arena по классам
+    struct ThreadCache {
+        CellArena* arena = nullptr;
+        std::array<FreeSlot*, CLASS_COUNT> free{};
+        std::array<size_t, CLASS_COUNT> counts{};
+        size_t total = 0;
+
+        ~ThreadCache() { Flush(); }
+        void Flush();
+    };
+
+    mutable std::mutex mutex_;
+    std::atomic<bool> released_{false};
+    std::array<SlotClass, CLASS_COUNT> classes_;
+    // отображённые участки, занятые блоки и блоки без страниц, готовые к повторному
+    // использованию
+    std::vector<void*> chunks_;
+    std::vector<void*> slabs_;
+    std::vector<void*> spare_slabs_;
+    // занятые слоты плюс ссылка владельца
+    size_t refs_ = 1;
+
+    CellArena() = default;
+    ~CellArena();
+
+    static SlabHeader* GetSlab(void* slot);
+    static ThreadCache& GetThreadCache();
+    // Под мьютексом арены
+    void* AllocateLocked(size_t slot_class);
+    // Под мьютексом арены; true, если арену нужно удалить
+    bool FreeLocked(void* ptr);
+    void AddSlab(size_t slot_class);
+    // Отдаёт системе страницы пустых блоков класса и убирает их слоты из списка свободных
+    void Trim(size_t slot_class);
+    // Уменьшает число ссылок под мьютексом; true, если арену нужно удалить
+    bool Unref();
+};
+
+// Аллокатор для std::allocate_shared: блок управления вместе с объектом
+// занимают один слот арены
+template <typename T>
+class CellArenaAllocator {
+public:
+    using value_type = T;
+
+    explicit CellArenaAllocator(CellArena& arena) : arena_(&arena) {}
+    template <typename U>
+    CellArenaAllocator(const CellArenaAllocator<U>& other) : arena_(other.arena_) {}
+
+    T* allocate(size_t n) {
+        static_assert(sizeof(T) <= CellArena::MAX_SLOT_SIZE, "Object does not fit an arena slot");
+        return static_cast<T*>(arena_->Allocate(n * sizeof(T)));
+    }
+    void deallocate(T* ptr, size_t) {
+        CellArena::Free(ptr);
+    }
+
+    template <typename U>
+    bool operator==(const CellArenaAllocator<U>& other) const {
+        return arena_ == other.arena_;
+    }
+    template <typename U>
+    bool operator!=(const CellArenaAllocator<U>& other) const {
+        return arena_ != other.arena_;
+    }
+
+private:
+    template <typename U>
+    friend class CellArenaAllocator;
+
+    CellArena* arena_;
+};
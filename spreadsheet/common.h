@@ -2,9 +2,11 @@
 
 #include <iosfwd>
 #include <memory>
+#include <optional>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <utility>
 #include <variant>
 #include <vector>
 
@@ -26,6 +28,22 @@ struct Position {
     static const Position NONE;
 };
 
+// Прямоугольный диапазон ячеек A1:B2; обе границы входят в диапазон
+struct Range {
+    Position first;
+    Position last;
+
+    bool operator==(Range rhs) const;
+    bool operator<(Range rhs) const;
+
+    bool IsValid() const;
+    bool Contains(Position pos) const;
+    std::string ToString() const;
+
+    // Диапазон по двум противоположным углам: first - левый верхний, last - правый нижний
+    static Range FromCorners(Position lhs, Position rhs);
+};
+
 struct Size {
     int rows = 0;
     int cols = 0;
@@ -93,6 +111,12 @@ public:
     // содержащий экранирующие символы). В случае формулы - её выражение.
     virtual std::string GetText() const = 0;
 
+    // Возвращает значение ячейки как число для формул без копирования строки:
+    // для текста, записывающего число, и для формулы с числовым результатом.
+    // std::nullopt означает, что значение нужно разбирать из GetValue().
+    // Реализация по умолчанию возвращает только числовое значение из GetValue().
+    virtual std::optional<double> GetNumber() const;
+
     // Возвращает список ячеек, которые непосредственно задействованы в данной
     // формуле. Список отсортирован по возрастанию и не содержит повторяющихся
     // ячеек. В случае текстовой ячейки список пуст.
@@ -143,6 +167,22 @@ public:
     // соответственно. Пустая ячейка представляется пустой строкой в любом случае.
     virtual void PrintValues(std::ostream& output) const = 0;
     virtual void PrintTexts(std::ostream& output) const = 0;
+
+    // Выводит прямоугольник range так же, как PrintValues() и PrintTexts() выводят
+    // всю таблицу: строка на каждую строку диапазона, в строке все его столбцы.
+    // Вычисляются только формулы диапазона и то, от чего они зависят.
+    // Реализация по умолчанию опрашивает каждую позицию диапазона через GetCell().
+    virtual void PrintValues(std::ostream& output, const Range& range) const;
+    virtual void PrintTexts(std::ostream& output, const Range& range) const;
+
+    // Собирает значения непустых ячеек диапазона построчно вместе с их позициями
+    virtual void GetValuesInRange(const Range& range,
+                                  std::vector<std::pair<Position, CellInterface::Value>>& values) const;
+
+    // Собирает непустые ячейки диапазона построчно. Реализация по умолчанию
+    // опрашивает каждую позицию диапазона через GetCell().
+    virtual void GetCellsInRange(const Range& range,
+                                 std::vector<const CellInterface*>& cells) const;
 };
 
 // Создаёт готовую к работе пустую таблицу.
@@ -0,0 +1,666 @@
+#include "dependency_graph.h"
+
+#include <algorithm>
+#include <tuple>
+
+#include "sheet_file.h"
+
+// --- DependencyGraph::Adjacency ---
+
+void DependencyGraph::Adjacency::Resize(size_t node_count) {
+    if (delta_head_.size() < node_count) {
+        delta_head_.resize(node_count, NONE);
+    }
+}
+
+void DependencyGraph::Adjacency::Add(uint32_t from, uint32_t to) {
+    uint32_t e = delta_free_;
+    if (e != NONE) {
+        delta_free_ = delta_[e].next;
+        delta_[e] = {to, delta_head_[from]};
+    } else {
+        e = static_cast<uint32_t>(delta_.size());
+        delta_.push_back({to, delta_head_[from]});
+    }
+    delta_head_[from] = e;
+    ++delta_count_;
+}
+
+void DependencyGraph::Adjacency::Remove(uint32_t from, uint32_t to) {
+    for (uint32_t* link = &delta_head_[from]; *link != NONE; link = &delta_[*link].next) {
+        const uint32_t e = *link;
+        if (delta_[e].to == to) {
+            *link = delta_[e].next;
+            delta_[e].next = delta_free_;
+            delta_free_ = e;
+            --delta_count_;
+            return;
+        }
+    }
+    if (from + 1 < offsets_.size()) {
+        for (uint32_t i = offsets_[from]; i < offsets_[from + 1]; ++i) {
+            if (targets_[i] == to) {
+                targets_[i] = NONE;
+                ++tombstones_;
+                return;
+            }
+        }
+    }
+}
+
+bool DependencyGraph::Adjacency::IsEmpty(uint32_t from) const {
+    if (delta_head_[from] != NONE) {
+        return false;
+    }
+    if (from + 1 < offsets_.size()) {
+        for (uint32_t i = offsets_[from]; i < offsets_[from + 1]; ++i) {
+            if (targets_[i] != NONE) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void DependencyGraph::Adjacency::Assign(std::vector<uint32_t> offsets,
+                                        std::vector<uint32_t> targets) {
+    const size_t node_count = offsets.empty() ? 0 : offsets.size() - 1;
+    offsets_ = std::move(offsets);
+    targets_ = std::move(targets);
+    tombstones_ = 0;
+
+    delta_head_.assign(node_count, NONE);
+    delta_.clear();
+    delta_free_ = NONE;
+    delta_count_ = 0;
+}
+
+// Буфер и удалённые ребра растут не больше четверти сжатой части,
+// поэтому уплотнение стоит амортизированно O(1) на правку
+bool DependencyGraph::Adjacency::NeedsCompaction() const {
+    constexpr size_t MIN_DELTA = 4096;
+    return delta_count_ + tombstones_ > std::max(MIN_DELTA, targets_.size() / 4);
+}
+
+void DependencyGraph::Adjacency::Compact() {
+    const size_t node_count = delta_head_.size();
+    std::vector<uint32_t> offsets(node_count + 1);
+    std::vector<uint32_t> targets;
+    targets.reserve(targets_.size() - tombstones_ + delta_count_);
+
+    for (size_t from = 0; from < node_count; ++from) {
+        offsets[from] = static_cast<uint32_t>(targets.size());
+        const size_t begin = targets.size();
+        ForEach(static_cast<uint32_t>(from), [&targets](uint32_t to) {
+            targets.push_back(to);
+        });
+        // буфер хранит ребра в обратном порядке добавления
+        std::sort(targets.begin() + begin, targets.end());
+    }
+    offsets[node_count] = static_cast<uint32_t>(targets.size());
+
+    offsets_ = std::move(offsets);
+    targets_ = std::move(targets);
+    tombstones_ = 0;
+
+    std::fill(delta_head_.begin(), delta_head_.end(), NONE);
+    delta_.clear();
+    delta_.shrink_to_fit();
+    delta_free_ = NONE;
+    delta_count_ = 0;
+}
+
+size_t DependencyGraph::Adjacency::GetEdgeMemory() const {
+    return targets_.capacity() * sizeof(uint32_t) + delta_.capacity() * sizeof(DeltaEdge);
+}
+
+size_t DependencyGraph::Adjacency::GetNodeMemory() const {
+    return (offsets_.capacity() + delta_head_.capacity()) * sizeof(uint32_t);
+}
+
+// --- DependencyGraph ---
+
+void DependencyGraph::SetReferences(Position pos, const std::vector<Position>& refs,
+                                    const std::vector<Range>& ranges) {
+    auto it = ids_.find(pos);
+    if (it == ids_.end() && refs.empty() && ranges.empty()) {
+        return;
+    }
+    if (std::find(refs.begin(), refs.end(), pos) != refs.end()) {
+        throw CircularDependencyException("circular dependency detected");
+    }
+    const uint32_t id = it != ids_.end() ? it->second : GetOrCreateNode(pos, false);
+
+    std::vector<uint32_t> old_refs;
+    refs_.ForEach(id, [&old_refs](uint32_t ref) {
+        old_refs.push_back(ref);
+    });
+    std::sort(old_refs.begin(), old_refs.end());
+
+    std::vector<uint32_t> new_refs;
+    new_refs.reserve(refs.size() + ranges.size());
+    for (const auto ref : refs) {
+        new_refs.push_back(GetOrCreateNode(ref, true));
+    }
+    for (const auto& range : ranges) {
+        new_refs.push_back(GetOrCreateRangeNode(range));
+    }
+    std::sort(new_refs.begin(), new_refs.end());
+    new_refs.erase(std::unique(new_refs.begin(), new_refs.end()), new_refs.end());
+
+    std::vector<uint32_t> added;
+    for (const auto ref_id : new_refs) {
+        if (std::binary_search(old_refs.begin(), old_refs.end(), ref_id)) {
+            continue;
+        }
+        if (!AddEdge(ref_id, id)) {
+            for (const auto added_ref : added) {
+                RemoveEdge(added_ref, id);
+            }
+            for (const auto new_ref : new_refs) {
+                EraseNodeIfIsolated(new_ref);
+            }
+            EraseNodeIfIsolated(id);
+            throw CircularDependencyException("circular dependency detected");
+        }
+        added.push_back(ref_id);
+    }
+
+    for (const auto old_ref : old_refs) {
+        if (!std::binary_search(new_refs.begin(), new_refs.end(), old_ref)) {
+            RemoveEdge(old_ref, id);
+            EraseNodeIfIsolated(old_ref);
+        }
+    }
+    EraseNodeIfIsolated(id);
+    CompactIfNeeded();
+}
+
+void DependencyGraph::RemoveReferences(Position pos) {
+    SetReferences(pos, {});
+}
+
+std::vector<Position> DependencyGraph::GetReferences(Position pos) const {
+    std::vector<Position> result;
+    ForEachReference(pos, [&result](Position ref) {
+        result.push_back(ref);
+    });
+    return result;
+}
+
+std::vector<Range> DependencyGraph::GetReferencedRanges(Position pos) const {
+    std::vector<Range> result;
+    ForEachReferencedRange(pos, [&result](const Range& range) {
+        result.push_back(range);
+    });
+    return result;
+}
+
+bool DependencyGraph::HasDependants(Position pos) const {
+    const uint32_t node = FindNode(pos);
+    // вершина-диапазон существует, только пока на неё ссылается формула
+    return (node != NONE && !deps_.IsEmpty(node)) || IsInsideAnyRange(pos);
+}
+
+bool DependencyGraph::HasDirectDependants(Position pos) const {
+    const uint32_t node = FindNode(pos);
+    return node != NONE && !deps_.IsEmpty(node);
+}
+
+bool DependencyGraph::HasReferences(Position pos) const {
+    const uint32_t node = FindNode(pos);
+    return node != NONE && !refs_.IsEmpty(node);
+}
+
+int DependencyGraph::GetOrder(Position pos) const {
+    const uint32_t node = FindNode(pos);
+    return node != NONE ? order_[node] : 0;
+}
+
+size_t DependencyGraph::GetEdgeMemory() const {
+    return refs_.GetEdgeMemory() + deps_.GetEdgeMemory();
+}
+
+size_t DependencyGraph::GetNodeMemory() const {
+    return refs_.GetNodeMemory() + deps_.GetNodeMemory()
+        + positions_.capacity() * sizeof(Position) + order_.capacity() * sizeof(int)
+        + is_range_.capacity() * sizeof(uint8_t)
+        + visited_.capacity() * sizeof(uint8_t) + free_ids_.capacity() * sizeof(uint32_t);
+}
+
+void DependencyGraph::Compact() {
+    refs_.Compact();
+    deps_.Compact();
+}
+
+void DependencyGraph::Save(BinaryWriter& writer) const {
+    // освобождённые номера пропускаются
+    std::vector<uint32_t> index(positions_.size(), NONE);
+    std::vector<NodeRecord> nodes;
+    for (uint32_t id = 0; id < positions_.size(); ++id) {
+        if (is_range_[id]) {
+            index[id] = static_cast<uint32_t>(nodes.size());
+            nodes.push_back({areas_.at(id), order_[id], 1});
+            continue;
+        }
+        auto it = ids_.find(positions_[id]);
+        if (it != ids_.end() && it->second == id) {
+            index[id] = static_cast<uint32_t>(nodes.size());
+            nodes.push_back({{positions_[id], positions_[id]}, order_[id], 0});
+        }
+    }
+
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> targets;
+    offsets.reserve(nodes.size() + 1);
+    targets.reserve(edge_count_);
+    for (uint32_t id = 0; id < positions_.size(); ++id) {
+        if (index[id] == NONE) {
+            continue;
+        }
+        offsets.push_back(static_cast<uint32_t>(targets.size()));
+        refs_.ForEach(id, [&targets, &index](uint32_t ref) {
+            targets.push_back(index[ref]);
+        });
+    }
+    offsets.push_back(static_cast<uint32_t>(targets.size()));
+
+    writer.WriteArray(nodes);
+    writer.WriteArray(offsets);
+    writer.WriteArray(targets);
+    writer.Write(static_cast<int32_t>(min_order_));
+    writer.Write(static_cast<int32_t>(max_order_));
+}
+
+DependencyGraph DependencyGraph::Load(BinaryReader& reader) {
+    const auto nodes = reader.ReadArray<NodeRecord>();
+    auto offsets = reader.ReadArray<uint32_t>();
+    auto targets = reader.ReadArray<uint32_t>();
+
+    DependencyGraph graph;
+    graph.min_order_ = reader.Read<int32_t>();
+    graph.max_order_ = reader.Read<int32_t>();
+
+    // смещения проверяются целиком до первого обращения к targets
+    const size_t node_count = nodes.size();
+    if (offsets.size() != node_count + 1 || offsets.front() != 0
+        || offsets.back() != targets.size()
+        || !std::is_sorted(offsets.begin(), offsets.end())) {
+        throw SheetFileError("Dependency graph is corrupted");
+    }
+
+    graph.positions_.resize(node_count);
+    graph.is_range_.resize(node_count);
+    graph.order_.resize(node_count);
+    graph.visited_.assign(node_count, false);
+    graph.ids_.reserve(node_count);
+    for (uint32_t id = 0; id < node_count; ++id) {
+        const auto& node = nodes[id];
+        if (!node.area.IsValid() || node.order < graph.min_order_
+            || node.order > graph.max_order_) {
+            throw SheetFileError("Dependency graph is corrupted");
+        }
+        graph.positions_[id] = node.area.first;
+        graph.is_range_[id] = node.is_range != 0;
+        graph.order_[id] = node.order;
+        if (node.is_range) {
+            if (!graph.range_ids_.emplace(node.area, id).second) {
+                throw SheetFileError("Dependency graph is corrupted");
+            }
+            graph.IndexRangeTiles(id, node.area);
+        } else {
+            if (!(node.area.first == node.area.last)
+                || !graph.ids_.emplace(node.area.first, id).second) {
+                throw SheetFileError("Dependency graph is corrupted");
+            }
+            graph.cell_nodes_.Set(node.area.first, id + 1);
+        }
+    }
+
+    // порядок вершин должен оставаться топологическим, иначе в графе мог бы быть цикл
+    std::vector<uint32_t> dep_offsets(node_count + 1, 0);
+    for (uint32_t id = 0; id < node_count; ++id) {
+        for (uint32_t i = offsets[id]; i < offsets[id + 1]; ++i) {
+            const uint32_t ref = targets[i];
+            if (ref >= node_count || graph.order_[ref] >= graph.order_[id]) {
+                throw SheetFileError("Dependency graph is corrupted");
+            }
+            ++dep_offsets[ref + 1];
+        }
+    }
+    for (const auto& [id, range] : graph.areas_) {
+        graph.cell_nodes_.ForEachInRange(range, [&graph, id = id](Position, uint32_t node) {
+            if (graph.order_[node - 1] >= graph.order_[id]) {
+                throw SheetFileError("Dependency graph is corrupted");
+            }
+        });
+    }
+
+    for (size_t id = 0; id < node_count; ++id) {
+        dep_offsets[id + 1] += dep_offsets[id];
+    }
+    std::vector<uint32_t> dep_targets(targets.size());
+    std::vector<uint32_t> next(dep_offsets.begin(), dep_offsets.end() - 1);
+    for (uint32_t id = 0; id < node_count; ++id) {
+        for (uint32_t i = offsets[id]; i < offsets[id + 1]; ++i) {
+            dep_targets[next[targets[i]]++] = id;
+        }
+    }
+
+    graph.edge_count_ = targets.size();
+    graph.refs_.Assign(std::move(offsets), std::move(targets));
+    graph.deps_.Assign(std::move(dep_offsets), std::move(dep_targets));
+    return graph;
+}
+
+// --- DependencyGraph::Builder ---
+
+void DependencyGraph::Builder::AddReferences(Position pos, const std::vector<Position>& refs,
+                                             const std::vector<Range>& ranges) {
+    if (refs.empty() && ranges.empty()) {
+        return;
+    }
+    const uint32_t id = graph_.GetOrCreateNode(pos, false);
+
+    refs_.clear();
+    for (const auto ref : refs) {
+        refs_.push_back(graph_.GetOrCreateNode(ref, true));
+    }
+    for (const auto& range : ranges) {
+        refs_.push_back(graph_.GetOrCreateRangeNode(range));
+    }
+    std::sort(refs_.begin(), refs_.end());
+    refs_.erase(std::unique(refs_.begin(), refs_.end()), refs_.end());
+    for (const auto ref : refs_) {
+        edges_.emplace_back(ref, id);
+    }
+}
+
+DependencyGraph DependencyGraph::Builder::Finish() {
+    auto& graph = graph_;
+    const size_t node_count = graph.positions_.size();
+
+    // ребра по зависимым и по ссылкам в сжатых строках; внутри строки по возрастанию
+    std::sort(edges_.begin(), edges_.end(), [](const auto& lhs, const auto& rhs) {
+        return std::tie(lhs.second, lhs.first) < std::tie(rhs.second, rhs.first);
+    });
+    std::vector<uint32_t> ref_offsets(node_count + 1, 0);
+    std::vector<uint32_t> dep_offsets(node_count + 1, 0);
+    for (const auto& [ref, dep] : edges_) {
+        ++ref_offsets[dep + 1];
+        ++dep_offsets[ref + 1];
+    }
+    for (size_t id = 0; id < node_count; ++id) {
+        ref_offsets[id + 1] += ref_offsets[id];
+        dep_offsets[id + 1] += dep_offsets[id];
+    }
+    std::vector<uint32_t> ref_targets(edges_.size());
+    std::vector<uint32_t> dep_targets(edges_.size());
+    std::vector<uint32_t> next(dep_offsets.begin(), dep_offsets.end() - 1);
+    for (size_t i = 0; i < edges_.size(); ++i) {
+        const auto [ref, dep] = edges_[i];
+        ref_targets[i] = ref;
+        dep_targets[next[ref]++] = dep;
+    }
+
+    // ячейка внутри диапазона - неявная ссылка диапазона
+    std::vector<uint32_t> pending(node_count);
+    std::vector<uint32_t> ready;
+    for (uint32_t id = 0; id < node_count; ++id) {
+        pending[id] = ref_offsets[id + 1] - ref_offsets[id];
+    }
+    for (const auto& [id, range] : graph.areas_) {
+        graph.cell_nodes_.ForEachInRange(range, [&pending, id = id](Position, uint32_t) {
+            ++pending[id];
+        });
+    }
+    for (uint32_t id = 0; id < node_count; ++id) {
+        if (pending[id] == 0) {
+            ready.push_back(id);
+        }
+    }
+
+    int order = 0;
+    auto release = [&pending, &ready](uint32_t id) {
+        if (--pending[id] == 0) {
+            ready.push_back(id);
+        }
+    };
+    while (!ready.empty()) {
+        const uint32_t id = ready.back();
+        ready.pop_back();
+        graph.order_[id] = ++order;
+        for (uint32_t i = dep_offsets[id]; i < dep_offsets[id + 1]; ++i) {
+            release(dep_targets[i]);
+        }
+        if (!graph.is_range_[id]) {
+            graph.ForEachRangeContaining(graph.positions_[id], release);
+        }
+    }
+    if (static_cast<size_t>(order) != node_count) {
+        throw CircularDependencyException("circular dependency detected");
+    }
+
+    graph.min_order_ = 1;
+    graph.max_order_ = order;
+    graph.edge_count_ = edges_.size();
+    graph.refs_.Assign(std::move(ref_offsets), std::move(ref_targets));
+    graph.deps_.Assign(std::move(dep_offsets), std::move(dep_targets));
+    edges_.clear();
+    return std::move(graph);
+}
+
+bool DependencyGraph::IsInsideAnyRange(Position pos) const {
+    bool inside = false;
+    ForEachRangeContaining(pos, [&inside](uint32_t) {
+        inside = true;
+    });
+    return inside;
+}
+
+uint32_t DependencyGraph::AllocateNode() {
+    if (!free_ids_.empty()) {
+        const uint32_t id = free_ids_.back();
+        free_ids_.pop_back();
+        return id;
+    }
+    const auto id = static_cast<uint32_t>(positions_.size());
+    positions_.push_back(Position::NONE);
+    order_.push_back(0);
+    visited_.push_back(false);
+    is_range_.push_back(false);
+    refs_.Resize(positions_.size());
+    deps_.Resize(positions_.size());
+    return id;
+}
+
+// Ячейка внутри диапазона имеет неявное ребро к нему, поэтому тоже ставится в начало
+// порядка: у новой вершины ещё нет явных ребер, и такой порядок ничего не нарушает
+uint32_t DependencyGraph::GetOrCreateNode(Position pos, bool is_source) {
+    auto [it, inserted] = ids_.try_emplace(pos, NONE);
+    if (!inserted) {
+        return it->second;
+    }
+
+    const uint32_t id = AllocateNode();
+    positions_[id] = pos;
+    is_range_[id] = false;
+    order_[id] = is_source || IsInsideAnyRange(pos) ? --min_order_ : ++max_order_;
+    cell_nodes_.Set(pos, id + 1);
+    it->second = id;
+    return id;
+}
+
+// Новый диапазон ставится в конец порядка, после всех ячеек, которые он может содержать
+uint32_t DependencyGraph::GetOrCreateRangeNode(const Range& range) {
+    auto [it, inserted] = range_ids_.try_emplace(range, NONE);
+    if (!inserted) {
+        return it->second;
+    }
+
+    const uint32_t id = AllocateNode();
+    positions_[id] = range.first;
+    is_range_[id] = true;
+    order_[id] = ++max_order_;
+    IndexRangeTiles(id, range);
+    it->second = id;
+    return id;
+}
+
+void DependencyGraph::IndexRangeTiles(uint32_t id, const Range& range) {
+    areas_.emplace(id, range);
+    for (int tile_row = range.first.row >> NodeGrid::TILE_BITS;
+         tile_row <= range.last.row >> NodeGrid::TILE_BITS; ++tile_row) {
+        for (int tile_col = range.first.col >> NodeGrid::TILE_BITS;
+             tile_col <= range.last.col >> NodeGrid::TILE_BITS; ++tile_col) {
+            range_tiles_[TileKey(tile_row, tile_col)].push_back({id, range});
+        }
+    }
+}
+
+void DependencyGraph::EraseNodeIfIsolated(uint32_t id) {
+    if (!refs_.IsEmpty(id) || !deps_.IsEmpty(id)) {
+        return;
+    }
+    if (!is_range_[id]) {
+        ids_.erase(positions_[id]);
+        cell_nodes_.Erase(positions_[id]);
+        free_ids_.push_back(id);
+        return;
+    }
+
+    const Range range = areas_.at(id);
+    for (int tile_row = range.first.row >> NodeGrid::TILE_BITS;
+         tile_row <= range.last.row >> NodeGrid::TILE_BITS; ++tile_row) {
+        for (int tile_col = range.first.col >> NodeGrid::TILE_BITS;
+             tile_col <= range.last.col >> NodeGrid::TILE_BITS; ++tile_col) {
+            auto tile = range_tiles_.find(TileKey(tile_row, tile_col));
+            auto& entries = tile->second;
+            auto entry = std::find_if(entries.begin(), entries.end(), [id](const RangeEntry& e) {
+                return e.id == id;
+            });
+            *entry = entries.back();
+            entries.pop_back();
+            if (entries.empty()) {
+                range_tiles_.erase(tile);
+            }
+        }
+    }
+    range_ids_.erase(range);
+    areas_.erase(id);
+    is_range_[id] = false;
+    free_ids_.push_back(id);
+}
+
+bool DependencyGraph::AddEdge(uint32_t ref, uint32_t dep) {
+    if (order_[ref] > order_[dep]) {
+        const int lower = order_[dep];
+        const int upper = order_[ref];
+
+        std::vector<uint32_t> forward;
+        if (!CollectAffected(dep, true, lower, upper, ref, forward)) {
+            return false;
+        }
+        std::vector<uint32_t> backward;
+        CollectAffected(ref, false, lower, upper, dep, backward);
+        Reorder(backward, forward);
+    }
+
+    deps_.Add(ref, dep);
+    refs_.Add(dep, ref);
+    ++edge_count_;
+    return true;
+}
+
+void DependencyGraph::RemoveEdge(uint32_t ref, uint32_t dep) {
+    deps_.Remove(ref, dep);
+    refs_.Remove(dep, ref);
+    --edge_count_;
+}
+
+bool DependencyGraph::CollectAffected(uint32_t start, bool forward, int lower, int upper,
+                                      uint32_t target, std::vector<uint32_t>& result) {
+    std::vector<uint32_t> stack{start};
+    visited_[start] = true;
+    bool found_target = false;
+
+    auto visit = [&](uint32_t next) {
+        if (found_target || visited_[next]) {
+            return;
+        }
+        if (next == target) {
+            found_target = true;
+            return;
+        }
+        if (order_[next] < lower || order_[next] > upper) {
+            return;
+        }
+        visited_[next] = true;
+        stack.push_back(next);
+    };
+
+    while (!stack.empty() && !found_target) {
+        const uint32_t current = stack.back();
+        stack.pop_back();
+        result.push_back(current);
+
+        if (forward) {
+            deps_.ForEach(current, visit);
+            if (!is_range_[current]) {
+                ForEachRangeContaining(positions_[current], visit);
+            }
+        } else {
+            refs_.ForEach(current, visit);
+            if (is_range_[current]) {
+                cell_nodes_.ForEachInRange(areas_.at(current), [&visit](Position, uint32_t node) {
+                    visit(node - 1);
+                });
+            }
+        }
+    }
+
+    for (const auto id : result) {
+        visited_[id] = false;
+    }
+    for (const auto id : stack) {
+        visited_[id] = false;
+    }
+    return !found_target;
+}
+
+// Вершины, из которых достижим ref, должны оказаться раньше вершин, достижимых
+// из dep; обе группы занимают тот же набор номеров, что и раньше.
+void DependencyGraph::Reorder(std::vector<uint32_t>& backward, std::vector<uint32_t>& forward) {
+    auto by_order = [this](uint32_t lhs, uint32_t rhs) {
+        return order_[lhs] < order_[rhs];
+    };
+    std::sort(backward.begin(), backward.end(), by_order);
+    std::sort(forward.begin(), forward.end(), by_order);
+
+    std::vector<int> orders;
+    orders.reserve(backward.size() + forward.size());
+    for (const auto id : backward) {
+        orders.push_back(order_[id]);
+    }
+    for (const auto id : forward) {
+        orders.push_back(order_[id]);
+    }
+    std::sort(orders.begin(), orders.end());
+
+    size_t i = 0;
+    for (const auto id : backward) {
+        order_[id] = orders[i++];
+    }
+    for (const auto id : forward) {
+        order_[id] = orders[i++];
+    }
+}
+
+void DependencyGraph::CompactIfNeeded() {
+    if (refs_.NeedsCompaction()) {
+        refs_.Compact();
+    }
+    if (deps_.NeedsCompaction()) {
+        deps_.Compact();
+    }
+}
@@ -0,0 +1,269 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "common.h"
+#include "tile_grid.h"
+
+class BinaryReader;
+class BinaryWriter;
+
+// Граф зависимостей между ячейками: ребро ref -> dep означает, что формула в dep
+// ссылается на ref. Поддерживает топологический порядок вершин (ord[ref] < ord[dep])
+// инкрементально, алгоритмом Пирса-Келли: при вставке ребра, нарушающего порядок,
+// просматривается только область между ord[dep] и ord[ref].
+// Диапазон, на который ссылается формула, - отдельная вершина с одним ребром к формуле;
+// ребра от ячеек внутри диапазона к нему неявные и находятся через индекс по тайлам.
+class DependencyGraph {
+public:
+    struct PositionHasher {
+        size_t operator()(const Position& p) const {
+            return std::hash<size_t>()(
+                (static_cast<size_t>(p.row) << 32) | static_cast<size_t>(p.col)
+                );
+        }
+    };
+
+    // Заменяет ссылки формулы в pos на ячейки refs и диапазоны ranges. Если новые
+    // ребра образуют цикл, бросает CircularDependencyException и оставляет граф без изменений.
+    void SetReferences(Position pos, const std::vector<Position>& refs,
+                       const std::vector<Range>& ranges = {});
+    void RemoveReferences(Position pos);
+
+    // Ячейки, на которые ссылается pos
+    std::vector<Position> GetReferences(Position pos) const;
+    // Диапазоны, на которые ссылается pos
+    std::vector<Range> GetReferencedRanges(Position pos) const;
+    bool HasDependants(Position pos) const;
+    // Есть ли формулы, ссылающиеся на pos напрямую, а не через диапазон
+    bool HasDirectDependants(Position pos) const;
+    // Есть ли у pos ссылки на ячейки или диапазоны
+    bool HasReferences(Position pos) const;
+
+    // func(Position) для каждой ячейки, на которую ссылается pos
+    template <typename Func>
+    void ForEachReference(Position pos, Func&& func) const {
+        const uint32_t node = FindNode(pos);
+        if (node != NONE) {
+            refs_.ForEach(node, [this, &func](uint32_t id) {
+                if (!is_range_[id]) {
+                    func(positions_[id]);
+                }
+            });
+        }
+    }
+    // func(const Range&) для каждого диапазона, на который ссылается pos
+    template <typename Func>
+    void ForEachReferencedRange(Position pos, Func&& func) const {
+        const uint32_t node = FindNode(pos);
+        if (node != NONE) {
+            refs_.ForEach(node, [this, &func](uint32_t id) {
+                if (is_range_[id]) {
+                    func(areas_.at(id));
+                }
+            });
+        }
+    }
+    // func(Position) для каждой ячейки, которая ссылается на pos напрямую или через
+    // диапазон; формула, несколько раз охватывающая pos, встречается несколько раз
+    template <typename Func>
+    void ForEachDependant(Position pos, Func&& func) const {
+        const uint32_t node = FindNode(pos);
+        if (node != NONE) {
+            ForEachNeighbour(deps_, node, func);
+        }
+        ForEachRangeContaining(pos, [this, &func](uint32_t range_id) {
+            ForEachNeighbour(deps_, range_id, func);
+        });
+    }
+
+    // Позиция в топологическом порядке; у вершины без ребер - 0
+    int GetOrder(Position pos) const;
+
+    size_t GetEdgeCount() const {
+        return edge_count_;
+    }
+    // Байты, занятые ребрами в обоих направлениях: сжатые массивы и буфер правок
+    size_t GetEdgeMemory() const;
+    // Байты, занятые индексами вершин: смещения строк, головы списков буфера, порядок
+    size_t GetNodeMemory() const;
+
+    // Переносит буфер правок в сжатые массивы
+    void Compact();
+
+    // Двоичный образ графа для SheetFile: вершины нумеруются заново подряд, ссылки
+    // записываются сжатыми строками, обратные ребра восстанавливаются при загрузке.
+    // Load проверяет номера и порядок вершин и бросает SheetFileError, если образ повреждён.
+    void Save(BinaryWriter& writer) const;
+    static DependencyGraph Load(BinaryReader& reader);
+
+    class Builder;
+
+private:
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    // Ребра одного направления: сжатые строки (CSR), собранные при последнем уплотнении,
+    // и буфер ребер, добавленных после него, в виде списков по вершинам.
+    // Удалённое ребро из сжатой части помечается как NONE до следующего уплотнения.
+    class Adjacency {
+    public:
+        void Resize(size_t node_count);
+        void Add(uint32_t from, uint32_t to);
+        void Remove(uint32_t from, uint32_t to);
+        bool IsEmpty(uint32_t from) const;
+        // Заменяет все ребра сжатыми строками: ребра from - targets[offsets[from]..offsets[from + 1])
+        void Assign(std::vector<uint32_t> offsets, std::vector<uint32_t> targets);
+
+        template <typename Func>
+        void ForEach(uint32_t from, Func&& func) const {
+            if (from + 1 < offsets_.size()) {
+                for (uint32_t i = offsets_[from]; i < offsets_[from + 1]; ++i) {
+                    if (targets_[i] != NONE) {
+                        func(targets_[i]);
+                    }
+                }
+            }
+            for (uint32_t e = delta_head_[from]; e != NONE; e = delta_[e].next) {
+                func(delta_[e].to);
+            }
+        }
+
+        bool NeedsCompaction() const;
+        void Compact();
+        size_t GetEdgeMemory() const;
+        size_t GetNodeMemory() const;
+
+    private:
+        struct DeltaEdge {
+            uint32_t to;
+            uint32_t next;
+        };
+
+        std::vector<uint32_t> offsets_;
+        std::vector<uint32_t> targets_;
+        size_t tombstones_ = 0;
+
+        std::vector<uint32_t> delta_head_;
+        std::vector<DeltaEdge> delta_;
+        uint32_t delta_free_ = NONE;
+        size_t delta_count_ = 0;
+    };
+
+    struct RangeHasher {
+        size_t operator()(const Range& r) const {
+            const PositionHasher hasher;
+            return hasher(r.first) * 37 + hasher(r.last);
+        }
+    };
+
+    // Диапазон в корзине индекса по тайлам
+    struct RangeEntry {
+        uint32_t id;
+        Range range;
+    };
+
+    using NodeGrid = TileGrid<uint32_t>;
+
+    // Вершина в двоичном образе; у ячейки last совпадает с first
+    struct NodeRecord {
+        Range area;
+        int32_t order;
+        uint32_t is_range;
+    };
+
+    std::unordered_map<Position, uint32_t, PositionHasher> ids_;
+    std::vector<Position> positions_;
+    std::vector<uint8_t> is_range_;
+    std::vector<int> order_;
+    std::vector<uint8_t> visited_;
+    std::vector<uint32_t> free_ids_;
+
+    Adjacency refs_;
+    Adjacency deps_;
+
+    std::unordered_map<Range, uint32_t, RangeHasher> range_ids_;
+    std::unordered_map<uint32_t, Range> areas_;
+    // Диапазоны, задевающие тайл, по ключу тайла
+    std::unordered_map<uint64_t, std::vector<RangeEntry>> range_tiles_;
+    // Вершины-ячейки по позициям (id + 1): ячейки, лежащие внутри диапазона
+    NodeGrid cell_nodes_;
+
+    // Новые вершины-источники ставятся в начало порядка, новые формулы - в конец,
+    // поэтому ссылка на ещё не упомянутую ячейку никогда не нарушает порядок
+    int min_order_ = 0;
+    int max_order_ = 0;
+    size_t edge_count_ = 0;
+
+    template <typename Func>
+    void ForEachNeighbour(const Adjacency& adjacency, uint32_t id, Func& func) const {
+        adjacency.ForEach(id, [this, &func](uint32_t neighbour) {
+            func(positions_[neighbour]);
+        });
+    }
+
+    static uint64_t TileKey(int tile_row, int tile_col) {
+        return static_cast<uint64_t>(tile_row) << 32 | static_cast<uint32_t>(tile_col);
+    }
+
+    // func(uint32_t) для каждой вершины-диапазона, содержащей pos
+    template <typename Func>
+    void ForEachRangeContaining(Position pos, Func&& func) const {
+        if (range_tiles_.empty()) {
+            return;
+        }
+        auto it = range_tiles_.find(
+            TileKey(pos.row >> NodeGrid::TILE_BITS, pos.col >> NodeGrid::TILE_BITS));
+        if (it != range_tiles_.end()) {
+            for (const auto& entry : it->second) {
+                if (entry.range.Contains(pos)) {
+                    func(entry.id);
+                }
+            }
+        }
+    }
+
+    bool IsInsideAnyRange(Position pos) const;
+
+    uint32_t AllocateNode();
+    // Вершина-ячейка pos или NONE. Сетка повторяет ids_ и ищет без хеширования
+    uint32_t FindNode(Position pos) const {
+        const uint32_t* node = pos.IsValid() ? cell_nodes_.Find(pos) : nullptr;
+        return node && *node ? *node - 1 : NONE;
+    }
+    uint32_t GetOrCreateNode(Position pos, bool is_source);
+    uint32_t GetOrCreateRangeNode(const Range& range);
+    void IndexRangeTiles(uint32_t id, const Range& range);
+    void EraseNodeIfIsolated(uint32_t id);
+
+    // false, если ребро замыкает цикл; граф при этом не меняется
+    bool AddEdge(uint32_t ref, uint32_t dep);
+    void RemoveEdge(uint32_t ref, uint32_t dep);
+
+    // Собирает вершины, достижимые из start по ребрам (прямым при forward, иначе
+    // обратным) с порядком в пределах [lower, upper], включая неявные ребра диапазонов.
+    // Возвращает false, если встречена вершина target.
+    bool CollectAffected(uint32_t start, bool forward, int lower, int upper,
+                         uint32_t target, std::vector<uint32_t>& result);
+    void Reorder(std::vector<uint32_t>& backward, std::vector<uint32_t>& forward);
+
+    void CompactIfNeeded();
+};
+
+// Построение графа за один проход (см. SheetImporter): ссылки формул добавляются
+// без поддержки порядка, Finish находит его алгоритмом Кана. Каждая формула
+// добавляется один раз.
+class DependencyGraph::Builder {
+public:
+    void AddReferences(Position pos, const std::vector<Position>& refs,
+                       const std::vector<Range>& ranges);
+    // Бросает CircularDependencyException, если ссылки образуют цикл
+    DependencyGraph Finish();
+
+private:
+    DependencyGraph graph_;
+    // ref, dep
+    std::vector<std::pair<uint32_t, uint32_t>> edges_;
+    std::vector<uint32_t> refs_;
+};
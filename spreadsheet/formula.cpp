@@ -41,81 +41,221 @@ std::string_view FormulaError::ToString() const {
     return "";
 }
 
-class Formula : public FormulaInterface {
-public:
-    
-    explicit Formula(std::string expression) : ast_(ParseFormulaAST(expression)) {}
-    
-    Value Evaluate(const SheetInterface& sheet) const override {
- 
-        try {
-            std::function<double(Position)> args = [&sheet](const Position pos)->double {
-           
-            if (!pos.IsValid()) 
-                throw FormulaError(FormulaError::Category::Ref);
-
-            const auto* cell = sheet.GetCell(pos);
-            if (!cell) 
-                return 0.0;
-
-            if (std::holds_alternative<double>(cell->GetValue())) {
-                return std::get<double>(cell->GetValue());
-                
-            } else 
-            if (std::holds_alternative<std::string>(cell->GetValue())) {
-                
-                auto str_value = std::get<std::string>(cell->GetValue());
-
-                if (str_value == "") 
-                    return 0.0;
-
-                std::istringstream input(str_value);
-                double num = 0.0;
-
-                if (input >> num && input.eof()) {
-                    return num;
-                } else {
-                    throw FormulaError(FormulaError::Category::Value);
-                }
-                
+namespace {
+
+// Значение ячейки как операнд формулы: текст читается как число,
+// пустой текст - ноль, ошибки упаковываются в NaN
+double ValueToNumber(const CellInterface::Value& value) {
+
+    if (std::holds_alternative<double>(value)) {
+        return std::get<double>(value);
+
+    } else
+    if (std::holds_alternative<std::string>(value)) {
+
+        const auto& str_value = std::get<std::string>(value);
+
+        if (str_value == "")
+            return 0.0;
+
+        std::istringstream input(str_value);
+        double num = 0.0;
+
+        if (input >> num && input.eof()) {
+            return num;
+        } else {
+            return MakeErrorValue(FormulaError::Category::Value);
+        }
+
+    } else {
+        return MakeErrorValue(std::get<FormulaError>(value).GetCategory());
+    }
+}
+
+}  // namespace
+
+// --- Formula ---
+
+Formula::Formula(FormulaProgram program)
+    : ast_(std::move(program.ast)), anchor_(program.anchor) {}
+
+FormulaInterface::Value Formula::Evaluate(const SheetInterface& sheet) const {
+
+    auto args = [&sheet](const Position pos)->double {
+
+        if (!pos.IsValid())
+            return MakeErrorValue(FormulaError::Category::Ref);
+
+        const auto* cell = sheet.GetCell(pos);
+        if (!cell)
+            return 0.0;
+
+        if (const auto number = cell->GetNumber())
+            return *number;
+        return ValueToNumber(cell->GetValue());
+    };
+
+    // значения непустых ячеек собираются в блок и передаются в накопитель целиком
+    auto range_args = [&sheet](const Range& range, RangeAggregate& aggregate) {
+
+        std::vector<const CellInterface*> cells;
+        sheet.GetCellsInRange(range, cells);
+
+        constexpr size_t BLOCK_SIZE = 256;
+        double block[BLOCK_SIZE];
+        size_t size = 0;
+
+        for (const auto* cell : cells) {
+            if (const auto number = cell->GetNumber()) {
+                block[size++] = *number;
             } else {
-                throw FormulaError(std::get<FormulaError>(cell->GetValue()));
+                const auto value = cell->GetValue();
+                if (std::holds_alternative<std::string>(value)
+                    && std::get<std::string>(value).empty())
+                    continue;
+                block[size++] = ValueToNumber(value);
+            }
+            if (size == BLOCK_SIZE) {
+                aggregate.Add(block, size);
+                size = 0;
             }
-                
-            };
-            
-            return ast_.Execute(args);
-            
-        } catch (const FormulaError& evaluate_error) {
-            return evaluate_error;
         }
-    }
+        aggregate.Add(block, size);
+    };
+
+    const double result = ast_->Execute(CellReader(args, range_args), anchor_);
+    if (IsErrorValue(result))
+        return GetErrorValue(result);
+    return result;
+}
+
+std::string Formula::GetExpression() const {
+    std::ostringstream out;
+    ast_->PrintFormula(out, anchor_);
     
-    std::string GetExpression() const override {
-        std::ostringstream out;
-        ast_.PrintFormula(out);
-        
-        return out.str();
+    return out.str();
+}
+
+std::vector<Position> Formula::GetReferencedCells() const {
+    std::vector<Position> cells;
+    for (const auto& offset : ast_->GetCells()) {
+
+        const auto cell = FromOffset(offset, anchor_);
+        if (!cell.IsValid()) 
+            continue;
+        if (cells.size() == 0 
+        || (cells.size() && !(cell == cells.back())))
+            cells.push_back(cell);
+
     }
+    return cells;
+}
 
-    std::vector<Position> GetReferencedCells() const override {
-        std::vector<Position> cells;
-        for (const auto& cell : ast_.GetCells()) {
-            
-            if (!cell.IsValid()) 
-                continue;
-            if (cells.size() == 0 
-            || (cells.size() && !(cell == cells.back())))
-                cells.push_back(cell);
+std::vector<Range> Formula::GetReferencedRanges() const {
+    std::vector<Range> ranges;
+    for (const auto& offset : ast_->GetRanges())
+        ranges.push_back(FromOffset(offset, anchor_));
+    std::sort(ranges.begin(), ranges.end());
+    ranges.erase(std::unique(ranges.begin(), ranges.end()), ranges.end());
+    return ranges;
+}
+
+std::unique_ptr<FormulaInterface> ParseFormula(std::string expression) {
+    return std::make_unique<Formula>(FormulaProgram{
+        std::make_shared<const FormulaAST>(ParseFormulaAST(expression)), Position{0, 0}});
+}
+
+FormulaProgram GetFormulaProgram(const FormulaInterface& formula) {
+    return dynamic_cast<const Formula&>(formula).GetProgram();
+}
+
+// --- FormulaCache ---
+
+namespace {
+
+// Текст выражения без пробелов по краям: ключ поиска по тексту
+std::string_view NormalizeExpression(std::string_view expression) {
+    const auto first = expression.find_first_not_of(" \t\n\r");
+    if (first == expression.npos)
+        return {};
+    const auto last = expression.find_last_not_of(" \t\n\r");
+    return expression.substr(first, last - first + 1);
+}
+
+}  // namespace
+
+FormulaProgram FormulaCache::Parse(const std::string& expression, Position pos) {
 
+    std::string text{NormalizeExpression(expression)};
+    {
+        std::lock_guard lock(mutex_);
+        auto it = texts_.find(text);
+        if (it != texts_.end()) {
+            if (auto ast = it->second.ast.lock()) {
+                ++statistics_.text_hits;
+                return {std::move(ast), it->second.anchor};
+            }
         }
-        return cells;
     }
 
-private:
-    FormulaAST ast_;
-};
+    auto shape = GetFormulaShape(expression, pos);
+    {
+        std::lock_guard lock(mutex_);
+        auto it = templates_.find(shape);
+        if (it != templates_.end()) {
+            if (auto ast = it->second.lock()) {
+                ++statistics_.shape_hits;
+                return {std::move(ast), pos};
+            }
+        }
+    }
 
-std::unique_ptr<FormulaInterface> ParseFormula(std::string expression) {
-    return std::make_unique<Formula>(std::move(expression));
+    // разбор идёт без блокировки: формулы пакета разбираются параллельно
+    std::shared_ptr<const FormulaAST> ast =
+        std::make_shared<const FormulaAST>(ParseFormulaAST(expression, pos));
+
+    std::lock_guard lock(mutex_);
+    ++statistics_.misses;
+    auto& entry = templates_[std::move(shape)];
+    if (auto existing = entry.lock())
+        ast = std::move(existing);
+    else
+        entry = ast;
+    texts_[std::move(text)] = {ast, pos};
+    SweepIfNeeded();
+
+    return {std::move(ast), pos};
+}
+
+size_t FormulaCache::GetTemplateCount() const {
+    std::lock_guard lock(mutex_);
+    return std::count_if(templates_.begin(), templates_.end(), [](const auto& entry){
+        return !entry.second.expired();
+    });
+}
+
+FormulaCache::Statistics FormulaCache::GetStatistics() const {
+    std::lock_guard lock(mutex_);
+    return statistics_;
+}
+
+// Записи умерших шаблонов удаляются, когда таблицы вырастают вдвое с прошлой чистки
+void FormulaCache::SweepIfNeeded() {
+
+    if (templates_.size() + texts_.size() < sweep_threshold_)
+        return;
+
+    for (auto it = templates_.begin(); it != templates_.end();) {
+        if (it->second.expired())
+            it = templates_.erase(it);
+        else
+            ++it;
+    }
+    for (auto it = texts_.begin(); it != texts_.end();) {
+        if (it->second.ast.expired())
+            it = texts_.erase(it);
+        else
+            ++it;
+    }
+    sweep_threshold_ = std::max(MIN_SWEEP_THRESHOLD, (templates_.size() + texts_.size()) * 2);
 }
\ No newline at end of file
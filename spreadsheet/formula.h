@@ -3,12 +3,20 @@
 #include "common.h"
 
 #include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
+class FormulaAST;
+
 // Формула, позволяющая вычислять и обновлять арифметическое выражение.
 // Поддерживаемые возможности:
 // * Простые бинарные операции и числа, скобки: 1+2*3, 2.5*(2+3.5/7)
 // * Значения ячеек в качестве переменных: A1+B2*C3
+// * Агрегатные функции SUM, AVERAGE, MIN, MAX, COUNT от выражений и диапазонов:
+//   SUM(A1:B1000,C1*2). Пустые ячейки диапазона пропускаются, COUNT считает
+//   только числовые значения, AVERAGE без значений даёт #DIV/0!
 // Ячейки, указанные в формуле, могут быть как формулами, так и текстом. Если это
 // текст, но он представляет число, тогда его нужно трактовать как число. Пустая
 // ячейка или ячейка с пустым текстом трактуется как число ноль.
@@ -34,8 +42,86 @@ public:
     // формулы. Список отсортирован по возрастанию и не содержит повторяющихся
     // ячеек.
     virtual std::vector<Position> GetReferencedCells() const = 0;
+
+    // Возвращает список диапазонов, указанных в формуле. Ячейки диапазонов
+    // не попадают в GetReferencedCells(). Список отсортирован и не содержит повторов.
+    virtual std::vector<Range> GetReferencedRanges() const = 0;
 };
 
 // Парсит переданное выражение и возвращает объект формулы.
 // Бросает FormulaException в случае, если формула синтаксически некорректна.
-std::unique_ptr<FormulaInterface> ParseFormula(std::string expression);
\ No newline at end of file
+std::unique_ptr<FormulaInterface> ParseFormula(std::string expression);
+
+// Программа формулы и якорь, от которого отсчитаны смещения её ссылок. По ним
+// формула сохраняется и восстанавливается без повторного разбора (см. SheetFile).
+struct FormulaProgram {
+    std::shared_ptr<const FormulaAST> ast;
+    Position anchor;
+};
+
+// Формула ячейки: общая для всех ячеек одной формы неизменяемая программа
+// и якорь, от которого отсчитываются смещения её ссылок. Копия формулы разделяет
+// программу, поэтому ячейка хранит формулу по значению.
+class Formula : public FormulaInterface {
+public:
+    explicit Formula(FormulaProgram program);
+
+    Value Evaluate(const SheetInterface& sheet) const override;
+    std::string GetExpression() const override;
+    std::vector<Position> GetReferencedCells() const override;
+    std::vector<Range> GetReferencedRanges() const override;
+
+    FormulaProgram GetProgram() const {
+        return {ast_, anchor_};
+    }
+
+private:
+    std::shared_ptr<const FormulaAST> ast_;
+    Position anchor_;
+};
+
+// formula должна быть создана ParseFormula или FormulaCache, либо быть Formula
+FormulaProgram GetFormulaProgram(const FormulaInterface& formula);
+
+// Кеш разобранных формул по форме: ссылки в форме записаны смещениями от ячейки
+// формулы, поэтому =B2*C2 в D2 и =B3*C3 в D3 разбираются один раз и разделяют
+// одну программу, а ячейка хранит только свою позицию. Перед формой проверяется
+// текст выражения: одинаковая формула, вставленная в разные ячейки, берётся
+// по тексту вместе с якорем первого разбора без разбиения на лексемы.
+// Кеш не владеет программами: программа живёт, пока её использует хотя бы
+// одна формула. Потокобезопасен.
+class FormulaCache {
+public:
+    struct Statistics {
+        size_t text_hits = 0;   // найдено по тексту
+        size_t shape_hits = 0;  // найдено по форме
+        size_t misses = 0;      // выражение разобрано
+    };
+
+    // Разбирает формулу ячейки pos или берёт готовую программу той же формы.
+    // Бросает FormulaException, как и ParseFormula.
+    FormulaProgram Parse(const std::string& expression, Position pos);
+
+    // Число различных форм, которые сейчас используются
+    size_t GetTemplateCount() const;
+
+    Statistics GetStatistics() const;
+
+private:
+    static constexpr size_t MIN_SWEEP_THRESHOLD = 1024;
+
+    // Программа вместе с якорем, от которого отсчитаны её смещения
+    struct InternedText {
+        std::weak_ptr<const FormulaAST> ast;
+        Position anchor;
+    };
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, std::weak_ptr<const FormulaAST>> templates_;
+    // заполняется только при разборе, поэтому не растёт при протягивании формулы
+    std::unordered_map<std::string, InternedText> texts_;
+    size_t sweep_threshold_ = MIN_SWEEP_THRESHOLD;
+    Statistics statistics_;
+
+    void SweepIfNeeded();
+};
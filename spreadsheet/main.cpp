@@ -1,6 +1,20 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
 #include <limits>
+#include <optional>
+#include <thread>
 #include "common.h"
 #include "formula.h"
+#include "FormulaAST.h"
+#include "sheet.h"
+#include "sheet_file.h"
+#include "sheet_import.h"
+#include "sheet_snapshot.h"
 #include "test_runner_p.h"
  
 inline std::ostream& operator<<(std::ostream& output, Position pos) {
@@ -11,6 +25,10 @@ inline Position operator"" _pos(const char* str, std::size_t) {
     return Position::FromString(str);
 }
  
+inline std::ostream& operator<<(std::ostream& output, const Range& range) {
+    return output << range.ToString();
+}
+
 inline std::ostream& operator<<(std::ostream& output, Size size) {
     return output << "(" << size.rows << ", " << size.cols << ")";
 }
@@ -146,6 +164,22 @@ void TestFormulaArithmetic() {
     ASSERT_EQUAL(evaluate("(12+13) * (14+(13-24/(1+1))*55-46)"), 575);
 }
  
+void TestFormulaDeepExpression() {
+    auto sheet = CreateSheet();
+    sheet->SetCell("A1"_pos, "2");
+
+    std::string expression = "A1-1";
+    double expected = 1;
+    for (int i = 0; i < 40; ++i) {
+        expression = "1-A1*(" + expression + ")";
+        expected = 1 - 2 * expected;
+    }
+
+    auto formula = ParseFormula(expression);
+    ASSERT_EQUAL(std::get<double>(formula->Evaluate(*sheet)), expected);
+    ASSERT_EQUAL(formula->GetExpression(), expression);
+}
+
 void TestFormulaReferences() {
     auto sheet = CreateSheet();
     auto evaluate = [&](std::string expr) {
@@ -247,6 +281,30 @@ void TestErrorDiv0() {
     }
 }
  
+void TestErrorPropagation() {
+    auto sheet = CreateSheet();
+    const CellInterface::Value div0 = FormulaError::Category::Div0;
+    const CellInterface::Value value = FormulaError::Category::Value;
+
+    sheet->SetCell("A1"_pos, "=1/0");
+    sheet->SetCell("A2"_pos, "=-A1*0+1");
+    sheet->SetCell("A3"_pos, "=2/A2");
+    sheet->SetCell("B1"_pos, "text");
+    sheet->SetCell("B2"_pos, "=B1*0");
+    sheet->SetCell("B3"_pos, "=1/B2");
+    sheet->SetCell("C1"_pos, "=1e308*10-1e308*10");
+    sheet->SetCell("C2"_pos, "=A1+B1");
+
+    ASSERT_EQUAL(sheet->GetCell("A2"_pos)->GetValue(), div0);
+    ASSERT_EQUAL(sheet->GetCell("A3"_pos)->GetValue(), div0);
+    ASSERT_EQUAL(sheet->GetCell("B2"_pos)->GetValue(), value);
+    ASSERT_EQUAL(sheet->GetCell("B3"_pos)->GetValue(), value);
+    ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetValue(), div0);
+
+    const auto mixed = sheet->GetCell("C2"_pos)->GetValue();
+    ASSERT(mixed == div0 || mixed == value);
+}
+
 void TestEmptyCellTreatedAsZero() {
     auto sheet = CreateSheet();
     sheet->SetCell("A1"_pos, "=B2");
@@ -289,6 +347,152 @@ void TestPrint() {
     ASSERT_EQUAL(values.str(), "\t\nmeow\t35\n");
 }
  
+// Печать, как её делал обход всех клеток области с выводом значений через поток
+void PrintByCells(const SheetInterface& sheet, std::ostream& values, std::ostream& texts) {
+    const Size size = sheet.GetPrintableSize();
+    for (int r = 0; r < size.rows; ++r) {
+        for (int c = 0; c < size.cols; ++c) {
+            if (c > 0) {
+                values << "\t";
+                texts << "\t";
+            }
+            const auto* cell = sheet.GetCell({r, c});
+            if (cell && !cell->GetText().empty()) {
+                values << cell->GetValue();
+                texts << cell->GetText();
+            }
+        }
+        values << "\n";
+        texts << "\n";
+    }
+}
+
+void TestPrintMatchesStream() {
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "=1/3");
+    sheet.SetCell("B1"_pos, "=-0*1");
+    sheet.SetCell("C1"_pos, "=1/0");
+    sheet.SetCell("D1"_pos, "=A1*1e20");
+    sheet.SetCell("E1"_pos, "'=escaped");
+    sheet.SetCell("F1"_pos, "1.50");
+    sheet.SetCell("G1"_pos, "=SUM(A1:B1)+1e-7");
+    sheet.SetCell("H1"_pos, "=ZZ1+1234567");
+    sheet.SetCell("A3"_pos, "=A1");
+    sheet.SetCell("Z200"_pos, "last");
+    for (int r = 0; r < 150; ++r) {
+        for (int c = 0; c < 70; c += 3) {
+            sheet.SetCell({r + 4, c}, "=" + std::to_string(r * 7 + c) + "/" + std::to_string(c + 3));
+        }
+    }
+    // длиннее буфера печати
+    sheet.SetCell("B2"_pos, std::string(300000, 'x'));
+
+    auto check = [](const SheetInterface& sheet, bool fixed) {
+        std::ostringstream values, texts, expected_values, expected_texts;
+        for (auto* out : {&values, &texts, &expected_values, &expected_texts}) {
+            if (fixed) {
+                *out << std::fixed << std::setprecision(2);
+            }
+        }
+        PrintByCells(sheet, expected_values, expected_texts);
+        sheet.PrintValues(values);
+        sheet.PrintTexts(texts);
+        ASSERT(values.str() == expected_values.str());
+        ASSERT(texts.str() == expected_texts.str());
+    };
+    check(sheet, false);
+    check(sheet, true);
+
+    const auto snapshot = sheet.Snapshot();
+    check(*snapshot, false);
+    check(*snapshot, true);
+}
+ 
+void TestPrintRange() {
+    Sheet sheet;
+    for (int r = 0; r < 200; ++r) {
+        sheet.SetCell({r, 0}, std::to_string(r));
+        sheet.SetCell({r, 1}, "=A" + std::to_string(r + 1) + "*2");
+        sheet.SetCell({r, 100}, "=B" + std::to_string(r + 1) + "/3");
+    }
+    sheet.SetCell("C5"_pos, "'=text");
+    sheet.SetCell("D6"_pos, "=1/0");
+    sheet.Recalculate();
+    sheet.SetCell("A1"_pos, "1000");
+
+    auto is_verified = [&sheet](Position pos) {
+        return static_cast<const Cell*>(sheet.GetCell(pos))->IsCacheValid(sheet.GetEpoch());
+    };
+
+    // окно с частью формул: остальные формулы таблицы не считаются
+    const Range window{{0, 1}, {9, 4}};
+    std::ostringstream values, texts;
+    sheet.PrintValues(values, window);
+    sheet.PrintTexts(texts, window);
+    ASSERT(is_verified({0, 1}));
+    ASSERT(!is_verified({0, 100}));
+
+    std::ostringstream expected_values, expected_texts;
+    sheet.SheetInterface::PrintValues(expected_values, window);
+    sheet.SheetInterface::PrintTexts(expected_texts, window);
+    ASSERT_EQUAL(values.str(), expected_values.str());
+    ASSERT_EQUAL(texts.str(), expected_texts.str());
+    ASSERT(values.str().rfind("2000\t\t\t\n", 0) == 0);
+
+    std::vector<std::pair<Position, CellInterface::Value>> cells;
+    sheet.GetValuesInRange(Range{{0, 99}, {1, 100}}, cells);
+    ASSERT_EQUAL(cells.size(), 2u);
+    ASSERT(cells[0].first == (Position{0, 100}));
+    ASSERT(cells[0].second == CellInterface::Value(2000.0 / 3));
+
+    // окно за пределами занятых ячеек печатается пустыми строками
+    std::ostringstream empty;
+    sheet.PrintValues(empty, Range{{500, 0}, {501, 2}});
+    ASSERT_EQUAL(empty.str(), "\t\t\n\t\t\n");
+
+    const auto snapshot = sheet.Snapshot();
+    std::ostringstream snapshot_values;
+    snapshot->PrintValues(snapshot_values, window);
+    ASSERT_EQUAL(snapshot_values.str(), expected_values.str());
+
+    try {
+        sheet.PrintValues(values, Range{{2, 0}, {1, 0}});
+        ASSERT(false);
+    } catch (const InvalidPositionException&) {
+    }
+}
+ 
+void TestPrintableSize() {
+    Sheet sheet;
+    // пустые ячейки, на которые ссылаются формулы, в область печати не входят
+    sheet.SetCell("B2"_pos, "=Z100+D20");
+    ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{2, 2}));
+    std::ostringstream texts;
+    sheet.PrintTexts(texts);
+    ASSERT_EQUAL(texts.str(), "\t\n\t=Z100+D20\n");
+
+    sheet.SetCell("D20"_pos, "1");
+    ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{20, 4}));
+    sheet.SetCell("C20"_pos, "text");
+    sheet.SetCell("D3"_pos, "");
+    ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{20, 4}));
+
+    // очищенная ячейка с зависимыми формулами остаётся пустой
+    sheet.ClearCell("D20"_pos);
+    ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{20, 3}));
+    sheet.ClearCell("C20"_pos);
+    ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{2, 2}));
+
+    sheet.SetCells({{"E5"_pos, "x"}, {"B2"_pos, ""}});
+    ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{5, 5}));
+    ASSERT_EQUAL(sheet.Snapshot()->GetPrintableSize(), (Size{5, 5}));
+
+    const auto fork = sheet.Fork();
+    fork->ClearCell("E5"_pos);
+    ASSERT_EQUAL(fork->GetPrintableSize(), (Size{0, 0}));
+    ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{5, 5}));
+}
+ 
 void TestCellReferences() {
     auto sheet = CreateSheet();
     sheet->SetCell("A1"_pos, "1");
@@ -312,6 +516,72 @@ void TestCellReferences() {
     ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetReferencedCells(), std::vector{"C3"_pos});
 }
  
+void TestEmptyReferencedCells() {
+    Sheet sheet;
+    // пустые позиции, на которые ссылаются формулы, не хранятся
+    sheet.SetCell("A1"_pos, "=Z9999*2");
+    ASSERT_EQUAL(sheet.GetCell("Z9999"_pos)->GetText(), "");
+    ASSERT(sheet.GetCell("Z9998"_pos) == nullptr);
+    std::vector<const CellInterface*> cells;
+    sheet.GetCellsInRange(Range{{0, 0}, {9999, 25}}, cells);
+    ASSERT_EQUAL(cells.size(), 1u);
+    ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{1, 1}));
+    // снимок видит те же ячейки, что и таблица
+    {
+        const auto snapshot = sheet.Snapshot();
+        ASSERT(snapshot->GetCell("Z9999"_pos) != nullptr);
+        ASSERT_EQUAL(snapshot->GetCell("Z9999"_pos)->GetText(), "");
+        ASSERT(snapshot->GetCell("Z9998"_pos) == nullptr);
+        ASSERT_EQUAL(snapshot->GetCell("A1"_pos)->GetValue(), CellInterface::Value(0.0));
+    }
+
+    // очистка ячейки видна формулам, которые на неё ссылаются напрямую и через диапазон
+    sheet.SetCell("B1"_pos, "5");
+    sheet.SetCell("C2"_pos, "3");
+    sheet.SetCell("D1"_pos, "=B1+SUM(C1:C3)");
+    ASSERT_EQUAL(sheet.GetCell("D1"_pos)->GetValue(), CellInterface::Value(8.0));
+    sheet.ClearCell("B1"_pos);
+    ASSERT(sheet.GetCell("B1"_pos) != nullptr);
+    ASSERT_EQUAL(sheet.GetCell("D1"_pos)->GetValue(), CellInterface::Value(3.0));
+    sheet.ClearCell("C2"_pos);
+    ASSERT(sheet.GetCell("C2"_pos) != nullptr);
+    ASSERT_EQUAL(sheet.GetCell("D1"_pos)->GetValue(), CellInterface::Value(0.0));
+    ASSERT_EQUAL(sheet.GetClearedCount(), 2u);
+    {
+        const auto snapshot = sheet.Snapshot();
+        for (const auto pos : {"B1"_pos, "C1"_pos, "C2"_pos, "C3"_pos, "E9"_pos}) {
+            ASSERT_EQUAL(snapshot->GetCell(pos) == nullptr, sheet.GetCell(pos) == nullptr);
+        }
+        ASSERT_EQUAL(snapshot->GetCell("D1"_pos)->GetValue(), CellInterface::Value(0.0));
+    }
+
+    const auto fork = sheet.Fork();
+    fork->SetCell("C3"_pos, "7");
+    fork->ClearCell("C3"_pos);
+    ASSERT_EQUAL(fork->GetCell("D1"_pos)->GetValue(), CellInterface::Value(0.0));
+
+    // когда на очищенные позиции перестают ссылаться, их эпохи забываются
+    sheet.SetCell("D1"_pos, "=B1");
+    ASSERT_EQUAL(sheet.GetClearedCount(), 1u);
+    ASSERT(sheet.GetCell("C2"_pos) == nullptr);
+    sheet.ClearCell("D1"_pos);
+    ASSERT_EQUAL(sheet.GetClearedCount(), 0u);
+    ASSERT(sheet.GetCell("B1"_pos) == nullptr);
+    ASSERT_EQUAL(fork->GetClearedCount(), 3u);
+
+    sheet.SetCell("E1"_pos, "1");
+    sheet.SetCell("E2"_pos, "=E1*10");
+    ASSERT_EQUAL(sheet.GetCell("E2"_pos)->GetValue(), CellInterface::Value(10.0));
+    sheet.SetCells({{"E1"_pos, "2"}, {"F1"_pos, "x"}});
+    sheet.BeginBatch();
+    sheet.ClearCell("E1"_pos);
+    sheet.CommitBatch();
+    ASSERT_EQUAL(sheet.GetCell("E2"_pos)->GetValue(), CellInterface::Value(0.0));
+    ASSERT_EQUAL(sheet.GetClearedCount(), 1u);
+    sheet.SetCells({{"E2"_pos, "=F1"}});
+    ASSERT_EQUAL(sheet.GetClearedCount(), 0u);
+}
+ 
 void TestFormulaIncorrect() {
     auto isIncorrect = [](std::string expression) {
         try {
@@ -329,6 +599,170 @@ void TestFormulaIncorrect() {
     ASSERT(isIncorrect("2+4-"));
 }
  
+std::optional<std::string> PrintAST(FormulaAST (*parse)(const std::string&), const std::string& expr) {
+    try {
+        std::ostringstream out;
+        parse(expr).Print(out);
+        return out.str();
+    } catch (const FormulaException&) {
+        return std::nullopt;
+    }
+}
+
+void TestFormulaParser() {
+    auto print = [](const std::string& expr) {
+        return PrintAST(&ParseFormulaAST, expr).value_or("<error>");
+    };
+
+    ASSERT_EQUAL(print("-A1*B1"), "(* (- A1) B1)");
+    ASSERT_EQUAL(print("1--2"), "(- 1 (- 2))");
+    ASSERT_EQUAL(print("1-2-3"), "(- (- 1 2) 3)");
+    ASSERT_EQUAL(print("1-(2-3)"), "(- 1 (- 2 3))");
+    ASSERT_EQUAL(print("2+3*4/5"), "(+ 2 (/ (* 3 4) 5))");
+    ASSERT_EQUAL(print(" +-( A1 )\t"), "(+ (- A1))");
+    ASSERT_EQUAL(print("2E3+.5+1.5e-1"), "(+ (+ 2000 0.5) 0.15)");
+    ASSERT_EQUAL(print("SUM(A1:B2, C3*2)+1"), "(+ (SUM A1:B2 (* C3 2)) 1)");
+    ASSERT_EQUAL(print("-MAX(B2:A1,MIN(1))"), "(- (MAX A1:B2 (MIN 1)))");
+
+    for (const auto* expr : {"", " ", "()", "1+", "1 2", "1.", "1e", "1e+", "e2", "A",
+                             "A1B", "a1", "1+(2", "1)", "1e400", "A1:B2", "1,2", "SUM()",
+                             "SUM(A1:)", "SUM(A1:B2", "SUM A1", "FOO(1)", "SUM(A1:B2+1)",
+                             "SUM(1:2)", "SUM((A1:B2))", "sum(1)", "SUM(A1:ZZZZ1)"}) {
+        ASSERT(!PrintAST(&ParseFormulaAST, expr));
+    }
+}
+
+void TestFormulaConstantFolding() {
+    auto program_size = [](const std::string& expr) {
+        return ParseFormulaAST(expr).GetProgram().size();
+    };
+
+    ASSERT_EQUAL(program_size("(2*3.5+1)/4*A1"), size_t(2));
+    ASSERT_EQUAL(program_size("-(-A1)*1/1-0"), size_t(1));
+    ASSERT_EQUAL(program_size("SUM(1,2,MAX(3,4))+A1"), size_t(2));
+    ASSERT_EQUAL(program_size("A1-(-0)"), size_t(2));
+
+    auto sheet = CreateSheet();
+    sheet->SetCell("A1"_pos, "4");
+    auto evaluate = [&](std::string expr) {
+        return ParseFormula(std::move(expr))->Evaluate(*sheet);
+    };
+
+    ASSERT_EQUAL(std::get<double>(evaluate("(2*3.5+1)/4*A1")), 8.0);
+    ASSERT_EQUAL(std::get<double>(evaluate("SUM(1,2,MAX(3,4))+A1")), 11.0);
+    ASSERT_EQUAL(std::get<double>(evaluate("AVERAGE(1,3)*-(-A1)")), 8.0);
+    ASSERT_EQUAL(std::get<double>(evaluate("A1*(2-2*1)")), 0.0);
+    ASSERT(std::get<FormulaError>(evaluate("A1+1/0")) == FormulaError::Category::Div0);
+
+    // печатается исходная формула, а не свёрнутая
+    ASSERT_EQUAL(ParseFormula("(2*3.5+1)/4*A1")->GetExpression(), "(2*3.5+1)/4*A1");
+    ASSERT_EQUAL(ParseFormula("--A1*1")->GetExpression(), "--A1*1");
+}
+
+#ifdef SPREADSHEET_ANTLR_ORACLE
+void TestFormulaParserMatchesAntlr() {
+    const std::vector<std::string> corpus = {
+        "1", "  42  ", "-1", "+-+1", "1--2", "1-2-3", "1/2/3", "-A1*B1", "(1+2)*(3-4)/5",
+        "((((A1))))", "2E3", "2e+3", "2e-3", ".5", "1.5E2*ZZ99", "1 2", "1.", "1e", "e2",
+        "A1B", "R2D2", "3X", "A0++", "((1)", "2+4-", "", "()", "1e400", "1e-400", "XFD16384",
+        "XFD16385", "A1 +\tB2\n*C3", "1.5.3", "00012", "*1", "1*/2", "SUM(A1:B2)",
+        "AVERAGE(1, A1:A5, -B2)", "MIN(B2:A1)*2", "SUM()", "SUM(A1:)", "FOO(1)", "A1:B2",
+    };
+
+    for (const auto& expr : corpus) {
+        ASSERT_EQUAL(PrintAST(&ParseFormulaAST, expr).value_or("<error>"),
+                     PrintAST(&ParseFormulaASTWithAntlr, expr).value_or("<error>"));
+    }
+}
+#endif
+
+void TestNumericTextCells() {
+    auto sheet = CreateSheet();
+    sheet->SetCell("A1"_pos, "12");
+    sheet->SetCell("A2"_pos, "'1.5e1");
+    sheet->SetCell("A3"_pos, " 3");
+    sheet->SetCell("A4"_pos, "3 ");
+    sheet->SetCell("A5"_pos, "=A1/2");
+    sheet->SetCell("A6"_pos, "=1/0");
+
+    // значение и текст числовой ячейки остаются строками
+    ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetValue(), CellInterface::Value("12"));
+    ASSERT_EQUAL(sheet->GetCell("A2"_pos)->GetValue(), CellInterface::Value("1.5e1"));
+    ASSERT_EQUAL(sheet->GetCell("A2"_pos)->GetText(), "'1.5e1");
+
+    ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetNumber().value_or(-1), 12.0);
+    ASSERT_EQUAL(sheet->GetCell("A2"_pos)->GetNumber().value_or(-1), 15.0);
+    ASSERT_EQUAL(sheet->GetCell("A3"_pos)->GetNumber().value_or(-1), 3.0);
+    ASSERT(!sheet->GetCell("A4"_pos)->GetNumber());
+    ASSERT_EQUAL(sheet->GetCell("A5"_pos)->GetNumber().value_or(-1), 6.0);
+    ASSERT(!sheet->GetCell("A6"_pos)->GetNumber());
+
+    sheet->SetCell("B1"_pos, "=A1+A2+A3");
+    ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetValue(), CellInterface::Value(30.0));
+    sheet->SetCell("B2"_pos, "=A4");
+    ASSERT_EQUAL(sheet->GetCell("B2"_pos)->GetValue(),
+                 CellInterface::Value(FormulaError::Category::Value));
+    sheet->SetCell("B3"_pos, "=SUM(A1:A5)");
+    ASSERT_EQUAL(sheet->GetCell("B3"_pos)->GetValue(),
+                 CellInterface::Value(FormulaError::Category::Value));
+
+    sheet->SetCell("A1"_pos, "twelve");
+    ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetValue(),
+                 CellInterface::Value(FormulaError::Category::Value));
+    sheet->SetCell("A1"_pos, "-2");
+    ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetValue(), CellInterface::Value(16.0));
+}
+
+void TestFormulaFunctions() {
+    auto sheet = CreateSheet();
+    sheet->SetCell("A1"_pos, "1");
+    sheet->SetCell("A2"_pos, "2");
+    sheet->SetCell("A3"_pos, "'3");
+    sheet->SetCell("B1"_pos, "=A1*10");
+    sheet->SetCell("B3"_pos, "4");
+
+    auto value = [&sheet](const std::string& expr) {
+        sheet->SetCell("Z1"_pos, "=" + expr);
+        return sheet->GetCell("Z1"_pos)->GetValue();
+    };
+
+    ASSERT_EQUAL(value("SUM(A1:B3)"), CellInterface::Value(20.0));
+    ASSERT_EQUAL(value("SUM(B3:A1)"), CellInterface::Value(20.0));
+    ASSERT_EQUAL(value("AVERAGE(A1:B3)"), CellInterface::Value(4.0));
+    ASSERT_EQUAL(value("MIN(A1:B3)"), CellInterface::Value(1.0));
+    ASSERT_EQUAL(value("MAX(A1:B3)"), CellInterface::Value(10.0));
+    ASSERT_EQUAL(value("COUNT(A1:B3)"), CellInterface::Value(5.0));
+    ASSERT_EQUAL(value("SUM(A1:A2,A1:A2,100,-B1)"), CellInterface::Value(96.0));
+    ASSERT_EQUAL(value("MAX(A1,MIN(A2:A3)*3)+1"), CellInterface::Value(7.0));
+    ASSERT_EQUAL(value("SUM(C1:D100)"), CellInterface::Value(0.0));
+    ASSERT_EQUAL(value("MIN(C1:D100)"), CellInterface::Value(0.0));
+    ASSERT_EQUAL(value("COUNT(C1:D100)"), CellInterface::Value(0.0));
+    ASSERT_EQUAL(value("AVERAGE(C1:D100)"), CellInterface::Value(FormulaError::Category::Div0));
+
+    // больше одного блока значений и больше одного тайла
+    for (int row = 0; row < 300; ++row) {
+        sheet->SetCell({row, 70}, std::to_string(row));
+    }
+    ASSERT_EQUAL(value("SUM(BS1:BS300)"), CellInterface::Value(299.0 * 300 / 2));
+    ASSERT_EQUAL(value("MAX(BS1:BS300)"), CellInterface::Value(299.0));
+
+    sheet->SetCell("C2"_pos, "text");
+    ASSERT_EQUAL(value("SUM(A1:C3)"), CellInterface::Value(FormulaError::Category::Value));
+    ASSERT_EQUAL(value("MIN(A1:C3)"), CellInterface::Value(FormulaError::Category::Value));
+    ASSERT_EQUAL(value("COUNT(A1:C3)"), CellInterface::Value(5.0));
+    sheet->SetCell("C2"_pos, "=1/0");
+    ASSERT_EQUAL(value("MAX(A1:C3)"), CellInterface::Value(FormulaError::Category::Div0));
+    ASSERT_EQUAL(value("COUNT(A1:C3,1/0)"), CellInterface::Value(5.0));
+
+    sheet->SetCell("Z1"_pos, "=SUM(A1:B2, (A3))+MAX( B2 : A1 )");
+    ASSERT_EQUAL(sheet->GetCell("Z1"_pos)->GetText(), "=SUM(A1:B2,A3)+MAX(A1:B2)");
+
+    auto formula = ParseFormula("SUM(B2:A1,C1:C9)+AVERAGE(A1:B2)*D4");
+    ASSERT_EQUAL(formula->GetReferencedCells(), std::vector<Position>{"D4"_pos});
+    ASSERT_EQUAL(formula->GetReferencedRanges(),
+                 (std::vector<Range>{{"A1"_pos, "B2"_pos}, {"C1"_pos, "C9"_pos}}));
+}
+
 void TestCellCircularReferences() {
     auto sheet = CreateSheet();
     sheet->SetCell("E2"_pos, "=E4");
@@ -374,6 +808,920 @@ void TestCache(){
 
     ASSERT_EQUAL(sheet->GetCell("A3"_pos)->GetValue(), CellInterface::Value(0.0));
 }
+
+bool IsCircular(SheetInterface& sheet, Position pos, std::string text) {
+    try {
+        sheet.SetCell(pos, std::move(text));
+    } catch (const CircularDependencyException&) {
+        return true;
+    }
+    return false;
+}
+
+void TestCircularReferencesThroughBranches() {
+    auto sheet = CreateSheet();
+    sheet->SetCell("B1"_pos, "=A1");
+    sheet->SetCell("C1"_pos, "=A1");
+    sheet->SetCell("D1"_pos, "=C1+B1");
+    sheet->SetCell("E1"_pos, "=D1");
+
+    // цикл проходит только через вторую зависимую ячейку A1
+    ASSERT(IsCircular(*sheet, "A1"_pos, "=E1"));
+    ASSERT(sheet->GetCell("A1"_pos) != nullptr);
+    ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetText(), "");
+
+    // после отказа граф не изменился и порядок вычисления прежний
+    sheet->SetCell("A1"_pos, "3");
+    ASSERT_EQUAL(sheet->GetCell("E1"_pos)->GetValue(), CellInterface::Value(6.0));
+
+    // снятие ребра разрешает ранее запрещённую ссылку
+    ASSERT(IsCircular(*sheet, "A1"_pos, "=C1"));
+    sheet->SetCell("C1"_pos, "=F1");
+    sheet->SetCell("A1"_pos, "=C1");
+    sheet->SetCell("F1"_pos, "5");
+    ASSERT_EQUAL(sheet->GetCell("E1"_pos)->GetValue(), CellInterface::Value(10.0));
+
+    // ссылки против текущего порядка: новая формула в начале цепочки
+    sheet->SetCell("G1"_pos, "=E1+1");
+    sheet->SetCell("F1"_pos, "=H1");
+    sheet->SetCell("H1"_pos, "2");
+    ASSERT_EQUAL(sheet->GetCell("G1"_pos)->GetValue(), CellInterface::Value(5.0));
+    ASSERT(IsCircular(*sheet, "H1"_pos, "=G1"));
+    ASSERT_EQUAL(sheet->GetCell("H1"_pos)->GetText(), "2");
+}
+
+void TestCircularReferenceInLongChain() {
+    constexpr int LENGTH = 100'000;
+    constexpr int WIDTH = 100;
+    auto chain_pos = [](int i) {
+        return Position{i / WIDTH, i % WIDTH};
+    };
+
+    Sheet sheet;
+    for (int i = 1; i < LENGTH; ++i) {
+        sheet.SetCell(chain_pos(i), "=" + chain_pos(i - 1).ToString() + "+1");
+    }
+    ASSERT(IsCircular(sheet, chain_pos(0), "=" + chain_pos(LENGTH - 1).ToString()));
+
+    // ссылка из начала цепочки на новую ячейку не нарушает порядок
+    sheet.SetCell(chain_pos(0), "=" + chain_pos(LENGTH).ToString());
+    sheet.SetCell(chain_pos(LENGTH), "1");
+    ASSERT_EQUAL(sheet.GetCell(chain_pos(LENGTH - 1))->GetValue(),
+                 CellInterface::Value(double(LENGTH)));
+}
+
+void TestLongDependencyChain() {
+    constexpr int LENGTH = 100'000;
+    constexpr int WIDTH = 100;
+    auto chain_pos = [](int i) {
+        return Position{i / WIDTH, i % WIDTH};
+    };
+
+    auto sheet = CreateSheet();
+    sheet->SetCell(chain_pos(0), "1");
+    for (int i = 1; i < LENGTH; ++i) {
+        sheet->SetCell(chain_pos(i), "=" + chain_pos(i - 1).ToString() + "+1");
+    }
+    ASSERT_EQUAL(sheet->GetCell(chain_pos(LENGTH - 1))->GetValue(),
+                 CellInterface::Value(double(LENGTH)));
+
+    sheet->SetCell(chain_pos(0), "2");
+    ASSERT_EQUAL(sheet->GetCell(chain_pos(LENGTH / 2))->GetValue(),
+                 CellInterface::Value(double(LENGTH / 2 + 2)));
+
+    static_cast<Sheet&>(*sheet).Recalculate();
+    ASSERT_EQUAL(sheet->GetCell(chain_pos(LENGTH - 1))->GetValue(),
+                 CellInterface::Value(double(LENGTH + 1)));
+}
+
+void TestEditsInDependencyWeb() {
+    constexpr int LAYERS = 60;
+    Sheet sheet;
+    sheet.SetCell({0, 0}, "1");
+    sheet.SetCell({0, 1}, "1");
+    for (int row = 1; row < LAYERS; ++row) {
+        const auto left = Position{row - 1, 0}.ToString();
+        const auto right = Position{row - 1, 1}.ToString();
+        sheet.SetCell({row, 0}, "=" + left + "+" + right);
+        sheet.SetCell({row, 1}, "=" + right + "+" + left);
+    }
+    const Position output{LAYERS - 1, 0};
+    ASSERT_EQUAL(sheet.GetCell(output)->GetValue(), CellInterface::Value(std::pow(2.0, LAYERS - 1)));
+
+    // правка ничего не пересчитывает, проверка происходит при чтении
+    sheet.SetCell({0, 1}, "3");
+    sheet.SetCell({0, 0}, "3");
+    ASSERT(!static_cast<const Cell*>(sheet.GetCell(output))->IsCacheValid());
+    ASSERT_EQUAL(sheet.GetCell(output)->GetValue(), CellInterface::Value(3 * std::pow(2.0, LAYERS - 1)));
+
+    // правка, не задевающая ссылки, не меняет значений
+    sheet.SetCell("Z1"_pos, "7");
+    ASSERT_EQUAL(sheet.GetCell(output)->GetValue(), CellInterface::Value(3 * std::pow(2.0, LAYERS - 1)));
+
+    sheet.ClearCell({0, 0});
+    ASSERT_EQUAL(sheet.GetCell({1, 0})->GetValue(), CellInterface::Value(3.0));
+    sheet.SetCell({0, 0}, "=1/0");
+    ASSERT_EQUAL(sheet.GetCell(output)->GetValue(),
+                 CellInterface::Value(FormulaError(FormulaError::Category::Div0)));
+}
+
+void TestBatchEdits() {
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "=B1");
+    sheet.SetCell("B1"_pos, "2");
+
+    sheet.BeginBatch();
+    sheet.SetCell("B1"_pos, "=A2*2");
+    sheet.SetCell("A2"_pos, "5");
+    sheet.SetCell("C1"_pos, "=A1+1");
+    sheet.ClearCell("Z9"_pos);
+    ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetText(), "2");
+    ASSERT(sheet.GetCell("C1"_pos) == nullptr);
+    sheet.CommitBatch();
+
+    ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetValue(), CellInterface::Value(11.0));
+
+    // цикл виден только в итоговом графе: пакет отклоняется целиком
+    sheet.BeginBatch();
+    sheet.SetCell("D1"_pos, "text");
+    sheet.SetCell("A2"_pos, "=C1");
+    sheet.ClearCell("A1"_pos);
+    sheet.SetCell("A1"_pos, "=B1");
+    bool circular = false;
+    try {
+        sheet.CommitBatch();
+    } catch (const CircularDependencyException&) {
+        circular = true;
+    }
+    ASSERT(circular);
+    ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetText(), "=B1");
+    ASSERT(!sheet.IsInBatch());
+    ASSERT(sheet.GetCell("D1"_pos) == nullptr);
+    ASSERT_EQUAL(sheet.GetCell("A2"_pos)->GetText(), "5");
+
+    // промежуточный цикл не мешает, если итоговый граф ацикличен
+    sheet.SetCells({{"A2"_pos, "=C1"}, {"A1"_pos, "7"}});
+    ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetValue(), CellInterface::Value(8.0));
+    ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetValue(), CellInterface::Value(16.0));
+
+    bool caught = false;
+    try {
+        sheet.SetCells({{"A1"_pos, "1"}, {"E1"_pos, "=A1+"}});
+    } catch (const FormulaException&) {
+        caught = true;
+    }
+    ASSERT(caught);
+    ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetText(), "7");
+    ASSERT(sheet.GetCell("E1"_pos) == nullptr);
+
+    sheet.BeginBatch();
+    sheet.SetCell("A1"_pos, "1");
+    sheet.SetCell("A1"_pos, "3");
+    sheet.RollbackBatch();
+    ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetValue(), CellInterface::Value(8.0));
+
+    sheet.SetCells({{"A1"_pos, "1"}, {"A1"_pos, "3"}});
+    ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetValue(), CellInterface::Value(4.0));
+}
+
+void TestDependencyGraphCompaction() {
+    constexpr int ROWS = 10'000;
+    DependencyGraph graph;
+    for (int row = 1; row < ROWS; ++row) {
+        graph.SetReferences({row, 1}, {{row - 1, 0}, {row, 0}});
+    }
+    // половина формул меняет ссылки: удалённые ребра в сжатой части и новые в буфере
+    for (int row = 1; row < ROWS; row += 2) {
+        graph.SetReferences({row, 1}, {{row, 0}, {row, 2}});
+    }
+    ASSERT_EQUAL(graph.GetEdgeCount(), size_t(2 * (ROWS - 1)));
+
+    auto check = [&graph]() {
+        for (int row = 1; row < ROWS; ++row) {
+            std::vector<Position> refs = graph.GetReferences({row, 1});
+            std::sort(refs.begin(), refs.end());
+            const Position second = row % 2 ? Position{row, 2} : Position{row - 1, 0};
+            ASSERT_EQUAL(refs, (std::vector{std::min(Position{row, 0}, second),
+                                            std::max(Position{row, 0}, second)}));
+
+            int dependants = 0;
+            graph.ForEachDependant({row, 0}, [&dependants](Position) {
+                ++dependants;
+            });
+            ASSERT_EQUAL(dependants, row % 2 == 1 && row + 1 < ROWS ? 2 : 1);
+        }
+    };
+    check();
+    graph.Compact();
+    check();
+    ASSERT_EQUAL(graph.GetEdgeMemory(), graph.GetEdgeCount() * 2 * sizeof(uint32_t));
+
+    for (int row = 1; row < ROWS; ++row) {
+        graph.RemoveReferences({row, 1});
+    }
+    ASSERT_EQUAL(graph.GetEdgeCount(), size_t(0));
+    ASSERT(!graph.HasDependants({0, 0}));
+    graph.SetReferences("A1"_pos, {"B1"_pos});
+    ASSERT(graph.HasDependants("B1"_pos));
+}
+
+void TestRecalculateAll() {
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "1");
+    sheet.SetCell("B1"_pos, "=A1*2");
+    sheet.SetCell("C1"_pos, "=A1+B1");
+    sheet.SetCell("D1"_pos, "=C1+B1+A1");
+
+    sheet.Recalculate();
+    ASSERT_EQUAL(sheet.GetCell("D1"_pos)->GetValue(), CellInterface::Value(6.0));
+
+    sheet.SetCell("A1"_pos, "10");
+    sheet.Recalculate();
+    ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetValue(), CellInterface::Value(20.0));
+    ASSERT_EQUAL(sheet.GetCell("D1"_pos)->GetValue(), CellInterface::Value(60.0));
+}
+
+void TestEarlyCutoff() {
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "1");
+    sheet.SetCell("B1"_pos, "=A1*0");
+    sheet.SetCell("C1"_pos, "=B1+1");
+    sheet.SetCell("D1"_pos, "=A1*2");
+    sheet.Recalculate();
+
+    auto changed_at = [&sheet](Position pos) {
+        return static_cast<const Cell*>(sheet.GetCell(pos))->GetChangedAt();
+    };
+    const auto b1_changed = changed_at("B1"_pos);
+    const auto c1_changed = changed_at("C1"_pos);
+    const auto d1_changed = changed_at("D1"_pos);
+
+    // B1 пересчитывается в то же значение: C1 не пересчитывается
+    sheet.SetCell("A1"_pos, "5");
+    ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetValue(), CellInterface::Value(1.0));
+    ASSERT_EQUAL(changed_at("B1"_pos), b1_changed);
+    ASSERT_EQUAL(changed_at("C1"_pos), c1_changed);
+    ASSERT(static_cast<const Cell*>(sheet.GetCell("C1"_pos))->IsCacheValid());
+
+    sheet.Recalculate();
+    ASSERT_EQUAL(sheet.GetCell("D1"_pos)->GetValue(), CellInterface::Value(10.0));
+    ASSERT(changed_at("D1"_pos) > d1_changed);
+
+    // -0 печатается иначе, чем 0, поэтому считается изменением
+    sheet.SetCell("A1"_pos, "-1");
+    sheet.SetCell("E1"_pos, "=B1");
+    sheet.Recalculate();
+    ASSERT(changed_at("B1"_pos) > b1_changed);
+    ASSERT_EQUAL(changed_at("C1"_pos), c1_changed);
+    std::ostringstream values;
+    sheet.PrintValues(values);
+    ASSERT_EQUAL(values.str(), "-1\t-0\t1\t-2\t-0\n");
+}
+
+void TestParallelRecalculation() {
+    constexpr int ROWS = 50;
+    constexpr int COLS = 300;
+
+    auto fill = [](Sheet& sheet) {
+        for (int col = 0; col < COLS; ++col) {
+            sheet.SetCell({0, col}, std::to_string(col % 7));
+            for (int row = 1; row < ROWS; ++row) {
+                const auto up = Position{row - 1, col}.ToString();
+                const auto left = Position{row - 1, col > 0 ? col - 1 : col}.ToString();
+                sheet.SetCell({row, col}, "=" + up + "*0.5+" + left + "/3+" + std::to_string(row));
+            }
+        }
+    };
+
+    Sheet serial;
+    Sheet parallel;
+    parallel.SetRecalculationThreads(4);
+    fill(serial);
+    fill(parallel);
+
+    for (int pass = 0; pass < 2; ++pass) {
+        serial.Recalculate();
+        parallel.Recalculate();
+        for (int row = 0; row < ROWS; ++row) {
+            for (int col = 0; col < COLS; ++col) {
+                ASSERT_EQUAL(parallel.GetCell({row, col})->GetValue(),
+                             serial.GetCell({row, col})->GetValue());
+            }
+        }
+        serial.SetCell("A1"_pos, "=1/0");
+        parallel.SetCell("A1"_pos, "=1/0");
+    }
+}
+
+void TestSheetSnapshots() {
+    auto sheet = std::make_unique<Sheet>();
+    sheet->SetCell("A1"_pos, "1");
+    sheet->SetCell("B1"_pos, "=A1*2");
+    sheet->SetCell("C1"_pos, "'=text");
+    sheet->SetCell("D1"_pos, "=SUM(A1:B1)");
+    sheet->SetCell("A70"_pos, "=D1");
+
+    auto print = [](const SheetInterface& sheet) {
+        std::ostringstream texts;
+        std::ostringstream values;
+        sheet.PrintTexts(texts);
+        sheet.PrintValues(values);
+        return texts.str() + values.str();
+    };
+
+    const auto snapshot = sheet->Snapshot();
+    const auto printed = print(*sheet);
+    ASSERT_EQUAL(print(*snapshot), printed);
+
+    sheet->SetCell("A1"_pos, "10");
+    sheet->ClearCell("C1"_pos);
+    sheet->SetCell("A100"_pos, "new");
+    ASSERT_EQUAL(sheet->GetCell("A70"_pos)->GetValue(), CellInterface::Value(30.0));
+
+    // правки таблицы не видны в снимке
+    ASSERT_EQUAL(print(*snapshot), printed);
+    ASSERT_EQUAL(snapshot->GetCell("A70"_pos)->GetValue(), CellInterface::Value(3.0));
+    ASSERT_EQUAL(snapshot->GetCell("B1"_pos)->GetText(), "=A1*2");
+    ASSERT(snapshot->GetCell("A100"_pos) == nullptr);
+    ASSERT_EQUAL(snapshot->GetPrintableSize(), (Size{70, 4}));
+
+    const auto next = sheet->Snapshot();
+    ASSERT(next->GetEpoch() > snapshot->GetEpoch());
+    ASSERT_EQUAL(print(*next), print(*sheet));
+
+    bool caught = false;
+    try {
+        const_cast<SheetSnapshot&>(*snapshot).SetCell("A1"_pos, "2");
+    } catch (const std::logic_error&) {
+        caught = true;
+    }
+    ASSERT(caught);
+
+    // снимок переживает таблицу
+    sheet.reset();
+    ASSERT_EQUAL(next->GetCell("D1"_pos)->GetValue(), CellInterface::Value(30.0));
+    ASSERT_EQUAL(print(*snapshot), printed);
+}
+
+void TestSnapshotsReadDuringWrites() {
+    constexpr int ROWS = 200;
+    constexpr int EDITS = 300;
+    constexpr int READERS = 3;
+
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "0");
+    for (int row = 1; row < ROWS; ++row) {
+        sheet.SetCell({row, 0}, "=A" + std::to_string(row) + "+A1");
+    }
+
+    std::shared_ptr<const SheetSnapshot> published = sheet.Snapshot();
+    std::atomic<bool> done = false;
+    std::atomic<int> inconsistent = 0;
+
+    // каждый снимок согласован: значение строки row равно (row + 1) * A1
+    auto read = [&]() {
+        while (!done.load()) {
+            const auto snapshot = std::atomic_load(&published);
+            const double base = *snapshot->GetCell("A1"_pos)->GetNumber();
+            for (int row = ROWS - 1; row > 0; row -= 37) {
+                const auto value = snapshot->GetCell({row, 0})->GetValue();
+                if (std::get<double>(value) != base * (row + 1))
+                    ++inconsistent;
+            }
+            std::ostringstream out;
+            snapshot->PrintValues(out);
+        }
+    };
+    std::vector<std::thread> readers;
+    for (int i = 0; i < READERS; ++i) {
+        readers.emplace_back(read);
+    }
+
+    for (int edit = 1; edit <= EDITS; ++edit) {
+        sheet.SetCell("A1"_pos, std::to_string(edit));
+        ASSERT_EQUAL(sheet.GetCell({ROWS - 1, 0})->GetValue(),
+                     CellInterface::Value(double(edit * ROWS)));
+        std::atomic_store(&published, sheet.Snapshot());
+    }
+    done = true;
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    ASSERT_EQUAL(inconsistent.load(), 0);
+}
+
+void TestSheetFork() {
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "1");
+    sheet.SetCell("A2"_pos, "2");
+    sheet.SetCell("B1"_pos, "=A1*10");
+    sheet.SetCell("B2"_pos, "=A2*10");
+    sheet.SetCell("C1"_pos, "=SUM(B1:B2)");
+    sheet.Recalculate();
+
+    const CellInterface* stale = sheet.GetCell("C1"_pos);
+    auto fork = sheet.Fork();
+    auto changed_at = [](const Sheet& sheet, Position pos) {
+        return static_cast<const Cell*>(sheet.GetCell(pos))->GetChangedAt();
+    };
+    const auto b2_changed = changed_at(*fork, "B2"_pos);
+
+    // правки копии не видны исходной таблице, пересчитываются только зависимые ячейки
+    fork->SetCell("A1"_pos, "5");
+    fork->Recalculate();
+    ASSERT_EQUAL(fork->GetCell("C1"_pos)->GetValue(), CellInterface::Value(70.0));
+    ASSERT_EQUAL(changed_at(*fork, "B2"_pos), b2_changed);
+    ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetValue(), CellInterface::Value(30.0));
+    ASSERT_EQUAL(stale->GetValue(), CellInterface::Value(30.0));
+
+    // и наоборот
+    sheet.SetCell("A2"_pos, "0");
+    sheet.SetCell("D1"_pos, "=C1+1");
+    ASSERT_EQUAL(sheet.GetCell("D1"_pos)->GetValue(), CellInterface::Value(11.0));
+    ASSERT_EQUAL(stale->GetValue(), CellInterface::Value(10.0));
+    ASSERT_EQUAL(fork->GetCell("C1"_pos)->GetValue(), CellInterface::Value(70.0));
+    ASSERT(fork->GetCell("D1"_pos) == nullptr);
+
+    // ячейка, которую копия уже не разделяет, остаётся той же после следующей копии
+    const CellInterface* d1 = sheet.GetCell("D1"_pos);
+    sheet.Fork().reset();
+    ASSERT(sheet.GetCell("D1"_pos) == d1);
+    ASSERT_EQUAL(d1->GetValue(), CellInterface::Value(11.0));
+
+    // копия копии и копия, пережившая исходную таблицу
+    auto second = fork->Fork();
+    second->SetCell("B2"_pos, "=A1+A2");
+    ASSERT_EQUAL(second->GetCell("C1"_pos)->GetValue(), CellInterface::Value(57.0));
+    ASSERT_EQUAL(fork->GetCell("C1"_pos)->GetValue(), CellInterface::Value(70.0));
+
+    std::ostringstream before;
+    fork->PrintValues(before);
+    fork.reset();
+    std::ostringstream texts;
+    second->PrintTexts(texts);
+    ASSERT_EQUAL(texts.str(), "5\t=A1*10\t=SUM(B1:B2)\n2\t=A1+A2\t\n");
+    ASSERT_EQUAL(before.str(), "5\t50\t70\n2\t20\t\n");
+
+    bool caught = false;
+    try {
+        second->SetCell("A2"_pos, "=C1");
+    } catch (const CircularDependencyException&) {
+        caught = true;
+    }
+    ASSERT(caught);
+    ASSERT_EQUAL(second->GetCell("A2"_pos)->GetText(), "2");
+}
+
+void TestCellArena() {
+    auto sheet = std::make_unique<Sheet>();
+    const auto& arena = sheet->GetCellArena();
+    // слоты в кеше потока считаются занятыми, поэтому перед подсчётом он сбрасывается
+    auto statistics = [](const CellArena& arena) {
+        CellArena::FlushThreadCache();
+        return arena.GetStatistics();
+    };
+    const size_t empty_slots = statistics(arena).used_slots;
+
+    for (int row = 0; row < 100; ++row) {
+        sheet->SetCell({row, 0}, std::to_string(row));
+        sheet->SetCell({row, 1}, "=A" + std::to_string(row + 1) + "*2");
+    }
+    ASSERT(statistics(arena).used_slots > empty_slots);
+
+    // замена содержимого берёт освобождённые слоты, новые блоки не нужны
+    const auto filled = statistics(arena);
+    for (int row = 0; row < 100; ++row) {
+        sheet->SetCell({row, 0}, std::to_string(row + 1));
+        sheet->SetCell({row, 1}, "=A" + std::to_string(row + 1) + "*3");
+    }
+    ASSERT_EQUAL(statistics(arena).used_slots, filled.used_slots);
+    ASSERT_EQUAL(statistics(arena).slabs, filled.slabs);
+    ASSERT_EQUAL(sheet->GetCell("B100"_pos)->GetValue(), CellInterface::Value(300.0));
+
+    // снимок и копия таблицы держат арену после удаления таблицы
+    const auto snapshot = sheet->Snapshot();
+    auto fork = sheet->Fork();
+    sheet.reset();
+    ASSERT_EQUAL(snapshot->GetCell("B2"_pos)->GetValue(), CellInterface::Value(6.0));
+    fork->SetCell("A2"_pos, "10");
+    ASSERT_EQUAL(fork->GetCell("B2"_pos)->GetValue(), CellInterface::Value(30.0));
+    ASSERT_EQUAL(fork->GetCell("B3"_pos)->GetValue(), CellInterface::Value(9.0));
+
+    // без снимков и правок все слоты возвращаются
+    Sheet cleared;
+    for (int row = 0; row < 100; ++row) {
+        cleared.SetCell({row, 0}, "=" + std::to_string(row) + "+1");
+    }
+    for (int row = 0; row < 100; ++row) {
+        cleared.ClearCell({row, 0});
+    }
+    ASSERT_EQUAL(statistics(cleared.GetCellArena()).used_slots, empty_slots);
+
+    // опустевшие блоки возвращаются системе
+    std::vector<std::pair<Position, std::string>> numbers;
+    for (int row = 0; row < 200; ++row) {
+        for (int col = 0; col < 100; ++col) {
+            numbers.emplace_back(Position{row, col}, std::to_string(row * col));
+        }
+    }
+    cleared.SetCells(numbers);
+    const size_t slabs = statistics(cleared.GetCellArena()).slabs;
+    for (const auto& [pos, text] : numbers) {
+        cleared.ClearCell(pos);
+    }
+    ASSERT(statistics(cleared.GetCellArena()).slabs < slabs);
+    ASSERT_EQUAL(statistics(cleared.GetCellArena()).used_slots, empty_slots);
+
+    // формулы пакета разбираются на пуле: ячейки создаются в кешах рабочих потоков,
+    // а освобождаются в вызывающем
+    auto parallel = std::make_unique<Sheet>();
+    parallel->SetRecalculationThreads(4);
+    for (int generation = 1; generation <= 3; ++generation) {
+        std::vector<std::pair<Position, std::string>> formulas;
+        for (int row = 0; row < 100; ++row) {
+            formulas.emplace_back(Position{row, 0}, std::to_string(row));
+            formulas.emplace_back(Position{row, 1}, "=A" + std::to_string(row + 1) + "*"
+                                                    + std::to_string(generation));
+        }
+        parallel->SetCells(std::move(formulas));
+    }
+    ASSERT_EQUAL(parallel->GetCell("B100"_pos)->GetValue(), CellInterface::Value(297.0));
+    parallel.reset();
+}
+
+void TestSheetFile() {
+    const auto path = (std::filesystem::temp_directory_path() / "spreadsheet_test.sheet").string();
+
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "1");
+    sheet.SetCell("A2"_pos, "'2");
+    sheet.SetCell("A3"_pos, "text");
+    sheet.SetCell("B1"_pos, "=A1*2");
+    sheet.SetCell("B2"_pos, "=A2*2");
+    sheet.SetCell("B3"_pos, "=A3*2");
+    sheet.SetCell("C1"_pos, "=SUM(B1:B2)+E5");
+    sheet.SetCell("D1"_pos, "=1/0");
+    sheet.SetCell("BM65"_pos, "=C1");
+
+    auto print = [](const SheetInterface& sheet) {
+        std::ostringstream out;
+        sheet.PrintTexts(out);
+        out << "---\n";
+        sheet.PrintValues(out);
+        return out.str();
+    };
+    const auto expected = print(sheet);
+
+    for (const bool with_values : {true, false}) {
+        SheetFile::Save(sheet, path, with_values);
+        auto loaded = SheetFile::Load(path);
+        ASSERT(loaded.mode == SheetFile::LoadMode::Mapped);
+        ASSERT_EQUAL(print(*loaded.sheet), expected);
+        ASSERT(loaded.sheet->GetCell("E5"_pos) != nullptr);
+
+        // граф загружен вместе с ячейками: правки пересчитывают зависимые, циклы запрещены
+        loaded.sheet->SetCell("A1"_pos, "10");
+        ASSERT_EQUAL(loaded.sheet->GetCell("BM65"_pos)->GetValue(), CellInterface::Value(24.0));
+        bool caught = false;
+        try {
+            loaded.sheet->SetCell("A2"_pos, "=BM65");
+        } catch (const CircularDependencyException&) {
+            caught = true;
+        }
+        ASSERT(caught);
+        loaded.sheet->ClearCell("C1"_pos);
+        ASSERT_EQUAL(loaded.sheet->GetCell("BM65"_pos)->GetValue(), CellInterface::Value(0.0));
+    }
+
+    // данные другой версии не читаются: таблица собирается из текстов
+    {
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        file.seekp(12);
+        const uint32_t version = SheetFile::VERSION + 1;
+        file.write(reinterpret_cast<const char*>(&version), sizeof(version));
+    }
+    auto rebuilt = SheetFile::Load(path);
+    ASSERT(rebuilt.mode == SheetFile::LoadMode::Rebuilt);
+    ASSERT_EQUAL(print(*rebuilt.sheet), expected);
+
+    // программа формулы изменена, а граф нет: граф не совпадает с формулами,
+    // и таблица собирается из текстов, а не получает незамеченный цикл
+    {
+        Sheet chain;
+        chain.SetCell("A1"_pos, "=B1");
+        chain.SetCell("B1"_pos, "=C1");
+        chain.SetCell("C1"_pos, "=Z1");
+        SheetFile::Save(chain, path);
+
+        std::string data;
+        {
+            std::ifstream file(path, std::ios::binary);
+            data.assign(std::istreambuf_iterator<char>(file), {});
+        }
+        // тексты записаны раньше программ: последнее вхождение - программа C1
+        const auto program = data.rfind("Z1");
+        ASSERT(program != std::string::npos);
+        data[program] = 'A';
+        {
+            std::ofstream file(path, std::ios::binary | std::ios::trunc);
+            file.write(data.data(), static_cast<std::streamsize>(data.size()));
+        }
+        auto corrupted = SheetFile::Load(path);
+        ASSERT(corrupted.mode == SheetFile::LoadMode::Rebuilt);
+        ASSERT_EQUAL(corrupted.sheet->GetCell("C1"_pos)->GetText(), "=Z1");
+        ASSERT_EQUAL(corrupted.sheet->GetCell("A1"_pos)->GetValue(), CellInterface::Value(0.0));
+
+        // смещение рёбер вершины за концом массива рёбер: файл не читается за границами,
+        // а собирается из текстов
+        chain.SetCell("C1"_pos, "=Z1");
+        SheetFile::Save(chain, path);
+        {
+            std::ifstream file(path, std::ios::binary);
+            data.assign(std::istreambuf_iterator<char>(file), {});
+        }
+        // граф в конце файла: вершины, 5 смещений, 3 ребра, границы порядка
+        constexpr size_t NODES = 4;
+        constexpr size_t EDGES = 3;
+        const size_t edges_at = data.size() - 2 * sizeof(int32_t) - EDGES * sizeof(uint32_t);
+        const size_t offsets_at = edges_at - sizeof(uint64_t) - (NODES + 1) * sizeof(uint32_t);
+        uint64_t edge_count = 0;
+        uint64_t offset_count = 0;
+        std::memcpy(&edge_count, &data[edges_at - sizeof(uint64_t)], sizeof(edge_count));
+        std::memcpy(&offset_count, &data[offsets_at - sizeof(uint64_t)], sizeof(offset_count));
+        ASSERT_EQUAL(edge_count, EDGES);
+        ASSERT_EQUAL(offset_count, NODES + 1);
+        const uint32_t offset = 100;
+        std::memcpy(&data[offsets_at + sizeof(uint32_t)], &offset, sizeof(offset));
+        {
+            std::ofstream file(path, std::ios::binary | std::ios::trunc);
+            file.write(data.data(), static_cast<std::streamsize>(data.size()));
+        }
+        auto out_of_bounds = SheetFile::Load(path);
+        ASSERT(out_of_bounds.mode == SheetFile::LoadMode::Rebuilt);
+        ASSERT_EQUAL(out_of_bounds.sheet->GetCell("A1"_pos)->GetText(), "=B1");
+    }
+
+    // якорь формулы за границами таблицы: ссылки не вычисляются от него, таблица
+    // собирается из текстов
+    {
+        Sheet single;
+        single.SetCell("A1"_pos, "=C7+1");
+        SheetFile::Save(single, path, false);
+
+        std::string data;
+        {
+            std::ifstream file(path, std::ios::binary);
+            data.assign(std::istreambuf_iterator<char>(file), {});
+        }
+        // запись ячейки: вид формулы, без значения, шаблон 0, якорь A1
+        const int32_t record[] = {3, 0, 0, 0};
+        const std::string pattern(reinterpret_cast<const char*>(record), sizeof(record));
+        const auto at = data.find(pattern);
+        ASSERT(at != std::string::npos);
+        ASSERT(data.find(pattern, at + 1) == std::string::npos);
+        const int32_t row = std::numeric_limits<int32_t>::max() - 1;
+        std::memcpy(&data[at + 2 * sizeof(int32_t)], &row, sizeof(row));
+        {
+            std::ofstream file(path, std::ios::binary | std::ios::trunc);
+            file.write(data.data(), static_cast<std::streamsize>(data.size()));
+        }
+        auto corrupted = SheetFile::Load(path);
+        ASSERT(corrupted.mode == SheetFile::LoadMode::Rebuilt);
+        ASSERT_EQUAL(corrupted.sheet->GetCell("A1"_pos)->GetValue(), CellInterface::Value(1.0));
+    }
+
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file << "A1\t=B1\n";
+    }
+    bool caught = false;
+    try {
+        SheetFile::Load(path);
+    } catch (const SheetFileError&) {
+        caught = true;
+    }
+    ASSERT(caught);
+    std::remove(path.c_str());
+}
+
+void TestSheetImporter() {
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "1");
+    sheet.SetCell("B1"_pos, "'2");
+    sheet.SetCell("C1"_pos, "=A3+B1");
+    sheet.SetCell("A3"_pos, "=SUM(A1:B1)*2");
+    sheet.SetCell("B3"_pos, "text with spaces");
+    sheet.SetCell("BM70"_pos, "=C1/0");
+    sheet.SetCell("D2"_pos, "=Z100");
+
+    std::ostringstream texts;
+    sheet.PrintTexts(texts);
+    std::ostringstream values;
+    sheet.PrintValues(values);
+
+    // маленькие блоки: строки разрезаются границами блоков
+    for (const size_t block_size : {size_t{5}, size_t{64}, size_t{1} << 20}) {
+        std::istringstream input(texts.str());
+        SheetImporter::Options options;
+        options.threads = 3;
+        options.block_size = block_size;
+        auto imported = SheetImporter::Import(input, options);
+
+        std::ostringstream imported_texts;
+        imported->PrintTexts(imported_texts);
+        ASSERT_EQUAL(imported_texts.str(), texts.str());
+        std::ostringstream imported_values;
+        imported->PrintValues(imported_values);
+        ASSERT_EQUAL(imported_values.str(), values.str());
+
+        imported->SetCell("A1"_pos, "10");
+        ASSERT_EQUAL(imported->GetCell("C1"_pos)->GetValue(), CellInterface::Value(26.0));
+        bool caught = false;
+        try {
+            imported->SetCell("A1"_pos, "=C1");
+        } catch (const CircularDependencyException&) {
+            caught = true;
+        }
+        ASSERT(caught);
+    }
+
+    {
+        std::istringstream input("a,\"b,c\",\"x\"\"y\"\r\n\"two\nlines\",=A3*2,\r\n7\n");
+        SheetImporter::Options options;
+        options.delimiter = ',';
+        options.quote = '"';
+        auto imported = SheetImporter::Import(input, options);
+        ASSERT_EQUAL(imported->GetCell("B1"_pos)->GetText(), "b,c");
+        ASSERT_EQUAL(imported->GetCell("C1"_pos)->GetText(), "x\"y");
+        ASSERT_EQUAL(imported->GetCell("A2"_pos)->GetText(), "two\nlines");
+        ASSERT_EQUAL(imported->GetCell("B2"_pos)->GetValue(), CellInterface::Value(14.0));
+        ASSERT(imported->GetCell("C2"_pos) == nullptr);
+        ASSERT_EQUAL(imported->GetPrintableSize(), (Size{3, 3}));
+    }
+
+    auto import_fails = [](const std::string& text) {
+        std::istringstream input(text);
+        try {
+            SheetImporter::Import(input);
+        } catch (const CircularDependencyException&) {
+            return true;
+        } catch (const FormulaException&) {
+            return true;
+        }
+        return false;
+    };
+    ASSERT(import_fails("=B1\t=A1\n"));
+    ASSERT(import_fails("=A1\n"));
+    ASSERT(import_fails("1\t=1+\n"));
+}
+
+void TestParseNumber() {
+    ASSERT_EQUAL(*Cell::ParseNumber("1.5e3"), 1500.0);
+    ASSERT_EQUAL(*Cell::ParseNumber("-.5"), -0.5);
+    ASSERT_EQUAL(*Cell::ParseNumber("+5"), 5.0);
+    ASSERT_EQUAL(*Cell::ParseNumber(" 5"), 5.0);
+    ASSERT(!Cell::ParseNumber("5 "));
+    ASSERT(!Cell::ParseNumber("1x"));
+    ASSERT(!Cell::ParseNumber("inf"));
+    ASSERT(!Cell::ParseNumber("-nan"));
+    ASSERT(!Cell::ParseNumber("1e999"));
+    ASSERT(!Cell::ParseNumber("-"));
+}
+
+void TestCellsAcrossTiles() {
+    auto sheet = CreateSheet();
+    sheet->SetCell("A1"_pos, "1");
+    sheet->SetCell("BM65"_pos, "tile");
+    sheet->SetCell("XFD16384"_pos, "=A1+1");
+
+    ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{Position::MAX_ROWS, Position::MAX_COLS}));
+    ASSERT_EQUAL(sheet->GetCell("XFD16384"_pos)->GetValue(), CellInterface::Value(2.0));
+    ASSERT(sheet->GetCell("BM64"_pos) == nullptr);
+
+    sheet->ClearCell("XFD16384"_pos);
+    ASSERT(sheet->GetCell("XFD16384"_pos) == nullptr);
+    ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{65, 65}));
+    ASSERT_EQUAL(sheet->GetCell("BM65"_pos)->GetText(), "tile");
+}
+    
+void TestRangeDependencies() {
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "1");
+    sheet.SetCell("A5"_pos, "2");
+    sheet.SetCell("C1"_pos, "=SUM(A1:A1000)");
+    sheet.SetCell("D1"_pos, "=C1*2");
+
+    // ячейки диапазона не превращаются в отдельные ссылки и не создаются
+    ASSERT(sheet.GetCell("A2"_pos) == nullptr);
+    ASSERT_EQUAL(sheet.GetCell("D1"_pos)->GetValue(), CellInterface::Value(6.0));
+
+    sheet.SetCell("A999"_pos, "10");
+    ASSERT_EQUAL(sheet.GetCell("D1"_pos)->GetValue(), CellInterface::Value(26.0));
+    sheet.SetCell("A500"_pos, "=A1+A5");
+    ASSERT_EQUAL(sheet.GetCell("D1"_pos)->GetValue(), CellInterface::Value(32.0));
+    sheet.SetCell("A1"_pos, "2");
+    sheet.Recalculate();
+    ASSERT_EQUAL(sheet.GetCell("D1"_pos)->GetValue(), CellInterface::Value(36.0));
+    sheet.ClearCell("A999"_pos);
+    ASSERT_EQUAL(sheet.GetCell("D1"_pos)->GetValue(), CellInterface::Value(16.0));
+
+    ASSERT(IsCircular(sheet, "A7"_pos, "=D1"));
+    ASSERT(IsCircular(sheet, "A7"_pos, "=SUM(C1:C2)"));
+    ASSERT(IsCircular(sheet, "B2"_pos, "=MAX(A1:C3)"));
+    ASSERT(IsCircular(sheet, "A500"_pos, "=A1+D1"));
+    ASSERT_EQUAL(sheet.GetCell("D1"_pos)->GetValue(), CellInterface::Value(16.0));
+
+    // после удаления ссылки на диапазон его ячейки снова можно связывать с формулой
+    sheet.SetCell("C1"_pos, "=A1");
+    sheet.SetCell("A7"_pos, "=D1");
+    ASSERT_EQUAL(sheet.GetCell("A7"_pos)->GetValue(), CellInterface::Value(4.0));
+    ASSERT(IsCircular(sheet, "C1"_pos, "=SUM(A1:A10)"));
+
+    sheet.BeginBatch();
+    sheet.SetCell("A7"_pos, "3");
+    sheet.SetCell("C1"_pos, "=SUM(A1:A10)");
+    sheet.CommitBatch();
+    ASSERT_EQUAL(sheet.GetCell("D1"_pos)->GetValue(), CellInterface::Value(14.0));
+}
+    
+void TestSharedFormulaTemplates() {
+    constexpr int ROWS = 1000;
+    Sheet sheet;
+    for (int row = 0; row < ROWS; ++row) {
+        const auto r = std::to_string(row + 1);
+        sheet.SetCell({row, 1}, r);
+        sheet.SetCell({row, 2}, "2");
+        sheet.SetCell({row, 3}, "=B" + r + "*C" + r);
+        sheet.SetCell({row, 4}, "=SUM(B" + r + ":C" + std::to_string(row + 2) + ")");
+    }
+    sheet.SetCell("F1"_pos, "=B1*C2");
+    ASSERT_EQUAL(sheet.GetFormulaCache().GetTemplateCount(), size_t(3));
+
+    ASSERT_EQUAL(sheet.GetCell("D7"_pos)->GetText(), "=B7*C7");
+    ASSERT_EQUAL(sheet.GetCell("D7"_pos)->GetValue(), CellInterface::Value(14.0));
+    ASSERT_EQUAL(sheet.GetCell("D7"_pos)->GetReferencedCells(),
+                 (std::vector<Position>{"B7"_pos, "C7"_pos}));
+    ASSERT_EQUAL(sheet.GetCell("E7"_pos)->GetText(), "=SUM(B7:C8)");
+    ASSERT_EQUAL(sheet.GetCell("E7"_pos)->GetValue(), CellInterface::Value(19.0));
+    ASSERT_EQUAL(sheet.GetCell("F1"_pos)->GetValue(), CellInterface::Value(2.0));
+
+    // ссылки вверх и влево от ячейки формулы
+    sheet.SetCell("H10"_pos, "=B1+G9");
+    sheet.SetCell("I11"_pos, "=C2+H10");
+    ASSERT_EQUAL(sheet.GetFormulaCache().GetTemplateCount(), size_t(4));
+    ASSERT_EQUAL(sheet.GetCell("I11"_pos)->GetText(), "=C2+H10");
+    ASSERT_EQUAL(sheet.GetCell("I11"_pos)->GetValue(), CellInterface::Value(3.0));
+
+    for (int row = 0; row < ROWS; ++row) {
+        sheet.ClearCell({row, 3});
+    }
+    ASSERT_EQUAL(sheet.GetFormulaCache().GetTemplateCount(), size_t(3));
+
+    bool caught = false;
+    try {
+        sheet.SetCell("D1"_pos, "=B1*");
+    } catch (const FormulaException&) {
+        caught = true;
+    }
+    ASSERT(caught);
+}
+
+void TestFormulaInterning() {
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "2");
+    sheet.SetCell("B1"_pos, "3");
+    for (int row = 1; row <= 100; ++row) {
+        sheet.SetCell({row, 5}, "=A1*B1");
+    }
+    sheet.SetCell("G1"_pos, "= A1*B1 ");
+
+    auto statistics = sheet.GetFormulaCache().GetStatistics();
+    ASSERT_EQUAL(statistics.misses, size_t(1));
+    ASSERT_EQUAL(statistics.text_hits, size_t(100));
+    ASSERT_EQUAL(statistics.shape_hits, size_t(0));
+
+    ASSERT_EQUAL(sheet.GetCell("F50"_pos)->GetText(), "=A1*B1");
+    ASSERT_EQUAL(sheet.GetCell("F50"_pos)->GetValue(), CellInterface::Value(6.0));
+    ASSERT_EQUAL(sheet.GetCell("F50"_pos)->GetReferencedCells(),
+                 (std::vector<Position>{"A1"_pos, "B1"_pos}));
+    ASSERT_EQUAL(sheet.GetCell("G1"_pos)->GetValue(), CellInterface::Value(6.0));
+
+    // протянутая формула находится по форме
+    sheet.SetCell("G3"_pos, "=B2*C2");
+    statistics = sheet.GetFormulaCache().GetStatistics();
+    ASSERT_EQUAL(statistics.shape_hits, size_t(1));
+    ASSERT_EQUAL(statistics.misses, size_t(1));
+
+    // после удаления всех формул программа освобождается и разбирается заново
+    for (int row = 0; row <= 100; ++row) {
+        sheet.ClearCell({row, 5});
+        sheet.ClearCell({row, 6});
+    }
+    sheet.SetCell("H1"_pos, "=A1*B1");
+    statistics = sheet.GetFormulaCache().GetStatistics();
+    ASSERT_EQUAL(statistics.misses, size_t(2));
+    ASSERT_EQUAL(sheet.GetCell("H1"_pos)->GetValue(), CellInterface::Value(6.0));
+}
     
 }//end namespace
  
@@ -388,17 +1736,50 @@ int main() {
     RUN_TEST(tr, TestSetCellPlainText);
     RUN_TEST(tr, TestClearCell);
     RUN_TEST(tr, TestFormulaArithmetic);
+    RUN_TEST(tr, TestFormulaDeepExpression);
     RUN_TEST(tr, TestFormulaReferences);
     RUN_TEST(tr, TestFormulaExpressionFormatting);
     RUN_TEST(tr, TestFormulaReferencedCells);
     RUN_TEST(tr, TestErrorValue);
     RUN_TEST(tr, TestErrorDiv0);
+    RUN_TEST(tr, TestErrorPropagation);
     RUN_TEST(tr, TestEmptyCellTreatedAsZero);
     RUN_TEST(tr, TestFormulaInvalidPosition);
     RUN_TEST(tr, TestPrint);
+    RUN_TEST(tr, TestPrintMatchesStream);
+    RUN_TEST(tr, TestPrintRange);
+    RUN_TEST(tr, TestPrintableSize);
     RUN_TEST(tr, TestCellReferences);
+    RUN_TEST(tr, TestEmptyReferencedCells);
     RUN_TEST(tr, TestFormulaIncorrect);
+    RUN_TEST(tr, TestFormulaParser);
+    RUN_TEST(tr, TestFormulaConstantFolding);
+#ifdef SPREADSHEET_ANTLR_ORACLE
+    RUN_TEST(tr, TestFormulaParserMatchesAntlr);
+#endif
+    RUN_TEST(tr, TestNumericTextCells);
+    RUN_TEST(tr, TestParseNumber);
+    RUN_TEST(tr, TestFormulaFunctions);
     RUN_TEST(tr, TestCellCircularReferences);
     RUN_TEST(tr, TestCache);
+    RUN_TEST(tr, TestCircularReferencesThroughBranches);
+    RUN_TEST(tr, TestCircularReferenceInLongChain);
+    RUN_TEST(tr, TestCellsAcrossTiles);
+    RUN_TEST(tr, TestLongDependencyChain);
+    RUN_TEST(tr, TestEditsInDependencyWeb);
+    RUN_TEST(tr, TestRecalculateAll);
+    RUN_TEST(tr, TestEarlyCutoff);
+    RUN_TEST(tr, TestBatchEdits);
+    RUN_TEST(tr, TestDependencyGraphCompaction);
+    RUN_TEST(tr, TestParallelRecalculation);
+    RUN_TEST(tr, TestSheetSnapshots);
+    RUN_TEST(tr, TestSnapshotsReadDuringWrites);
+    RUN_TEST(tr, TestSheetFork);
+    RUN_TEST(tr, TestCellArena);
+    RUN_TEST(tr, TestSheetFile);
+    RUN_TEST(tr, TestSheetImporter);
+    RUN_TEST(tr, TestRangeDependencies);
+    RUN_TEST(tr, TestSharedFormulaTemplates);
+    RUN_TEST(tr, TestFormulaInterning);
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,135 @@
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <locale>
+#include <type_traits>
+#include <variant>
+
+#include "FormulaAST.h"
+#include "cell.h"
+#include "print_buffer.h"
+
+namespace {
+
+// Буфер, освобождённый последней печатью в этом потоке
+thread_local std::vector<char> spare_buffer;
+
+// Поток печатает числа как printf("%g") - так же, как std::to_chars с точностью 6
+bool HasDefaultFormat(const std::ostream& output) {
+    const auto flags = std::ios_base::floatfield | std::ios_base::showpos
+        | std::ios_base::showpoint | std::ios_base::uppercase;
+    return (output.flags() & flags) == 0 && output.precision() == 6 && output.width() == 0
+        && output.getloc() == std::locale::classic();
+}
+
+}  // namespace
+
+PrintBuffer::PrintBuffer(std::ostream& output)
+    : output_(output), buffer_(std::move(spare_buffer)), stream_(this)
+    , default_format_(HasDefaultFormat(output)) {
+
+    buffer_.resize(BUFFER_SIZE);
+    setp(buffer_.data(), buffer_.data() + buffer_.size());
+}
+
+PrintBuffer::~PrintBuffer() {
+    Flush();
+    spare_buffer = std::move(buffer_);
+}
+
+void PrintBuffer::Write(char c, size_t count) {
+    while (count > 0) {
+        if (pptr() == epptr()) {
+            Flush();
+        }
+        const size_t part = std::min(count, static_cast<size_t>(epptr() - pptr()));
+        std::memset(pptr(), c, part);
+        pbump(static_cast<int>(part));
+        count -= part;
+    }
+}
+
+void PrintBuffer::Write(double value) {
+    if (!default_format_) {
+        std::ostream formatted(this);
+        formatted.copyfmt(output_);
+        formatted << value;
+        return;
+    }
+    if (static_cast<size_t>(epptr() - pptr()) < MAX_NUMBER_SIZE) {
+        Flush();
+    }
+    const auto result = std::to_chars(pptr(), epptr(), value, std::chars_format::general, 6);
+    pbump(static_cast<int>(result.ptr - pptr()));
+}
+
+void PrintBuffer::Write(FormulaError error) {
+    stream_ << error;
+}
+
+void PrintBuffer::Write(const CellInterface::Value& value) {
+    std::visit([this](const auto& alternative) {
+        if constexpr (std::is_same_v<std::decay_t<decltype(alternative)>, std::string>) {
+            Write(std::string_view(alternative));
+        } else {
+            Write(alternative);
+        }
+    }, value);
+}
+
+void PrintBuffer::Flush() {
+    if (pptr() > pbase()) {
+        output_.write(pbase(), pptr() - pbase());
+    }
+    setp(buffer_.data(), buffer_.data() + buffer_.size());
+}
+
+PrintBuffer::int_type PrintBuffer::overflow(int_type c) {
+    Flush();
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+
+std::streamsize PrintBuffer::xsputn(const char* data, std::streamsize size) {
+    if (size > epptr() - pptr()) {
+        Flush();
+        // длинный текст пишется в поток напрямую
+        if (static_cast<size_t>(size) >= buffer_.size()) {
+            output_.write(data, size);
+            return size;
+        }
+    }
+    std::memcpy(pptr(), data, size);
+    pbump(static_cast<int>(size));
+    return size;
+}
+
+int PrintBuffer::sync() {
+    Flush();
+    return 0;
+}
+
+void PrintCellText(const Cell& cell, PrintBuffer& buffer) {
+    if (const auto* formula = cell.GetFormula()) {
+        const auto program = GetFormulaProgram(*formula);
+        buffer.Write(FORMULA_SIGN);
+        program.ast->PrintFormula(buffer.Stream(), program.anchor);
+    } else {
+        buffer.Write(cell.GetPlainText());
+    }
+}
+
+void PrintCellValue(const Cell& cell, const CellInterface& formula_cell, PrintBuffer& buffer) {
+    if (cell.GetFormula()) {
+        buffer.Write(formula_cell.GetValue());
+        return;
+    }
+    auto text = cell.GetPlainText();
+    if (!text.empty() && text.front() == ESCAPE_SIGN) {
+        text.remove_prefix(1);
+    }
+    buffer.Write(text);
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <ostream>
+#include <streambuf>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "common.h"
+
+class Cell;
+
+// Буфер печати таблицы: вывод копируется в буфер потока и сбрасывается в поток
+// крупными блоками. Память буфера своя у каждого потока и переходит от одной печати
+// к следующей.
+// Числа форматируются std::to_chars так же, как их печатает operator<< потока
+// с настройками по умолчанию; если настройки потока изменены, число печатается
+// через поток с его настройками. Stream() - поток с настройками по умолчанию,
+// пишущий в тот же буфер.
+class PrintBuffer : public std::streambuf {
+public:
+    explicit PrintBuffer(std::ostream& output);
+    ~PrintBuffer() override;
+
+    PrintBuffer(const PrintBuffer&) = delete;
+    PrintBuffer& operator=(const PrintBuffer&) = delete;
+
+    void Write(char c) {
+        sputc(c);
+    }
+    void Write(char c, size_t count);
+    void Write(std::string_view text) {
+        sputn(text.data(), static_cast<std::streamsize>(text.size()));
+    }
+    void Write(double value);
+    void Write(FormulaError error);
+    void Write(const CellInterface::Value& value);
+
+    std::ostream& Stream() { return stream_; }
+
+    void Flush();
+
+protected:
+    int_type overflow(int_type c) override;
+    std::streamsize xsputn(const char* data, std::streamsize size) override;
+    int sync() override;
+
+private:
+    static constexpr size_t BUFFER_SIZE = 256 << 10;
+    // запас места под самое длинное число
+    static constexpr size_t MAX_NUMBER_SIZE = 32;
+
+    std::ostream& output_;
+    std::vector<char> buffer_;
+    std::ostream stream_;
+    bool default_format_;
+};
+
+// Текст ячейки, как его печатает PrintTexts
+void PrintCellText(const Cell& cell, PrintBuffer& buffer);
+// Значение ячейки, как его печатает PrintValues; значение формулы берётся у formula_cell
+void PrintCellValue(const Cell& cell, const CellInterface& formula_cell, PrintBuffer& buffer);
+
+// Печатает занятые ячейки прямоугольника area построчно: столбцы разделяются '\t',
+// строка заканчивается '\n'. Обходятся только занятые ячейки; print(Position, const T&)
+// пишет содержимое ячейки в buffer.
+template <typename Grid, typename Func>
+void PrintRows(const Grid& cells, const Range& area, PrintBuffer& buffer, Func&& print) {
+    int row = area.first.row;
+    int col = area.first.col;
+    auto finish_row = [&]() {
+        buffer.Write('\t', area.last.col - col);
+        buffer.Write('\n');
+        ++row;
+        col = area.first.col;
+    };
+
+    cells.ForEachInRange(area, [&](Position pos, const auto& cell) {
+        while (row < pos.row) {
+            finish_row();
+        }
+        buffer.Write('\t', pos.col - col);
+        col = pos.col;
+        print(pos, cell);
+    });
+    while (row <= area.last.row) {
+        finish_row();
+    }
+}
+
+// Печатает всю таблицу размера size
+template <typename Grid, typename Func>
+void PrintRows(const Grid& cells, Size size, PrintBuffer& buffer, Func&& print) {
+    if (size.rows > 0 && size.cols > 0) {
+        PrintRows(cells, Range{{0, 0}, {size.rows - 1, size.cols - 1}}, buffer,
+                  std::forward<Func>(print));
+    }
+}
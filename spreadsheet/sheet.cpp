@@ -1,54 +1,176 @@
 #include <algorithm>
+#include <atomic>
+#include <exception>
 #include <iostream>
 #include <optional>
 
 #include "cell.h"
+#include "print_buffer.h"
 #include "sheet.h"
+#include "sheet_snapshot.h"
 #include "common.h"
 
-// --- Table ---
+// --- PrintableArea ---
+
+void PrintableArea::Add(Position pos){
+    Add(row_counts_, pos.row, size_.rows);
+    Add(col_counts_, pos.col, size_.cols);
+}
+
+void PrintableArea::Remove(Position pos){
+    Remove(row_counts_, pos.row, size_.rows);
+    Remove(col_counts_, pos.col, size_.cols);
+}
+
+void PrintableArea::Add(std::vector<int>& counts, int index, int& bound){
+    if(static_cast<size_t>(index) >= counts.size())
+        counts.resize(index + 1);
+    ++counts[index];
+    bound = std::max(bound, index + 1);
+}
 
-CellPtr Table::operator()(Position pos){
-    auto it = cells_.find(pos);
-    if(it != cells_.end())
-        return it->second;
-    return nullptr;
+void PrintableArea::Remove(std::vector<int>& counts, int index, int& bound){
+    --counts[index];
+    while(bound > 0 && counts[bound - 1] == 0)
+        --bound;
 }
 
-const CellPtr Table::operator()(Position pos) const {
-    auto it = cells_.find(pos);
-    if(it != cells_.end())
-        return it->second;
-    return nullptr;
+// --- Table ---
+
+const CellPtr& Table::operator()(Position pos) const {
+    return cells_.Get(pos);
 }
 
-inline void Table::SetCell(CellPtr cell){
+void Table::SetCell(CellPtr cell){
 
     Position pos = cell->GetPosition();
 
-    cells_[pos] = cell;
+    const auto& old_cell = cells_.Get(pos);
+    if(old_cell && !old_cell->IsEmpty())
+        area_.Remove(pos);
+    if(!cell->IsEmpty())
+        area_.Add(pos);
+
+    cells_.Set(pos, std::move(cell));
+    if(!replaced_.empty())
+        replaced_.erase(pos);
 }
 
 inline void Table::DeleteCell(Position pos){
 
     RemoveCellConnections(pos);
 
-    cells_.erase(pos);
+    EraseCell(pos);
 }
 
-inline void Table::RemoveCellConnections(Position pos){
+void Table::EraseCell(Position pos){
+
+    const auto& cell = cells_.Get(pos);
+    if(cell && !cell->IsEmpty())
+        area_.Remove(pos);
+
+    cells_.Erase(pos);
+    if(!replaced_.empty())
+        replaced_.erase(pos);
+}
+
+uint64_t Table::GetChangedAt(Position pos) const {
+    if(const auto& cell = cells_.Get(pos))
+        return cell->GetChangedAt();
+    const auto it = cleared_.find(pos);
+    return it != cleared_.end() ? it->second : 0;
+}
 
-    for(const auto& ref_pos : pos_to_refs[pos]){
-        cell_to_deps[ref_pos].erase(pos);
+bool Table::IsReferencedEmpty(Position pos) const {
+    return cleared_.count(pos) || Graph().HasDirectDependants(pos);
+}
+
+void Table::MarkCleared(Position pos, uint64_t epoch){
+    if(Graph().HasDependants(pos))
+        cleared_[pos] = epoch;
+}
+
+void Table::ReleaseCleared(const std::vector<Position>& refs, const std::vector<Range>& ranges){
+
+    if(cleared_.empty())
+        return;
+
+    std::vector<Position> released;
+    for(const auto ref_pos : refs){
+        if(cleared_.count(ref_pos))
+            released.push_back(ref_pos);
+    }
+    for(const auto& range : ranges)
+        ForEachClearedInRange(range, [&released](Position pos){ released.push_back(pos); });
+
+    for(const auto pos : released){
+        if(!Graph().HasDependants(pos))
+            cleared_.erase(pos);
     }
-    
-    pos_to_refs.erase(pos);
+}
+
+// Очищенных позиций обычно мало: перебираются они, а не клетки диапазона
+template <typename Func>
+void Table::ForEachClearedInRange(const Range& range, Func&& func) const {
+
+    if(cleared_.empty())
+        return;
+
+    const auto area = static_cast<uint64_t>(range.last.row - range.first.row + 1)
+        * static_cast<uint64_t>(range.last.col - range.first.col + 1);
+    if(cleared_.size() <= area){
+        for(const auto& [pos, epoch] : cleared_){
+            if(range.Contains(pos))
+                func(pos);
+        }
+        return;
+    }
+    for(int row = range.first.row; row <= range.last.row; ++row){
+        for(int col = range.first.col; col <= range.last.col; ++col){
+            if(cleared_.count({row, col}))
+                func(Position{row, col});
+        }
+    }
+}
+
+inline void Table::RemoveCellConnections(Position pos){
+    if(Graph().HasReferences(pos))
+        MutableGraph().RemoveReferences(pos);
+}
+
+// Граф, разделяемый с копией таблицы, копируется. Счётчик ссылок увеличивает только
+// Sheet::Fork() этой таблицы; барьер упорядочивает изменение после освобождения копии.
+DependencyGraph& Table::MutableGraph(){
+    if(graph_.use_count() > 1)
+        graph_ = std::make_shared<DependencyGraph>(*graph_);
+    else
+        std::atomic_thread_fence(std::memory_order_acquire);
+    return *graph_;
 }
 
 // --- Sheet --
 
+namespace {
+
+// Метки владельцев ячеек уникальны среди всех таблиц процесса
+uint64_t NextOwnerToken(){
+    static std::atomic<uint64_t> next_token{1};
+    return next_token.fetch_add(1, std::memory_order_relaxed);
+}
+
+}  // namespace
+
+Sheet::Sheet()
+    : owner_token_(NextOwnerToken()) {}
+
+// Ячейки таблицы освобождаются после тела деструктора и возвращают слоты
+// уже отпущенной арене; последняя из них удаляет арену
+Sheet::~Sheet(){
+    arena_->Release();
+}
+
 CellPtr Sheet::MakeEmptyCell(Position pos){
-    return std::make_shared<Cell>(*this, pos);
+    return Cell::Create(*this, pos);
 }
 
 void Sheet::SetCell(Position pos, std::string text) { 
@@ -57,20 +179,34 @@ void Sheet::SetCell(Position pos, std::string text) {
         throw InvalidPositionException("On SetCell");
     }
 
+    if(batch_){
+        batch_->push_back({pos, std::move(text)});
+        return;
+    }
+
     auto cell = MakeEmptyCell(pos);
 
     cell->Set(std::move(text));
 
-    if(IsCircularDependency(cell))
-        throw CircularDependencyException("circular dependency detected");
-
-    if (table_(pos))
-        table_.DeleteCell(pos);
+    // При цикле бросает исключение, не меняя граф. Ячейка без ссылок на месте такой же
+    // не меняет граф, и граф, разделяемый с копией таблицы, не копируется.
+    auto refs = cell->GetReferencedCells();
+    auto ranges = cell->GetReferencedRanges();
+    std::vector<Position> old_refs;
+    std::vector<Range> old_ranges;
+    if(!table_.cleared_.empty()){
+        old_refs = table_.Graph().GetReferences(pos);
+        old_ranges = table_.Graph().GetReferencedRanges(pos);
+    }
+    if(!refs.empty() || !ranges.empty() || table_.Graph().HasReferences(pos))
+        table_.MutableGraph().SetReferences(pos, refs, ranges);
 
-    InvalidateCacheOfDependants(pos);
-    SetCellConnections(cell);
+    ++epoch_;
+    cell->SetChangedAt(epoch_);
 
+    table_.cleared_.erase(pos);
     table_.SetCell(cell);
+    table_.ReleaseCleared(old_refs, old_ranges);
         
 }
 
@@ -79,7 +215,9 @@ const CellInterface* Sheet::GetCell(Position pos) const {
     if(!pos.IsValid())
         throw InvalidPositionException("On GetCell");
 
-    return table_(pos).get();
+    if(const auto& cell = AdoptCell(pos))
+        return cell.get();
+    return table_.IsReferencedEmpty(pos) ? &empty_cell_ : nullptr;
 }
 
 CellInterface* Sheet::GetCell(Position pos) {
@@ -87,149 +225,449 @@ CellInterface* Sheet::GetCell(Position pos) {
     if(!pos.IsValid())
         throw InvalidPositionException("On GetCell");
 
+    if(const auto& cell = AdoptCell(pos))
+        return cell.get();
+    return table_.IsReferencedEmpty(pos) ? &empty_cell_ : nullptr;
+}
+
+// Кеш чужой ячейки не меняется: его разделяют копии таблицы. Копия ячейки получает
+// проверенное значение вместе с эпохой проверки, поэтому формулы, не зависящие от правок
+// после Fork(), не пересчитываются. Ячейки без формул неизменяемы и не копируются.
+// Своя ячейка, которую копии таблицы уже не разделяют, не копируется, а заменённая
+// своя ячейка остаётся в Table::replaced_: выданные указатели не повисают.
+const CellPtr& Sheet::AdoptCell(Position pos) const {
+
+    const auto& cell = table_(pos);
+    if(!cell || cell->GetOwnerToken() == owner_token_ || !cell->GetFormula())
+        return cell;
+
+    const bool own = cell->IsCreatedBy(*this);
+    if(own && cell.use_count() == 1 && !table_.cells_.IsShared(pos)){
+        std::atomic_thread_fence(std::memory_order_acquire);
+        cell->SetOwnerToken(owner_token_);
+        return cell;
+    }
 
-    return table_(pos).get();
-    
+    auto copy = cell->CopyFor(const_cast<Sheet&>(*this));
+    if(own)
+        table_.replaced_[pos].push_back(cell);
+    table_.cells_.Set(pos, std::move(copy));
+    return table_(pos);
+}
+
+std::unique_ptr<Sheet> Sheet::Fork(){
+
+    auto fork = std::make_unique<Sheet>();
+    fork->table_ = table_;
+    fork->table_.replaced_.clear();
+    fork->epoch_ = epoch_;
+    fork->formula_cache_ = formula_cache_;
+
+    // ячейки, существующие сейчас, становятся общими и больше не меняются
+    owner_token_ = NextOwnerToken();
+    return fork;
 }
 
 void Sheet::ClearCell(Position pos) {
     
     if(!pos.IsValid())
         throw InvalidPositionException("On ClearCell");
-        
+
+    if(batch_){
+        batch_->push_back({pos, std::nullopt});
+        return;
+    }
+
+    ++epoch_;
+
+    std::vector<Position> old_refs;
+    std::vector<Range> old_ranges;
+    if(!table_.cleared_.empty()){
+        old_refs = table_.Graph().GetReferences(pos);
+        old_ranges = table_.Graph().GetReferencedRanges(pos);
+    }
+    const bool existed = table_(pos) != nullptr;
     table_.DeleteCell(pos);
-    InvalidateCacheOfDependants(pos);
-     
+
+    // ячейки больше нет; формулы, которые на неё ссылаются, увидят эпоху очистки
+    if(existed)
+        table_.MarkCleared(pos, epoch_);
+    table_.ReleaseCleared(old_refs, old_ranges);
 }
 
-void Sheet::SetCellConnections(CellPtr cell){
-    SetCellRefs(cell);
-    SetCellDependants(cell);
+void Sheet::BeginBatch(){
+    if(batch_)
+        throw std::logic_error("Batch is already started");
+    batch_.emplace();
 }
- 
-void Sheet::InvalidateCacheOfDependants(Position pos){
 
-    std::function<void (Position)> 
-        go_up = [&](Position pos){
-            for(const auto& dep_pos : table_.cell_to_deps[pos]){
-                table_(dep_pos)->InvalidateCache();
-                if(table_.cell_to_deps.count(dep_pos))
-                    go_up(dep_pos);
-            }        
-        };
+void Sheet::CommitBatch(){
+    if(!batch_)
+        throw std::logic_error("No batch to commit");
 
-    if(table_.cell_to_deps.count(pos))
-        go_up(pos);
-    
+    auto edits = std::move(*batch_);
+    batch_.reset();
+    ApplyEdits(std::move(edits));
+}
+
+void Sheet::RollbackBatch(){
+    batch_.reset();
+}
+
+void Sheet::SetCells(std::vector<std::pair<Position, std::string>> cells){
+
+    std::vector<Edit> edits;
+    edits.reserve(cells.size());
+    for(auto& [pos, text] : cells){
+        if(!pos.IsValid())
+            throw InvalidPositionException("On SetCells");
+        edits.push_back({pos, std::move(text)});
+    }
+    ApplyEdits(std::move(edits));
 }
 
-void Sheet::SetCellRefs(CellPtr cell){
+// Сначала разбираются все формулы, затем у всех правленых ячеек снимаются старые ребра
+// и добавляются новые, так что цикл проверяется только для итогового графа.
+// До этого момента таблица не менялась; при цикле старые ребра восстанавливаются.
+void Sheet::ApplyEdits(std::vector<Edit> edits){
 
-    for(const auto ref_pos : cell->GetReferencedCells()){
+    std::unordered_map<Position, size_t, Table::PHasher> last_edit;
+    for(size_t i = 0; i < edits.size(); ++i)
+        last_edit[edits[i].pos] = i;
 
-        auto ref_cell = table_(ref_pos);
+    std::vector<size_t> unique_edits;
+    unique_edits.reserve(last_edit.size());
+    for(size_t i = 0; i < edits.size(); ++i){
+        if(last_edit.at(edits[i].pos) == i)
+            unique_edits.push_back(i);
+    }
 
-        if(!ref_cell){
-            ref_cell = MakeEmptyCell(ref_pos);
-            table_.SetCell(ref_cell);
+    // формулы пакета независимы, поэтому разбираются на пуле потоков, если он задан
+    std::vector<std::pair<Position, CellPtr>> cells(unique_edits.size());
+    std::vector<std::exception_ptr> errors(unique_edits.size());
+    auto parse = [&](size_t i){
+        auto& edit = edits[unique_edits[i]];
+        cells[i].first = edit.pos;
+        if(!edit.text)
+            return;
+        try{
+            auto cell = MakeEmptyCell(edit.pos);
+            cell->Set(std::move(*edit.text));
+            cells[i].second = std::move(cell);
+        } catch(...){
+            errors[i] = std::current_exception();
         }
+    };
+    if(pool_)
+        pool_->ParallelFor(cells.size(), parse);
+    else
+        for(size_t i = 0; i < cells.size(); ++i)
+            parse(i);
+
+    for(const auto& error : errors){
+        if(error)
+            std::rethrow_exception(error);
+    }
 
-        table_.pos_to_refs[cell->GetPosition()].insert(ref_pos);
+    std::vector<std::vector<Position>> old_refs;
+    std::vector<std::vector<Range>> old_ranges;
+    old_refs.reserve(cells.size());
+    old_ranges.reserve(cells.size());
+    auto& graph = table_.MutableGraph();
+    for(const auto& [pos, cell] : cells){
+        old_refs.push_back(graph.GetReferences(pos));
+        old_ranges.push_back(graph.GetReferencedRanges(pos));
+        graph.RemoveReferences(pos);
     }
 
-}
+    try{
+        for(const auto& [pos, cell] : cells){
+            if(cell)
+                graph.SetReferences(pos, cell->GetReferencedCells(),
+                                    cell->GetReferencedRanges());
+        }
+    } catch(const CircularDependencyException&){
+        for(const auto& [pos, cell] : cells)
+            graph.RemoveReferences(pos);
+        for(size_t i = 0; i < cells.size(); ++i)
+            graph.SetReferences(cells[i].first, old_refs[i], old_ranges[i]);
+        throw;
+    }
+
+    ++epoch_;
 
-void Sheet::SetCellDependants(CellPtr cell){
-    for(const auto ref_pos : cell->GetReferencedCells()){
-        table_.cell_to_deps[ref_pos].insert(cell->GetPosition());
+    for(const auto& [pos, cell] : cells){
+        if(cell){
+            cell->SetChangedAt(epoch_);
+            table_.cleared_.erase(pos);
+            table_.SetCell(cell);
+        } else if(table_(pos)){
+            table_.EraseCell(pos);
+            table_.MarkCleared(pos, epoch_);
+        }
+    }
+    if(!table_.cleared_.empty()){
+        for(size_t i = 0; i < cells.size(); ++i)
+            table_.ReleaseCleared(old_refs[i], old_ranges[i]);
     }
 }
 
-bool Sheet::IsCircularDependency(CellPtr cell){
+template <typename Func>
+void Sheet::ForEachInput(Position pos, Func&& func) const {
 
-    std::function<bool (Position, const std::vector<Position>&)> 
-        go_up = [&](Position pos, const std::vector<Position>& pos_to_find){
+    table_.Graph().ForEachReference(pos, func);
+    table_.Graph().ForEachReferencedRange(pos, [this, &func](const Range& range){
+        table_.cells_.ForEachInRange(range, [&func](Position cell_pos, const CellPtr&){
+            func(cell_pos);
+        });
+        table_.ForEachClearedInRange(range, func);
+    });
+}
 
-        auto it = table_.cell_to_deps.find(pos);
+// Формула пересчитывается, только если после её последней проверки изменилась
+// хотя бы одна ссылка; иначе кеш подтверждается в текущей эпохе. Если пересчитанное
+// значение совпало с прежним, эпоха изменения ячейки остаётся старой и зависимые
+// ячейки только подтверждают свой кеш (ранняя отсечка)
+void Sheet::VerifyCell(Position pos) const {
+
+    const auto& cell = AdoptCell(pos);
+    const uint64_t verified_at = cell->GetVerifiedAt();
+
+    bool refs_changed = verified_at == 0;
+    ForEachInput(pos, [this, verified_at, &refs_changed](Position ref_pos){
+        refs_changed = refs_changed || table_.GetChangedAt(ref_pos) > verified_at;
+    });
+
+    if(refs_changed){
+        if(cell->Recalculate())
+            cell->SetChangedAt(epoch_);
+    } else {
+        cell->MarkVerified();
+    }
+}
 
-        if(it != table_.cell_to_deps.end()){
+void Sheet::Recalculate(Position pos) const {
 
-            if(it->second.empty()){
-                table_.cell_to_deps.erase(it);
-                return false;
-            }
+    const auto& cell = table_(pos);
+    if(!cell || cell->IsCacheValid(epoch_))
+        return;
+    RecalculateCells({pos});
+}
 
-            for(const auto dep_pos : it->second){
+// Обход в глубину с явным стеком по непроверенным ячейкам positions и тем, от которых
+// они зависят. Ячейка проверяется после всех своих непроверенных ссылок.
+void Sheet::RecalculateCells(const std::vector<Position>& positions) const {
 
-                auto predicate = [&dep_pos](const Position& lhs){ return lhs == dep_pos;};
+    std::vector<Position> order;
+    std::unordered_set<Position, Table::PHasher> visited;
+    std::vector<std::pair<Position, bool>> stack;
+    stack.reserve(positions.size());
+    for(const auto pos : positions)
+        stack.push_back({pos, false});
 
-                if (std::any_of(pos_to_find.begin(), pos_to_find.end(), predicate))
-                    return true;
-                return go_up(dep_pos, pos_to_find);
-            }
+    while(!stack.empty()){
+
+        auto [current, refs_pushed] = stack.back();
+
+        if(refs_pushed){
+            stack.pop_back();
+            order.push_back(current);
+            continue;
         }
-        return false;
-    };
+        // ячейка могла попасть в стек несколько раз: обходится первое вхождение
+        if(!visited.insert(current).second){
+            stack.pop_back();
+            continue;
+        }
+        stack.back().second = true;
 
-    for(const auto& ref_pos : cell->GetReferencedCells()){
+        ForEachInput(current, [&](Position ref_pos){
+            const auto& ref_cell = table_(ref_pos);
+            if(ref_cell && !ref_cell->IsCacheValid(epoch_) && !visited.count(ref_pos))
+                stack.push_back({ref_pos, false});
+        });
+    }
+
+    for(const auto order_pos : order)
+        VerifyCell(order_pos);
+}
 
-        if(ref_pos == cell->GetPosition())
-            return true;
+std::shared_ptr<const SheetSnapshot> Sheet::Snapshot() const{
+    std::unordered_set<Position, Table::PHasher> cleared;
+    for(const auto& [pos, epoch] : table_.cleared_)
+        cleared.insert(pos);
+    return std::make_shared<SheetSnapshot>(table_.cells_, epoch_, GetPrintableSize(),
+                                           std::move(cleared));
+}
+
+void Sheet::SetRecalculationThreads(size_t thread_count){
+    if(thread_count <= 1)
+        pool_.reset();
+    else if(!pool_ || pool_->GetThreadCount() != thread_count)
+        pool_ = std::make_unique<ThreadPool>(thread_count);
+}
+
+// Алгоритм Кана на подграфе непроверенных формул, по уровням: ячейки уровня зависят
+// только от проверенных ячеек и от предыдущих уровней, поэтому проверяются независимо
+// и могут считаться параллельно. Результат не зависит от числа потоков.
+void Sheet::Recalculate() const {
+
+    std::vector<Position> stale;
+    table_.cells_.ForEach([this, &stale](Position pos, const CellPtr& cell){
+        if(!cell->IsCacheValid(epoch_))
+            stale.push_back(pos);
+    });
+
+    std::unordered_map<Position, int, Table::PHasher> pending_refs;
+    std::vector<Position> level;
+    // чужие ячейки заменяются копиями до параллельного пересчёта, который их читает
+    std::vector<Position> foreign;
+
+    for(const auto pos : stale){
+        AdoptCell(pos);
+        int count = 0;
+        ForEachInput(pos, [this, &count, &foreign](Position ref_pos){
+            const auto& ref_cell = table_(ref_pos);
+            if(!ref_cell)
+                return;
+            if(!ref_cell->IsCacheValid(epoch_))
+                ++count;
+            else if(ref_cell->GetOwnerToken() != owner_token_ && ref_cell->GetFormula())
+                foreign.push_back(ref_pos);
+        });
+        if(count == 0)
+            level.push_back(pos);
+        else
+            pending_refs[pos] = count;
     }
+    for(const auto pos : foreign)
+        AdoptCell(pos);
 
-    return go_up(cell->GetPosition(), cell->GetReferencedCells());
+    std::vector<Position> next_level;
+    while(!level.empty()){
 
+        auto recalculate = [this, &level](size_t i){
+            VerifyCell(level[i]);
+        };
+        if(pool_)
+            pool_->ParallelFor(level.size(), recalculate);
+        else
+            for(size_t i = 0; i < level.size(); ++i)
+                recalculate(i);
+
+        next_level.clear();
+        for(const auto pos : level){
+            table_.Graph().ForEachDependant(pos, [&](Position dep_pos){
+                auto pending = pending_refs.find(dep_pos);
+                if(pending != pending_refs.end() && --pending->second == 0)
+                    next_level.push_back(dep_pos);
+            });
+        }
+        std::swap(level, next_level);
+    }
 }
 
 Size Sheet::GetPrintableSize() const {
-    
-    Size result{ 0, 0 };
-    
-    for (auto it = table_.cells_.begin(); it != table_.cells_.end(); ++it) {
-        if (it->second != nullptr) {
-            const int c = it->first.col;
-            const int r = it->first.row;
-            result.rows = std::max(result.rows, r + 1);
-            result.cols = std::max(result.cols, c + 1);
-        }
+    return table_.area_.GetSize();
+}
+
+void Sheet::GetCellsInRange(const Range& range,
+                            std::vector<const CellInterface*>& cells) const {
+    cells.clear();
+    std::vector<Position> foreign;
+    table_.cells_.ForEachInRange(range, [this, &cells, &foreign](Position pos, const CellPtr& cell){
+        if(cell->GetOwnerToken() != owner_token_ && cell->GetFormula())
+            foreign.push_back(pos);
+        cells.push_back(cell.get());
+    });
+    // копии чужих формул кладутся в блоки только после обхода
+    if(!foreign.empty()){
+        cells.clear();
+        for(const auto pos : foreign)
+            AdoptCell(pos);
+        table_.cells_.ForEachInRange(range, [&cells](Position, const CellPtr& cell){
+            cells.push_back(cell.get());
+        });
     }
-    return result;
 }
 
+// Печать обходит только занятые ячейки: пустые клетки между ними - одни разделители.
+// Формулы считаются заранее одним пересчётом, а не по одной при печати.
 void Sheet::PrintValues(std::ostream& output) const {
-    
-    Size size = GetPrintableSize();
-    for (int r = 0; r < size.rows; ++r) {
-
-        for (int c = 0; c < size.cols; ++c) {
-            if (c > 0) {
-                output << "\t";
-            }
-            const auto& it = table_.cells_.find({ r, c });
-            if (it != table_.cells_.end() && it->second && !it->second->GetText().empty()) {
-                std::visit([&](const auto value) {output << value; }, it->second->GetValue());
-            }
-        }
-        output << "\n";
-    }
+
+    Recalculate();
+    // свежие значения чужих формул уже в кеше, но читать кеш должна своя копия
+    std::vector<Position> foreign;
+    table_.cells_.ForEach([this, &foreign](Position pos, const CellPtr& cell){
+        if(cell->GetOwnerToken() != owner_token_ && cell->GetFormula())
+            foreign.push_back(pos);
+    });
+    for(const auto pos : foreign)
+        AdoptCell(pos);
+
+    PrintBuffer buffer(output);
+    PrintRows(table_.cells_, GetPrintableSize(), buffer, [&buffer](Position, const CellPtr& cell){
+        PrintCellValue(*cell, *cell, buffer);
+    });
 }
             
 void Sheet::PrintTexts(std::ostream& output) const {
    
-    Size size = GetPrintableSize();
-    for (int r = 0; r < size.rows; ++r) {
-
-        for (int c = 0; c < size.cols; ++c) {
-            if (c > 0) {
-                output << "\t";
-            }
-            const auto& it = table_.cells_.find({ r, c });
-            if (it != table_.cells_.end() && it->second && !it->second->GetText().empty()) {
-                output << it->second->GetText();
-            }
-        }
-        output << "\n";
-    }
+    PrintBuffer buffer(output);
+    PrintRows(table_.cells_, GetPrintableSize(), buffer, [&buffer](Position, const CellPtr& cell){
+        PrintCellText(*cell, buffer);
+    });
+}
+
+void Sheet::PrepareRange(const Range& range) const {
+
+    if(!range.IsValid())
+        throw InvalidPositionException("On range access");
+
+    std::vector<Position> stale;
+    std::vector<Position> foreign;
+    table_.cells_.ForEachInRange(range, [this, &stale, &foreign](Position pos, const CellPtr& cell){
+        if(!cell->IsCacheValid(epoch_))
+            stale.push_back(pos);
+        else if(cell->GetOwnerToken() != owner_token_ && cell->GetFormula())
+            foreign.push_back(pos);
+    });
+    RecalculateCells(stale);
+    for(const auto pos : foreign)
+        AdoptCell(pos);
+}
+
+// Обходятся только занятые ячейки диапазона; считаются только его формулы
+// и то, от чего они зависят
+void Sheet::PrintValues(std::ostream& output, const Range& range) const {
+
+    PrepareRange(range);
+    PrintBuffer buffer(output);
+    PrintRows(table_.cells_, range, buffer, [&buffer](Position, const CellPtr& cell){
+        PrintCellValue(*cell, *cell, buffer);
+    });
+}
+
+void Sheet::PrintTexts(std::ostream& output, const Range& range) const {
+
+    if(!range.IsValid())
+        throw InvalidPositionException("On range access");
+
+    PrintBuffer buffer(output);
+    PrintRows(table_.cells_, range, buffer, [&buffer](Position, const CellPtr& cell){
+        PrintCellText(*cell, buffer);
+    });
+}
+
+void Sheet::GetValuesInRange(const Range& range,
+                             std::vector<std::pair<Position, CellInterface::Value>>& values) const {
+
+    PrepareRange(range);
+    values.clear();
+    table_.cells_.ForEachInRange(range, [&values](Position pos, const CellPtr& cell){
+        if(cell->GetFormula() || !cell->GetPlainText().empty())
+            values.emplace_back(pos, cell->GetValue());
+    });
 }
 
 std::unique_ptr<SheetInterface> CreateSheet() {
@@ -1,42 +1,93 @@
 #pragma once
 
 #include <functional>
+#include <optional>
 #include <vector>
 #include <unordered_map>
+#include <unordered_set>
 #include "cell.h"
 #include "common.h"
+#include "dependency_graph.h"
+#include "thread_pool.h"
+#include "tile_grid.h"
 
-using CellPtr = std::shared_ptr<Cell>;
+class SheetSnapshot;
+
+// Область печати: число ячеек с непустым текстом в каждой строке и в каждом столбце.
+// Размер читается за O(1); при удалении крайней ячейки граница сдвигается
+// к ближайшей непустой строке или столбцу.
+class PrintableArea {
+public:
+    void Add(Position pos);
+    void Remove(Position pos);
+
+    Size GetSize() const { return size_; }
+
+private:
+    std::vector<int> row_counts_;
+    std::vector<int> col_counts_;
+    Size size_;
+
+    static void Add(std::vector<int>& counts, int index, int& bound);
+    static void Remove(std::vector<int>& counts, int index, int& bound);
+};
 
 struct Table{
 
-    CellPtr operator()(Position pos);
-    const CellPtr operator()(Position pos) const;
+    const CellPtr& operator()(Position pos) const;
 
-    inline void SetCell(CellPtr cell);
+    // Все замены ячеек с другим содержимым идут через SetCell и EraseCell:
+    // они поддерживают область печати
+    void SetCell(CellPtr cell);
 
     inline void DeleteCell(Position pos);
+    void EraseCell(Position pos);
 
     inline void RemoveCellConnections(Position pos);
 
-    struct PHasher {
-        size_t operator()(const Position& p) const {
-            return std::hash<size_t>()(
-                (static_cast<size_t>(p.row) << 32) | static_cast<size_t>(p.col)
-                );
-        }
-    };
+    // Эпоха последнего изменения позиции: ячейки, очистки ячейки или 0
+    uint64_t GetChangedAt(Position pos) const;
+    // Пустая позиция, на которую ссылается формула или которая очищена при живых
+    // зависимых формулах
+    bool IsReferencedEmpty(Position pos) const;
+    // Запоминает очистку pos, если на неё ссылаются формулы
+    void MarkCleared(Position pos, uint64_t epoch);
+    // Забывает очистки позиций refs и ranges, на которые больше не ссылаются формулы
+    void ReleaseCleared(const std::vector<Position>& refs, const std::vector<Range>& ranges);
+    // func(Position) для каждой очищенной позиции диапазона
+    template <typename Func>
+    void ForEachClearedInRange(const Range& range, Func&& func) const;
+
+    // Граф разделяется копиями таблицы (Sheet::Fork) и копируется перед первым изменением
+    const DependencyGraph& Graph() const { return *graph_; }
+    DependencyGraph& MutableGraph();
+
+    using PHasher = DependencyGraph::PositionHasher;
+
+    // Ячейки формул, унаследованные при Sheet::Fork(), заменяются своими копиями
+    // и при чтении, поэтому хранилище изменяемо и в константных методах
+    mutable TileGrid<CellPtr> cells_;
+
+    std::shared_ptr<DependencyGraph> graph_ = std::make_shared<DependencyGraph>();
 
-    std::unordered_map<Position, CellPtr, PHasher> cells_;
+    PrintableArea area_;
 
-    std::unordered_map<Position, std::set<Position>, PHasher> pos_to_refs;
-    std::unordered_map<Position, std::set<Position>, PHasher> cell_to_deps;
+    // Ячейки формул этой таблицы, заменённые копиями после Sheet::Fork(), пока копия таблицы
+    // их разделяет: указатель на ячейку, выданный до Fork(), действителен до правки позиции.
+    // Копиям таблицы не передаются.
+    mutable std::unordered_map<Position, std::vector<CellPtr>, PHasher> replaced_;
+
+    // Ячейки на месте пустых позиций, на которые ссылаются формулы, не хранятся: такие
+    // ссылки есть только в графе. Очищенная позиция, на которую ссылаются формулы,
+    // хранит здесь эпоху очистки, чтобы зависимые формулы увидели изменение.
+    std::unordered_map<Position, uint64_t, PHasher> cleared_;
 
 };
 
 class Sheet : public SheetInterface {
 public:
-    ~Sheet(){};
+    Sheet();
+    ~Sheet();
 
     void SetCell(Position pos, std::string text) override;
 
@@ -49,18 +100,109 @@ public:
 
     void PrintValues(std::ostream& output) const override;
     void PrintTexts(std::ostream& output) const override;
+    void PrintValues(std::ostream& output, const Range& range) const override;
+    void PrintTexts(std::ostream& output, const Range& range) const override;
+
+    void GetValuesInRange(const Range& range,
+                          std::vector<std::pair<Position, CellInterface::Value>>& values) const override;
+    void GetCellsInRange(const Range& range,
+                         std::vector<const CellInterface*>& cells) const override;
+
+    // Правки между BeginBatch и CommitBatch только запоминаются: до CommitBatch
+    // таблица не меняется. CommitBatch разбирает все формулы, обновляет граф
+    // и эпоху за один проход; при ошибке разбора или цикле бросает исключение,
+    // и таблица остаётся в состоянии до BeginBatch.
+    void BeginBatch();
+    void CommitBatch();
+    void RollbackBatch();
+    bool IsInBatch() const { return batch_.has_value(); }
+
+    // Применяет правки атомарно, как один пакет; для повторной позиции действует последняя
+    void SetCells(std::vector<std::pair<Position, std::string>> cells);
+
+    // Номер текущей правки: растёт при каждом изменении таблицы
+    uint64_t GetEpoch() const { return epoch_; }
+
+    // Программы формул, общие для ячеек одной формы; общий для таблицы и её копий
+    FormulaCache& GetFormulaCache() { return *formula_cache_; }
+    const FormulaCache& GetFormulaCache() const { return *formula_cache_; }
+
+    // Копия таблицы для сценария "что если": ячейки, граф и проверенные значения формул
+    // разделяются с исходной таблицей, пока одна из них их не изменит. Стоит копирования
+    // каталога блоков ячеек. Копия пересчитывает только формулы, зависящие от её правок.
+    // Указатели на ячейки, полученные до Fork(), действительны до правки их позиций.
+    // Правки пакета, не применённые CommitBatch, в копию не попадают.
+    std::unique_ptr<Sheet> Fork();
+
+    // Метка ячеек, кеш которых таблица может менять (см. Cell::GetOwnerToken)
+    uint64_t GetOwnerToken() const { return owner_token_; }
+
+    // Память ячеек таблицы, их содержимого и формул. Ячейки, которые разделяются
+    // с копиями и снимками таблицы, держат арену и после удаления таблицы
+    CellArena& GetCellArena() const { return *arena_; }
+
+    // Число очищенных позиций, на которые ещё ссылаются формулы (см. Table::cleared_)
+    size_t GetClearedCount() const { return table_.cleared_.size(); }
+
+    // Неизменяемая версия таблицы для чтения из других потоков, пока таблица меняется.
+    // Стоит копирования каталога блоков ячеек; правки пакета, не применённые
+    // CommitBatch, в снимок не попадают.
+    std::shared_ptr<const SheetSnapshot> Snapshot() const;
+
+    // Проверяет все формулы в топологическом порядке, каждую один раз, и пересчитывает
+    // те, у которых изменилась хотя бы одна ссылка.
+    // Независимые формулы одного уровня считаются на пуле потоков, если он задан.
+    void Recalculate() const;
+    // 0 или 1 - пересчёт в вызывающем потоке
+    void SetRecalculationThreads(size_t thread_count);
+    // Проверяет формулу в pos и всё, от чего она зависит, без рекурсии
+    void Recalculate(Position pos) const;
 
 private:
+    friend class SheetFile;
+    friend class SheetImporter;
+
     Table table_;
 
-    CellPtr MakeEmptyCell(Position pos);
+    // Правка таблицы только увеличивает эпоху и помечает изменённую ячейку;
+    // кеш формулы проверяется лениво по эпохам изменения её ссылок
+    uint64_t epoch_ = 1;
+
+    std::unique_ptr<ThreadPool> pool_;
+
+    std::shared_ptr<FormulaCache> formula_cache_ = std::make_shared<FormulaCache>();
+
+    uint64_t owner_token_;
 
-    void SetCellConnections(CellPtr cell);
+    // Объявлена перед empty_cell_, которая в ней создаётся
+    CellArena* arena_ = CellArena::Create();
 
-    void InvalidateCacheOfDependants(Position pos);
+    // Пустая позиция, на которую ссылаются формулы, видна через GetCell как эта ячейка
+    // (см. Table::IsReferencedEmpty)
+    Cell empty_cell_{*this};
 
-    void SetCellRefs(CellPtr cell);
+    // Текст ячейки; пустое значение - очистка ячейки
+    struct Edit {
+        Position pos;
+        std::optional<std::string> text;
+    };
+    std::optional<std::vector<Edit>> batch_;
+
+    void ApplyEdits(std::vector<Edit> edits);
+
+    void VerifyCell(Position pos) const;
+    // Проверяет формулы positions и всё, от чего они зависят, одним обходом
+    void RecalculateCells(const std::vector<Position>& positions) const;
+    // Готовит формулы диапазона к чтению: проверяет их кеш и заменяет чужие ячейки своими
+    void PrepareRange(const Range& range) const;
+
+    // func(Position) для каждой позиции, от которой зависит формула в pos: прямые
+    // ссылки, существующие ячейки её диапазонов и очищенные позиции в них
+    template <typename Func>
+    void ForEachInput(Position pos, Func&& func) const;
+
+    CellPtr MakeEmptyCell(Position pos);
 
-    void SetCellDependants(CellPtr cell);
-    bool IsCircularDependency(CellPtr cell);
+    // Ячейка в pos; чужая ячейка формулы сначала заменяется своей копией
+    const CellPtr& AdoptCell(Position pos) const;
 };
\ No newline at end of file
@@ -0,0 +1,402 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include <utility>
+
+#include "FormulaAST.h"
+#include "cell.h"
+#include "sheet.h"
+#include "sheet_file.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SPREADSHEET_HAS_MMAP
+#endif
+
+namespace {
+
+constexpr char MAGIC[8] = {'S', 'P', 'S', 'H', 'E', 'E', 'T', '\0'};
+constexpr uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+// Заголовок одинаков во всех версиях; части лежат по смещениям от начала файла
+struct FileHeader {
+    char magic[8];
+    uint32_t byte_order;
+    uint32_t version;
+    uint64_t cell_count;
+    uint64_t texts_offset;
+    uint64_t texts_size;
+    uint64_t data_offset;
+    uint64_t data_size;
+};
+
+// Ячейка в данных; позиция и текст берутся из записи с тем же номером в текстах
+struct CellRecord {
+    enum Kind : uint8_t {
+        EMPTY,
+        TEXT,
+        NUMBER,
+        FORMULA,
+    };
+
+    uint8_t kind;
+    // у формулы сохранено вычисленное значение
+    uint8_t has_value;
+    uint16_t reserved;
+    // номер шаблона формулы
+    uint32_t program;
+    Position anchor;
+    // число ячейки или значение формулы; ошибка упакована в NaN (см. MakeErrorValue)
+    double value;
+};
+
+// Файл, отображённый в память только для чтения. Без mmap читается целиком.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path) {
+#ifdef SPREADSHEET_HAS_MMAP
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw SheetFileError("Cannot open " + path);
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            close(fd);
+            throw SheetFileError("Cannot read " + path);
+        }
+        size_ = static_cast<size_t>(info.st_size);
+        if (size_ > 0) {
+            void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) {
+                close(fd);
+                throw SheetFileError("Cannot map " + path);
+            }
+            madvise(data, size_, MADV_SEQUENTIAL);
+            data_ = static_cast<const char*>(data);
+        }
+        close(fd);
+#else
+        std::ifstream input(path, std::ios::binary);
+        if (!input) {
+            throw SheetFileError("Cannot open " + path);
+        }
+        buffer_.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+        data_ = buffer_.data();
+        size_ = buffer_.size();
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+#ifdef SPREADSHEET_HAS_MMAP
+        if (data_) {
+            munmap(const_cast<char*>(data_), size_);
+        }
+#endif
+    }
+
+    const char* Data() const { return data_; }
+    size_t Size() const { return size_; }
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+#ifndef SPREADSHEET_HAS_MMAP
+    std::vector<char> buffer_;
+#endif
+};
+
+double EncodeFormulaValue(const CellInterface::Value& value) {
+    if (const auto* error = std::get_if<FormulaError>(&value)) {
+        return MakeErrorValue(error->GetCategory());
+    }
+    return std::get<double>(value);
+}
+
+CellInterface::Value DecodeFormulaValue(double value) {
+    if (IsErrorValue(value)) {
+        return GetErrorValue(value);
+    }
+    return value;
+}
+
+// Запись текстов: позиция и текст ячейки
+struct TextRecord {
+    Position pos;
+    std::string_view text;
+};
+
+TextRecord ReadTextRecord(BinaryReader& reader) {
+    TextRecord record;
+    record.pos = reader.Read<Position>();
+    record.text = reader.ReadString();
+    if (!record.pos.IsValid()) {
+        throw SheetFileError("Cell position is out of sheet bounds");
+    }
+    return record;
+}
+
+}  // namespace
+
+void SheetFile::Save(const Sheet& sheet, const std::string& path, bool with_values) {
+
+    if (with_values) {
+        sheet.Recalculate();
+    }
+
+    // ячейки берутся через GetCell: общие с копиями таблицы формулы заменяются своими
+    std::vector<Position> positions;
+    sheet.table_.cells_.ForEach([&positions](Position pos, const CellPtr&) {
+        positions.push_back(pos);
+    });
+
+    BinaryWriter texts;
+    std::vector<CellRecord> records;
+    records.reserve(positions.size());
+    std::vector<FormulaProgram> programs;
+    std::unordered_map<const FormulaAST*, uint32_t> program_ids;
+
+    for (const auto pos : positions) {
+        const auto* cell = static_cast<const Cell*>(sheet.GetCell(pos));
+        const std::string text = cell->GetText();
+        texts.Write(pos);
+        texts.WriteString(text);
+
+        CellRecord record{};
+        if (const auto* formula = cell->GetFormula()) {
+            auto program = GetFormulaProgram(*formula);
+            const auto [it, inserted] = program_ids.emplace(
+                program.ast.get(), static_cast<uint32_t>(programs.size()));
+            record.kind = CellRecord::FORMULA;
+            record.program = it->second;
+            record.anchor = program.anchor;
+            if (inserted) {
+                programs.push_back(std::move(program));
+            }
+            if (with_values && cell->IsCacheValid(sheet.GetEpoch())) {
+                record.has_value = true;
+                record.value = EncodeFormulaValue(cell->GetValue());
+            }
+        } else if (const auto number = cell->GetNumber()) {
+            record.kind = CellRecord::NUMBER;
+            record.value = *number;
+        } else {
+            record.kind = text.empty() ? CellRecord::EMPTY : CellRecord::TEXT;
+        }
+        records.push_back(record);
+    }
+    texts.Align(alignof(uint64_t));
+
+    BinaryWriter data;
+    data.Write(static_cast<uint32_t>(programs.size()));
+    for (const auto& program : programs) {
+        std::ostringstream expression;
+        program.ast->PrintFormula(expression, program.anchor);
+        data.Write(program.anchor);
+        data.WriteString(expression.str());
+    }
+    data.Align(alignof(uint64_t));
+    data.WriteArray(records);
+    sheet.table_.Graph().Save(data);
+
+    FileHeader header{};
+    std::copy(std::begin(MAGIC), std::end(MAGIC), header.magic);
+    header.byte_order = BYTE_ORDER_MARK;
+    header.version = VERSION;
+    header.cell_count = records.size();
+    header.texts_offset = sizeof(FileHeader);
+    header.texts_size = texts.GetBuffer().size();
+    header.data_offset = header.texts_offset + header.texts_size;
+    header.data_size = data.GetBuffer().size();
+
+    std::ofstream output(path, std::ios::binary | std::ios::trunc);
+    output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    output.write(texts.GetBuffer().data(), texts.GetBuffer().size());
+    output.write(data.GetBuffer().data(), data.GetBuffer().size());
+    if (!output) {
+        throw SheetFileError("Cannot write " + path);
+    }
+}
+
+SheetFile::Loaded SheetFile::Load(const std::string& path) {
+
+    const MappedFile file(path);
+
+    FileHeader header;
+    if (file.Size() < sizeof(header)) {
+        throw SheetFileError("Not a sheet file: " + path);
+    }
+    std::memcpy(&header, file.Data(), sizeof(header));
+    if (!std::equal(std::begin(MAGIC), std::end(MAGIC), header.magic)) {
+        throw SheetFileError("Not a sheet file: " + path);
+    }
+    if (header.byte_order != BYTE_ORDER_MARK) {
+        throw SheetFileError("Sheet file has a different byte order: " + path);
+    }
+    if (header.texts_offset > file.Size()
+        || header.texts_size > file.Size() - header.texts_offset) {
+        throw SheetFileError("Sheet file is truncated: " + path);
+    }
+    const char* texts = file.Data() + header.texts_offset;
+
+    const bool has_data = header.data_offset <= file.Size()
+        && header.data_size <= file.Size() - header.data_offset;
+    if (header.version == VERSION && has_data) {
+        try {
+            return {LoadData(texts, header.texts_size, file.Data() + header.data_offset,
+                             header.data_size, header.cell_count),
+                    LoadMode::Mapped};
+        } catch (const SheetFileError&) {
+        } catch (const FormulaException&) {
+        } catch (const ParsingError&) {
+        }
+    }
+    return {Rebuild(texts, header.texts_size, header.cell_count), LoadMode::Rebuilt};
+}
+
+std::unique_ptr<Sheet> SheetFile::LoadData(const char* texts, size_t texts_size,
+                                           const char* data, size_t data_size,
+                                           uint64_t cell_count) {
+
+    BinaryReader text_reader(texts, texts_size);
+    BinaryReader reader(data, data_size);
+    auto sheet = std::make_unique<Sheet>();
+
+    // каждый шаблон разбирается один раз, ячейки только ссылаются на него
+    const auto program_count = reader.Read<uint32_t>();
+    std::vector<std::shared_ptr<const FormulaAST>> programs;
+    programs.reserve(program_count);
+    for (uint32_t i = 0; i < program_count; ++i) {
+        const auto anchor = reader.Read<Position>();
+        const auto expression = reader.ReadString();
+        if (!anchor.IsValid()) {
+            throw SheetFileError("Formula anchor is out of sheet bounds");
+        }
+        programs.push_back(std::make_shared<const FormulaAST>(
+            ParseFormulaAST(std::string(expression), anchor)));
+    }
+    reader.Align(alignof(uint64_t));
+
+    const auto record_count = reader.Read<uint64_t>();
+    if (record_count != cell_count
+        || record_count > (data_size / sizeof(CellRecord))) {
+        throw SheetFileError("Cell records do not match cell texts");
+    }
+    const char* records = reader.Take(record_count * sizeof(CellRecord));
+
+    const uint64_t epoch = sheet->GetEpoch();
+    std::vector<Position> formulas;
+    for (uint64_t i = 0; i < record_count; ++i) {
+        const auto text = ReadTextRecord(text_reader);
+        CellRecord record;
+        std::memcpy(&record, records + i * sizeof(CellRecord), sizeof(CellRecord));
+
+        auto cell = Cell::Create(*sheet, text.pos);
+        switch (record.kind) {
+            case CellRecord::EMPTY:
+                break;
+            case CellRecord::TEXT:
+                cell->SetText(std::string(text.text), std::nullopt);
+                break;
+            case CellRecord::NUMBER:
+                cell->SetText(std::string(text.text), record.value);
+                break;
+            case CellRecord::FORMULA: {
+                if (record.program >= programs.size()) {
+                    throw SheetFileError("Formula template is out of range");
+                }
+                // ссылки формулы отсчитываются от якоря: за границами таблицы они переполнятся
+                if (!record.anchor.IsValid()) {
+                    throw SheetFileError("Formula anchor is out of sheet bounds");
+                }
+                std::optional<CellInterface::Value> value;
+                if (record.has_value) {
+                    value = DecodeFormulaValue(record.value);
+                }
+                cell->SetFormula({programs[record.program], record.anchor}, std::move(value));
+                formulas.push_back(text.pos);
+                break;
+            }
+            default:
+                throw SheetFileError("Unknown cell kind");
+        }
+        cell->SetChangedAt(epoch);
+        sheet->table_.SetCell(std::move(cell));
+    }
+
+    sheet->table_.graph_ = std::make_shared<DependencyGraph>(DependencyGraph::Load(reader));
+    CheckGraph(*sheet, formulas);
+    text_reader.Align(alignof(uint64_t));
+    if (!reader.AtEnd() || !text_reader.AtEnd()) {
+        throw SheetFileError("Sheet file has trailing data");
+    }
+    return sheet;
+}
+
+// Граф из файла должен совпадать со ссылками формул, восстановленных из программ:
+// иначе правки не доходили бы до зависимых ячеек, а цикл остался бы незамеченным
+void SheetFile::CheckGraph(const Sheet& sheet, const std::vector<Position>& formulas) {
+
+    const auto& graph = sheet.table_.Graph();
+    size_t edge_count = 0;
+    // буферы общие для всех формул: проверка не выделяет память на каждую ячейку
+    std::vector<Position> refs;
+    std::vector<Range> ranges;
+    for (const Position pos : formulas) {
+        const auto& cell = sheet.table_(pos);
+        refs.clear();
+        graph.ForEachReference(pos, [&refs](Position ref) { refs.push_back(ref); });
+        std::sort(refs.begin(), refs.end());
+        if (refs != cell->GetReferencedCells()) {
+            throw SheetFileError("Dependency graph does not match formulas");
+        }
+        // у большинства формул нет диапазонов: лишний диапазон в графе заметит общий счёт рёбер
+        const auto cell_ranges = cell->GetReferencedRanges();
+        if (!cell_ranges.empty()) {
+            ranges.clear();
+            graph.ForEachReferencedRange(pos, [&ranges](const Range& range) {
+                ranges.push_back(range);
+            });
+            std::sort(ranges.begin(), ranges.end());
+            if (ranges != cell_ranges) {
+                throw SheetFileError("Dependency graph does not match formulas");
+            }
+        }
+        edge_count += refs.size() + cell_ranges.size();
+    }
+    // рёбра ячеек без формул и диапазоны формул без диапазонов
+    if (edge_count != graph.GetEdgeCount()) {
+        throw SheetFileError("Dependency graph does not match formulas");
+    }
+}
+
+// Медленный путь: все тексты применяются одним пакетом, формулы разбираются заново
+std::unique_ptr<Sheet> SheetFile::Rebuild(const char* texts, size_t texts_size,
+                                          uint64_t cell_count) {
+
+    BinaryReader reader(texts, texts_size);
+    std::vector<std::pair<Position, std::string>> cells;
+    for (uint64_t i = 0; i < cell_count; ++i) {
+        const auto record = ReadTextRecord(reader);
+        if (!record.text.empty()) {
+            cells.emplace_back(record.pos, std::string(record.text));
+        }
+    }
+
+    auto sheet = std::make_unique<Sheet>();
+    try {
+        sheet->SetCells(std::move(cells));
+    } catch (const FormulaException& e) {
+        throw SheetFileError(std::string("Cannot rebuild sheet: ") + e.what());
+    } catch (const CircularDependencyException& e) {
+        throw SheetFileError(std::string("Cannot rebuild sheet: ") + e.what());
+    }
+    return sheet;
+}
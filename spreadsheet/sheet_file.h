@@ -0,0 +1,147 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "common.h"
+
+class Sheet;
+
+// Файл повреждён или не является сохранённой таблицей
+class SheetFileError : public std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+// Двоичный файл таблицы. Состоит из заголовка и двух частей:
+// * тексты: позиция и текст каждой ячейки. Формат этой части не меняется между
+//   версиями, по ней таблицу всегда можно собрать заново через SetCells;
+// * данные: ячейки без текста формул, шаблоны формул, граф зависимостей и, если
+//   сохранены, вычисленные значения формул. Формат зависит от версии.
+// Файл загружается отображением в память (mmap): формулы разбираются по одному
+// разу на шаблон, граф и значения копируются массивами без пересчёта. Если версия
+// данных не совпадает с текущей или данные не проходят проверку, таблица собирается
+// из текстов. Числа записываются в порядке байтов машины, сохранившей файл.
+class SheetFile {
+public:
+    static constexpr uint32_t VERSION = 1;
+
+    enum class LoadMode {
+        Mapped,   // загружена из данных
+        Rebuilt,  // собрана из текстов
+    };
+
+    struct Loaded {
+        std::unique_ptr<Sheet> sheet;
+        LoadMode mode;
+    };
+
+    // Правки пакета, не применённые CommitBatch, не сохраняются. С with_values
+    // формулы перед сохранением пересчитываются и загружаются уже вычисленными.
+    static void Save(const Sheet& sheet, const std::string& path, bool with_values = true);
+    // Бросает SheetFileError, если файл нельзя прочитать даже как тексты ячеек
+    static Loaded Load(const std::string& path);
+
+private:
+    static std::unique_ptr<Sheet> LoadData(const char* texts, size_t texts_size,
+                                           const char* data, size_t data_size,
+                                           uint64_t cell_count);
+    // Бросает SheetFileError, если граф не совпадает со ссылками формул formulas
+    static void CheckGraph(const Sheet& sheet, const std::vector<Position>& formulas);
+    static std::unique_ptr<Sheet> Rebuild(const char* texts, size_t texts_size,
+                                          uint64_t cell_count);
+};
+
+// Запись чисел и массивов в буфер в порядке байтов машины
+class BinaryWriter {
+public:
+    template <typename T>
+    void Write(const T& value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        const auto* bytes = reinterpret_cast<const char*>(&value);
+        buffer_.insert(buffer_.end(), bytes, bytes + sizeof(T));
+    }
+
+    template <typename T>
+    void WriteArray(const std::vector<T>& values) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        Write(static_cast<uint64_t>(values.size()));
+        const auto* bytes = reinterpret_cast<const char*>(values.data());
+        buffer_.insert(buffer_.end(), bytes, bytes + values.size() * sizeof(T));
+    }
+
+    void WriteString(std::string_view text) {
+        Write(static_cast<uint32_t>(text.size()));
+        buffer_.insert(buffer_.end(), text.begin(), text.end());
+    }
+
+    // Дополняет буфер нулями до кратного alignment размера
+    void Align(size_t alignment) {
+        buffer_.resize((buffer_.size() + alignment - 1) / alignment * alignment, '\0');
+    }
+
+    const std::vector<char>& GetBuffer() const { return buffer_; }
+
+private:
+    std::vector<char> buffer_;
+};
+
+// Чтение из непрерывной памяти с проверкой границ: выход за конец бросает SheetFileError
+class BinaryReader {
+public:
+    BinaryReader(const char* data, size_t size)
+        : begin_(data), current_(data), end_(data + size) {}
+
+    template <typename T>
+    T Read() {
+        static_assert(std::is_trivially_copyable_v<T>);
+        T value;
+        std::memcpy(&value, Take(sizeof(T)), sizeof(T));
+        return value;
+    }
+
+    template <typename T>
+    std::vector<T> ReadArray() {
+        static_assert(std::is_trivially_copyable_v<T>);
+        const auto size = Read<uint64_t>();
+        if (size > static_cast<uint64_t>(end_ - current_) / sizeof(T)) {
+            throw SheetFileError("Array is out of file bounds");
+        }
+        std::vector<T> values(size);
+        std::memcpy(values.data(), Take(size * sizeof(T)), size * sizeof(T));
+        return values;
+    }
+
+    std::string_view ReadString() {
+        const auto size = Read<uint32_t>();
+        return {Take(size), size};
+    }
+
+    // Указатель на следующие size байт
+    const char* Take(size_t size) {
+        if (size > static_cast<size_t>(end_ - current_)) {
+            throw SheetFileError("Record is out of file bounds");
+        }
+        const char* result = current_;
+        current_ += size;
+        return result;
+    }
+
+    // Пропускает выравнивание, записанное BinaryWriter::Align
+    void Align(size_t alignment) {
+        const size_t offset = current_ - begin_;
+        Take((offset + alignment - 1) / alignment * alignment - offset);
+    }
+
+    bool AtEnd() const { return current_ == end_; }
+
+private:
+    const char* begin_;
+    const char* current_;
+    const char* end_;
+};
@@ -0,0 +1,228 @@
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cell.h"
+#include "sheet.h"
+#include "sheet_import.h"
+#include "thread_pool.h"
+
+namespace {
+
+// Кусок блока из целых строк текста
+struct Chunk {
+    const char* begin;
+    const char* end;
+    int first_row = 0;
+};
+
+struct ChunkCells {
+    std::vector<CellPtr> cells;
+    std::exception_ptr error;
+};
+
+// Указатель за первым переводом строки вне кавычек, начиная с from, или nullptr.
+// begin - начало строки, то есть позиция вне кавычек
+const char* FindRecordEnd(const char* begin, const char* from, const char* end, char quote) {
+    size_t quotes = quote ? std::count(begin, from, quote) : 0;
+    for (const char* pos = from; pos < end;) {
+        const auto* line_end = static_cast<const char*>(std::memchr(pos, '\n', end - pos));
+        if (!line_end) {
+            return nullptr;
+        }
+        if (quote) {
+            quotes += std::count(pos, line_end, quote);
+        }
+        if (quotes % 2 == 0) {
+            return line_end + 1;
+        }
+        pos = line_end + 1;
+    }
+    return nullptr;
+}
+
+// Указатель за последним переводом строки вне кавычек или nullptr
+const char* FindLastRecordEnd(const char* begin, const char* end, char quote) {
+    const char* last = nullptr;
+    if (!quote) {
+        for (const char* pos = end; pos > begin; --pos) {
+            if (pos[-1] == '\n') {
+                return pos;
+            }
+        }
+        return nullptr;
+    }
+    for (const char* pos = begin; (pos = FindRecordEnd(pos, pos, end, quote));) {
+        last = pos;
+    }
+    return last;
+}
+
+// Число строк куска; последняя строка текста может не заканчиваться переводом строки
+int CountRecords(const Chunk& chunk, char quote) {
+    int rows = 0;
+    if (!quote || std::find(chunk.begin, chunk.end, quote) == chunk.end) {
+        rows = static_cast<int>(std::count(chunk.begin, chunk.end, '\n'));
+    } else {
+        for (const char* pos = chunk.begin; (pos = FindRecordEnd(pos, pos, chunk.end, quote));) {
+            ++rows;
+        }
+    }
+    if (chunk.end > chunk.begin && chunk.end[-1] != '\n') {
+        ++rows;
+    }
+    return rows;
+}
+
+void ParseChunk(const Chunk& chunk, Sheet& sheet, const SheetImporter::Options& options,
+                ChunkCells& result) {
+
+    const char delimiter = options.delimiter;
+    const char quote = options.quote;
+    Position pos{chunk.first_row, 0};
+    std::string field;
+
+    for (const char* current = chunk.begin; current < chunk.end;) {
+        field.clear();
+
+        if (quote && *current == quote) {
+            ++current;
+            while (current < chunk.end) {
+                const char* closing = std::find(current, chunk.end, quote);
+                field.append(current, closing);
+                current = closing + (closing < chunk.end);
+                if (current < chunk.end && *current == quote) {
+                    field += quote;
+                    ++current;
+                } else {
+                    break;
+                }
+            }
+        }
+        const char* field_end = current;
+        while (field_end < chunk.end && *field_end != delimiter && *field_end != '\n') {
+            ++field_end;
+        }
+        field.append(current, field_end);
+        // конец строки CRLF
+        if (field_end > current && field_end[-1] == '\r'
+            && (field_end == chunk.end || *field_end == '\n')) {
+            field.pop_back();
+        }
+
+        if (!field.empty()) {
+            if (!pos.IsValid()) {
+                throw InvalidPositionException("On import");
+            }
+            auto cell = Cell::Create(sheet, pos);
+            cell->Set(field);
+            result.cells.push_back(std::move(cell));
+        }
+
+        if (field_end == chunk.end) {
+            break;
+        }
+        if (*field_end == '\n') {
+            ++pos.row;
+            pos.col = 0;
+        } else {
+            ++pos.col;
+        }
+        current = field_end + 1;
+    }
+}
+
+}  // namespace
+
+std::unique_ptr<Sheet> SheetImporter::Import(std::istream& input, const Options& options) {
+
+    const size_t thread_count = options.threads
+        ? options.threads
+        : std::max<size_t>(1, std::thread::hardware_concurrency());
+    ThreadPool pool(thread_count);
+    // несколько кусков на поток, чтобы потоки не ждали самый длинный кусок
+    const size_t chunk_size = std::max<size_t>(64 << 10, options.block_size / (thread_count * 4));
+
+    auto sheet = std::make_unique<Sheet>();
+    const uint64_t epoch = sheet->GetEpoch();
+    std::vector<Position> formulas;
+    int next_row = 0;
+
+    std::string buffer;
+    size_t carry = 0;
+    for (bool last = false; !last;) {
+        buffer.resize(carry + options.block_size);
+        input.read(buffer.data() + carry, options.block_size);
+        const size_t size = carry + static_cast<size_t>(input.gcount());
+        last = static_cast<size_t>(input.gcount()) < options.block_size;
+
+        const char* begin = buffer.data();
+        const char* end = begin + size;
+
+        std::vector<Chunk> chunks;
+        const char* pos = begin;
+        while (pos < end) {
+            const char* cut = pos + chunk_size < end
+                ? FindRecordEnd(pos, pos + chunk_size, end, options.quote)
+                : nullptr;
+            if (!cut) {
+                // хвост блока без конца строки ждёт следующего блока
+                cut = last ? end : FindLastRecordEnd(pos, end, options.quote);
+                if (!cut) {
+                    break;
+                }
+            }
+            chunks.push_back({pos, cut});
+            pos = cut;
+        }
+
+        std::vector<int> rows(chunks.size());
+        pool.ParallelFor(chunks.size(), [&](size_t i) {
+            rows[i] = CountRecords(chunks[i], options.quote);
+        });
+        for (size_t i = 0; i < chunks.size(); ++i) {
+            chunks[i].first_row = next_row;
+            next_row += rows[i];
+        }
+
+        std::vector<ChunkCells> parsed(chunks.size());
+        pool.ParallelFor(chunks.size(), [&](size_t i) {
+            try {
+                ParseChunk(chunks[i], *sheet, options, parsed[i]);
+            } catch (...) {
+                parsed[i].error = std::current_exception();
+            }
+        });
+        for (const auto& chunk_cells : parsed) {
+            if (chunk_cells.error) {
+                std::rethrow_exception(chunk_cells.error);
+            }
+        }
+
+        for (auto& chunk_cells : parsed) {
+            for (auto& cell : chunk_cells.cells) {
+                const auto cell_pos = cell->GetPosition();
+                if (cell->GetFormula()) {
+                    formulas.push_back(cell_pos);
+                }
+                cell->SetChangedAt(epoch);
+                sheet->table_.SetCell(std::move(cell));
+            }
+        }
+
+        carry = end - pos;
+        std::memmove(buffer.data(), pos, carry);
+    }
+
+    // граф строится, когда известны все ячейки: ссылки могут указывать на следующие блоки
+    DependencyGraph::Builder builder;
+    for (const auto pos : formulas) {
+        const auto& cell = sheet->table_(pos);
+        builder.AddReferences(pos, cell->GetReferencedCells(), cell->GetReferencedRanges());
+    }
+    sheet->table_.graph_ = std::make_shared<DependencyGraph>(builder.Finish());
+    return sheet;
+}
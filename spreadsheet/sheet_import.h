@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <istream>
+#include <memory>
+
+class Sheet;
+
+// Загрузка таблицы из текста с разделителями - обратная операция к PrintTexts:
+// строка текста - строка таблицы, поле - текст ячейки, пустое поле - пустая ячейка.
+// Текст читается блоками; блок делится на куски по границам строк, куски разбираются
+// на пуле потоков: числа читаются std::from_chars, формулы разбираются через кеш формул
+// таблицы. Ячейки кладутся в хранилище напрямую, граф зависимостей строится один раз
+// после чтения всех блоков, без Sheet::SetCell и проверки цикла на каждую формулу.
+class SheetImporter {
+public:
+    struct Options {
+        char delimiter = '\t';
+        // Символ кавычек CSV: поле, начинающееся с него, может содержать разделители
+        // и переводы строк, удвоенная кавычка внутри - сама кавычка. '\0' - без кавычек,
+        // как в выводе PrintTexts
+        char quote = '\0';
+        // 0 - по числу ядер
+        size_t threads = 0;
+        size_t block_size = 16 << 20;
+    };
+
+    // Бросает FormulaException при ошибке в формуле, InvalidPositionException, если
+    // ячейка выходит за границы таблицы, CircularDependencyException при цикле
+    static std::unique_ptr<Sheet> Import(std::istream& input, const Options& options);
+    static std::unique_ptr<Sheet> Import(std::istream& input) {
+        return Import(input, Options{});
+    }
+};
@@ -0,0 +1,242 @@
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <unordered_set>
+#include <utility>
+
+#include "print_buffer.h"
+#include "sheet_snapshot.h"
+
+// --- SheetSnapshot::FormulaCell ---
+
+CellInterface::Value SheetSnapshot::FormulaCell::GetValue() const {
+    if(!IsReady())
+        snapshot_.Evaluate(*this);
+    return value_;
+}
+
+std::string SheetSnapshot::FormulaCell::GetText() const {
+    return cell_.GetText();
+}
+
+std::optional<double> SheetSnapshot::FormulaCell::GetNumber() const {
+    if(!IsReady())
+        snapshot_.Evaluate(*this);
+    if(const auto* number = std::get_if<double>(&value_))
+        return *number;
+    return std::nullopt;
+}
+
+std::vector<Position> SheetSnapshot::FormulaCell::GetReferencedCells() const {
+    return cell_.GetReferencedCells();
+}
+
+// --- SheetSnapshot ---
+
+namespace {
+
+// Пустая ячейка снимка, на которую ссылаются формулы: то же, что пустая ячейка таблицы
+class EmptyCell : public CellInterface {
+public:
+    Value GetValue() const override { return ""; }
+    std::string GetText() const override { return ""; }
+    std::vector<Position> GetReferencedCells() const override { return {}; }
+};
+
+const EmptyCell empty_cell;
+
+}  // namespace
+
+SheetSnapshot::SheetSnapshot(TileGrid<CellPtr> cells, uint64_t epoch, Size printable_size,
+                             PositionSet cleared)
+    : cells_(std::move(cells)), epoch_(epoch), printable_size_(printable_size)
+    , cleared_(std::move(cleared)) {}
+
+void SheetSnapshot::SetCell(Position, std::string){
+    throw std::logic_error("Sheet snapshot is read-only");
+}
+
+void SheetSnapshot::ClearCell(Position){
+    throw std::logic_error("Sheet snapshot is read-only");
+}
+
+const CellInterface* SheetSnapshot::GetCell(Position pos) const {
+
+    if(!pos.IsValid())
+        throw InvalidPositionException("On GetCell");
+
+    if(const auto* cell = FindCell(pos))
+        return cell;
+    return IsReferencedEmpty(pos) ? &empty_cell : nullptr;
+}
+
+// У ячеек снимка нет изменяющих методов, поэтому неконстантный доступ безопасен
+CellInterface* SheetSnapshot::GetCell(Position pos) {
+    return const_cast<CellInterface*>(std::as_const(*this).GetCell(pos));
+}
+
+// Ячейки без формул неизменяемы и отдаются как есть
+const CellInterface* SheetSnapshot::FindCell(Position pos) const {
+
+    const auto& cell = cells_.Get(pos);
+    if(!cell)
+        return nullptr;
+    if(cell->GetFormula())
+        return &GetFormulaCell(*cell, pos);
+    return cell.get();
+}
+
+bool SheetSnapshot::IsReferencedEmpty(Position pos) const {
+
+    if(cleared_.count(pos))
+        return true;
+
+    std::call_once(referenced_once_, [this](){
+        cells_.ForEach([this](Position, const CellPtr& cell){
+            if(const auto* formula = cell->GetFormula()){
+                for(const auto ref : formula->GetReferencedCells())
+                    referenced_.insert(ref);
+            }
+        });
+    });
+    return referenced_.count(pos) > 0;
+}
+
+SheetSnapshot::CacheShard& SheetSnapshot::GetShard(Position pos) const {
+    return shards_[static_cast<size_t>(pos.row * 17 + pos.col) % SHARD_COUNT];
+}
+
+const SheetSnapshot::FormulaCell& SheetSnapshot::GetFormulaCell(const Cell& cell,
+                                                                 Position pos) const {
+    auto& shard = GetShard(pos);
+    std::lock_guard lock(shard.mutex);
+    return shard.cells.try_emplace(pos, *this, cell, pos).first->second;
+}
+
+void SheetSnapshot::Publish(const FormulaCell& formula_cell, CellInterface::Value value) const {
+
+    std::lock_guard lock(GetShard(formula_cell.pos_).mutex);
+    // формулу могли одновременно вычислить в другом потоке: значения совпадают
+    if(!formula_cell.ready_.load(std::memory_order_relaxed)){
+        formula_cell.value_ = std::move(value);
+        formula_cell.ready_.store(true, std::memory_order_release);
+    }
+}
+
+void SheetSnapshot::Evaluate(const FormulaCell& formula_cell) const {
+
+    std::vector<const FormulaCell*> order;
+    std::unordered_set<Position, DependencyGraph::PositionHasher> visited;
+    std::vector<std::pair<const FormulaCell*, bool>> stack{{&formula_cell, false}};
+
+    while(!stack.empty()){
+
+        auto [current, refs_pushed] = stack.back();
+
+        if(refs_pushed){
+            stack.pop_back();
+            order.push_back(current);
+            continue;
+        }
+        if(!visited.insert(current->pos_).second){
+            stack.pop_back();
+            continue;
+        }
+        stack.back().second = true;
+
+        auto push_input = [&](Position ref_pos, const CellPtr& ref_cell){
+            if(!ref_cell || !ref_cell->GetFormula() || visited.count(ref_pos))
+                return;
+            const auto& ref_formula_cell = GetFormulaCell(*ref_cell, ref_pos);
+            if(!ref_formula_cell.IsReady())
+                stack.push_back({&ref_formula_cell, false});
+        };
+
+        const auto* formula = current->GetCell().GetFormula();
+        for(const auto ref_pos : formula->GetReferencedCells())
+            push_input(ref_pos, cells_.Get(ref_pos));
+        for(const auto& range : formula->GetReferencedRanges()){
+            if(range.IsValid())
+                cells_.ForEachInRange(range, push_input);
+        }
+    }
+
+    for(const auto* current : order){
+        if(current->IsReady())
+            continue;
+        const auto* formula = current->GetCell().GetFormula();
+        Publish(*current, Cell::MakeFormulaValue(formula->Evaluate(*this)));
+    }
+}
+
+Size SheetSnapshot::GetPrintableSize() const {
+    return printable_size_;
+}
+
+void SheetSnapshot::GetCellsInRange(const Range& range,
+                                    std::vector<const CellInterface*>& cells) const {
+    cells.clear();
+    cells_.ForEachInRange(range, [this, &cells](Position pos, const CellPtr&){
+        cells.push_back(FindCell(pos));
+    });
+}
+
+void SheetSnapshot::PrintValues(std::ostream& output) const {
+
+    PrintBuffer buffer(output);
+    PrintRows(cells_, GetPrintableSize(), buffer, [this, &buffer](Position pos, const CellPtr& cell){
+        PrintValue(pos, *cell, buffer);
+    });
+}
+
+void SheetSnapshot::PrintTexts(std::ostream& output) const {
+
+    PrintBuffer buffer(output);
+    PrintRows(cells_, GetPrintableSize(), buffer, [&buffer](Position, const CellPtr& cell){
+        PrintCellText(*cell, buffer);
+    });
+}
+
+void SheetSnapshot::PrintValues(std::ostream& output, const Range& range) const {
+
+    if(!range.IsValid())
+        throw InvalidPositionException("On range access");
+
+    PrintBuffer buffer(output);
+    PrintRows(cells_, range, buffer, [this, &buffer](Position pos, const CellPtr& cell){
+        PrintValue(pos, *cell, buffer);
+    });
+}
+
+void SheetSnapshot::PrintTexts(std::ostream& output, const Range& range) const {
+
+    if(!range.IsValid())
+        throw InvalidPositionException("On range access");
+
+    PrintBuffer buffer(output);
+    PrintRows(cells_, range, buffer, [&buffer](Position, const CellPtr& cell){
+        PrintCellText(*cell, buffer);
+    });
+}
+
+void SheetSnapshot::GetValuesInRange(
+    const Range& range, std::vector<std::pair<Position, CellInterface::Value>>& values) const {
+
+    if(!range.IsValid())
+        throw InvalidPositionException("On range access");
+
+    values.clear();
+    cells_.ForEachInRange(range, [this, &values](Position pos, const CellPtr& cell){
+        if(cell->GetFormula())
+            values.emplace_back(pos, GetFormulaCell(*cell, pos).GetValue());
+        else if(!cell->GetPlainText().empty())
+            values.emplace_back(pos, cell->GetValue());
+    });
+}
+
+void SheetSnapshot::PrintValue(Position pos, const Cell& cell, PrintBuffer& buffer) const {
+    if(cell.GetFormula())
+        PrintCellValue(cell, GetFormulaCell(cell, pos), buffer);
+    else
+        PrintCellValue(cell, cell, buffer);
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "cell.h"
+#include "common.h"
+#include "dependency_graph.h"
+#include "tile_grid.h"
+
+class PrintBuffer;
+
+// Неизменяемая версия таблицы на момент создания (см. Sheet::Snapshot). Разделяет с таблицей
+// блоки ячеек и сами ячейки: содержимое ячейки после записи в таблицу не меняется, а правки
+// таблицы заменяют ячейки и копируют разделяемые блоки. Значения формул снимок считает
+// сам и хранит в своём кеше, не трогая кеш ячеек таблицы, поэтому снимок можно читать
+// и печатать из любого числа потоков, пока таблица продолжает меняться. Снимок может
+// пережить таблицу; память старых версий освобождается вместе с последней ссылкой на снимок.
+class SheetSnapshot : public SheetInterface {
+public:
+    // cleared - очищенные позиции, на которые ещё ссылаются формулы (см. Table::cleared_)
+    SheetSnapshot(TileGrid<CellPtr> cells, uint64_t epoch, Size printable_size,
+                  std::unordered_set<Position, DependencyGraph::PositionHasher> cleared);
+
+    // Снимок только читается: изменение бросает std::logic_error
+    void SetCell(Position pos, std::string text) override;
+    void ClearCell(Position pos) override;
+
+    const CellInterface* GetCell(Position pos) const override;
+          CellInterface* GetCell(Position pos) override;
+
+    Size GetPrintableSize() const override;
+
+    void PrintValues(std::ostream& output) const override;
+    void PrintTexts(std::ostream& output) const override;
+    void PrintValues(std::ostream& output, const Range& range) const override;
+    void PrintTexts(std::ostream& output, const Range& range) const override;
+
+    void GetValuesInRange(const Range& range,
+                          std::vector<std::pair<Position, CellInterface::Value>>& values) const override;
+
+    void GetCellsInRange(const Range& range,
+                         std::vector<const CellInterface*>& cells) const override;
+
+    // Эпоха таблицы, которую видит снимок
+    uint64_t GetEpoch() const { return epoch_; }
+
+private:
+    // Ячейка формулы в снимке: текст и ссылки берутся из ячейки таблицы,
+    // значение вычисляется один раз и больше не меняется
+    class FormulaCell : public CellInterface {
+    public:
+        FormulaCell(const SheetSnapshot& snapshot, const Cell& cell, Position pos)
+            : snapshot_(snapshot), cell_(cell), pos_(pos) {}
+
+        Value GetValue() const override;
+        std::string GetText() const override;
+        std::optional<double> GetNumber() const override;
+        std::vector<Position> GetReferencedCells() const override;
+
+        const Cell& GetCell() const { return cell_; }
+        bool IsReady() const { return ready_.load(std::memory_order_acquire); }
+
+    private:
+        friend class SheetSnapshot;
+
+        const SheetSnapshot& snapshot_;
+        const Cell& cell_;
+        Position pos_;
+
+        // value_ записывается под мьютексом сегмента до ready_ и после этого не меняется
+        mutable std::atomic<bool> ready_{false};
+        mutable Value value_;
+    };
+
+    // Кеш формул разбит на сегменты по позиции, чтобы потоки реже ждали друг друга
+    struct CacheShard {
+        std::mutex mutex;
+        std::unordered_map<Position, FormulaCell, DependencyGraph::PositionHasher> cells;
+    };
+    static constexpr size_t SHARD_COUNT = 64;
+
+    using PositionSet = std::unordered_set<Position, DependencyGraph::PositionHasher>;
+
+    TileGrid<CellPtr> cells_;
+    uint64_t epoch_;
+    Size printable_size_;
+    mutable std::array<CacheShard, SHARD_COUNT> shards_;
+
+    // Пустые позиции, на которые ссылаются формулы, видны через GetCell как пустая
+    // ячейка, как и в таблице. Прямые ссылки формул собираются при первом запросе
+    // пустой позиции.
+    PositionSet cleared_;
+    mutable std::once_flag referenced_once_;
+    mutable PositionSet referenced_;
+
+    CacheShard& GetShard(Position pos) const;
+    const FormulaCell& GetFormulaCell(const Cell& cell, Position pos) const;
+    const CellInterface* FindCell(Position pos) const;
+    bool IsReferencedEmpty(Position pos) const;
+    void PrintValue(Position pos, const Cell& cell, PrintBuffer& buffer) const;
+
+    // Вычисляет формулу в pos и все невычисленные формулы, от которых она зависит,
+    // обходом в глубину с явным стеком
+    void Evaluate(const FormulaCell& formula_cell) const;
+    void Publish(const FormulaCell& formula_cell, CellInterface::Value value) const;
+};
@@ -1,8 +1,10 @@
 #include "common.h"
 
 #include <cctype>
+#include <ostream>
 #include <sstream>
 #include <algorithm>
+#include <tuple>
 
 const int LETTERS = 26;
 const int MAX_POSITION_LENGTH = 17;
@@ -78,4 +80,113 @@ Position Position::FromString(std::string_view str) {
     }
 
     return {row - 1, col - 1};
-}
\ No newline at end of file
+}
+
+bool Range::operator==(const Range rhs) const {
+    return (first == rhs.first)
+        && (last == rhs.last);
+}
+
+bool Range::operator<(const Range rhs) const {
+    return std::tie(first.row, first.col, last.row, last.col)
+        < std::tie(rhs.first.row, rhs.first.col, rhs.last.row, rhs.last.col);
+}
+
+bool Range::IsValid() const {
+    return first.IsValid()
+        && last.IsValid()
+        && (first.row <= last.row)
+        && (first.col <= last.col);
+}
+
+bool Range::Contains(const Position pos) const {
+    return (pos.row >= first.row)
+        && (pos.row <= last.row)
+        && (pos.col >= first.col)
+        && (pos.col <= last.col);
+}
+
+std::string Range::ToString() const {
+    if (!IsValid()) {
+        return "";
+    }
+    return first.ToString() + ':' + last.ToString();
+}
+
+Range Range::FromCorners(const Position lhs, const Position rhs) {
+    return {{std::min(lhs.row, rhs.row), std::min(lhs.col, rhs.col)},
+            {std::max(lhs.row, rhs.row), std::max(lhs.col, rhs.col)}};
+}
+
+std::optional<double> CellInterface::GetNumber() const {
+    const auto value = GetValue();
+    if (std::holds_alternative<double>(value)) {
+        return std::get<double>(value);
+    }
+    return std::nullopt;
+}
+
+namespace {
+
+// Обходит все позиции диапазона; print(const CellInterface&) вызывается для непустых ячеек
+template <typename Func>
+void PrintRangeByCells(const SheetInterface& sheet, std::ostream& output, const Range& range,
+                       Func print) {
+    if (!range.IsValid()) {
+        throw InvalidPositionException("On Print");
+    }
+    for (int row = range.first.row; row <= range.last.row; ++row) {
+        for (int col = range.first.col; col <= range.last.col; ++col) {
+            if (col > range.first.col) {
+                output << '\t';
+            }
+            const auto* cell = sheet.GetCell({row, col});
+            if (cell && !cell->GetText().empty()) {
+                print(*cell);
+            }
+        }
+        output << '\n';
+    }
+}
+
+}  // namespace
+
+void SheetInterface::PrintValues(std::ostream& output, const Range& range) const {
+    PrintRangeByCells(*this, output, range, [&output](const CellInterface& cell) {
+        std::visit([&output](const auto& value) { output << value; }, cell.GetValue());
+    });
+}
+
+void SheetInterface::PrintTexts(std::ostream& output, const Range& range) const {
+    PrintRangeByCells(*this, output, range, [&output](const CellInterface& cell) {
+        output << cell.GetText();
+    });
+}
+
+void SheetInterface::GetValuesInRange(
+    const Range& range, std::vector<std::pair<Position, CellInterface::Value>>& values) const {
+    if (!range.IsValid()) {
+        throw InvalidPositionException("On GetValuesInRange");
+    }
+    values.clear();
+    for (int row = range.first.row; row <= range.last.row; ++row) {
+        for (int col = range.first.col; col <= range.last.col; ++col) {
+            const auto* cell = GetCell({row, col});
+            if (cell && !cell->GetText().empty()) {
+                values.emplace_back(Position{row, col}, cell->GetValue());
+            }
+        }
+    }
+}
+
+void SheetInterface::GetCellsInRange(const Range& range,
+                                     std::vector<const CellInterface*>& cells) const {
+    cells.clear();
+    for (int row = range.first.row; row <= range.last.row; ++row) {
+        for (int col = range.first.col; col <= range.last.col; ++col) {
+            if (const auto* cell = GetCell({row, col})) {
+                cells.push_back(cell);
+            }
+        }
+    }
+}
@@ -0,0 +1,74 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t thread_count) {
+    for (size_t i = 1; i < thread_count; ++i) {
+        workers_.emplace_back([this] { WorkerLoop(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+void ThreadPool::Run(const Job& job) {
+    {
+        std::lock_guard lock(mutex_);
+        job_ = &job;
+        next_index_ = 0;
+        // по несколько кусков на поток, чтобы выровнять неравномерную нагрузку
+        chunk_size_ = std::max<size_t>(1, job.count / (GetThreadCount() * 8));
+        active_ = workers_.size();
+        ++generation_;
+    }
+    wake_.notify_all();
+
+    Work(job);
+
+    std::unique_lock lock(mutex_);
+    done_.wait(lock, [this] { return active_ == 0; });
+    job_ = nullptr;
+}
+
+void ThreadPool::Work(const Job& job) {
+    for (;;) {
+        const size_t begin = next_index_.fetch_add(chunk_size_);
+        if (begin >= job.count) {
+            return;
+        }
+        const size_t end = std::min(job.count, begin + chunk_size_);
+        for (size_t i = begin; i < end; ++i) {
+            job.invoke(job.context, i);
+        }
+    }
+}
+
+void ThreadPool::WorkerLoop() {
+    size_t seen_generation = 0;
+    std::unique_lock lock(mutex_);
+
+    for (;;) {
+        wake_.wait(lock, [&] { return stop_ || generation_ != seen_generation; });
+        if (stop_) {
+            return;
+        }
+        seen_generation = generation_;
+        const Job* job = job_;
+
+        lock.unlock();
+        Work(*job);
+        lock.lock();
+
+        if (--active_ == 0) {
+            done_.notify_one();
+        }
+    }
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Пул потоков для параллельных циклов. Вызывающий поток тоже участвует в работе,
+// поэтому пул на один поток не создаёт дополнительных потоков вовсе.
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t thread_count);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t GetThreadCount() const {
+        return workers_.size() + 1;
+    }
+
+    // Вызывает func(i) для всех i из [0, count) и ждёт завершения.
+    // Порядок вызовов не определён, func не должна бросать исключений.
+    template <typename Func>
+    void ParallelFor(size_t count, const Func& func) {
+        if (workers_.empty() || count < 2) {
+            for (size_t i = 0; i < count; ++i) {
+                func(i);
+            }
+            return;
+        }
+
+        Job job{count, &func, [](const void* context, size_t i) {
+            (*static_cast<const Func*>(context))(i);
+        }};
+        Run(job);
+    }
+
+private:
+    struct Job {
+        size_t count;
+        const void* context;
+        void (*invoke)(const void*, size_t);
+    };
+
+    std::vector<std::thread> workers_;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    const Job* job_ = nullptr;
+    size_t generation_ = 0;
+    size_t active_ = 0;
+    bool stop_ = false;
+
+    std::atomic<size_t> next_index_{0};
+    size_t chunk_size_ = 1;
+
+    void Run(const Job& job);
+    void Work(const Job& job);
+    void WorkerLoop();
+};
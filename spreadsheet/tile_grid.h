@@ -0,0 +1,199 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "common.h"
+
+// Плотное хранилище значений, разбитое на квадратные блоки (тайлы) TILE_SIZE x TILE_SIZE.
+// Блоки создаются по требованию, поиск ячейки сводится к индексной арифметике.
+// Внутри блока ячейки лежат построчно, поэтому обход по строкам идёт по непрерывной памяти.
+// Тип T должен приводиться к bool: значение по умолчанию означает пустой слот.
+// Копия хранилища разделяет блоки с оригиналом; блок копируется при первом изменении
+// в любой из копий (copy-on-write), поэтому копирование стоит только каталога блоков.
+// Копировать и изменять хранилище нужно из одного потока; читать неизменяемую копию
+// можно из любого числа потоков.
+template <typename T>
+class TileGrid {
+public:
+    static constexpr int TILE_BITS = 6;
+    static constexpr int TILE_SIZE = 1 << TILE_BITS;
+    static constexpr int TILE_MASK = TILE_SIZE - 1;
+    static constexpr int TILE_COLS = (Position::MAX_COLS + TILE_SIZE - 1) / TILE_SIZE;
+
+    struct Tile {
+        std::array<T, TILE_SIZE * TILE_SIZE> slots{};
+        int occupied = 0;
+
+        T& operator()(int row, int col) {
+            return slots[(row & TILE_MASK) * TILE_SIZE + (col & TILE_MASK)];
+        }
+        const T& operator()(int row, int col) const {
+            return slots[(row & TILE_MASK) * TILE_SIZE + (col & TILE_MASK)];
+        }
+    };
+
+    const T* Find(Position pos) const {
+        const Tile* tile = FindTile(pos.row, pos.col);
+        return tile ? &(*tile)(pos.row, pos.col) : nullptr;
+    }
+
+    const T& Get(Position pos) const {
+        static const T empty{};
+        const T* slot = Find(pos);
+        return slot ? *slot : empty;
+    }
+
+    // Блок позиции разделяется с другой копией хранилища. Счётчик ссылок после
+    // освобождения копии читается без барьера: изменять блок можно после acquire-барьера.
+    bool IsShared(Position pos) const {
+        const size_t index = TileIndex(pos.row, pos.col);
+        return index < tiles_.size() && tiles_[index].use_count() > 1;
+    }
+
+    void Set(Position pos, T value) {
+        if (!value) {
+            Erase(pos);
+            return;
+        }
+        Tile& tile = GetOrCreateUniqueTile(pos.row, pos.col);
+        T& slot = tile(pos.row, pos.col);
+        if (!slot) {
+            ++tile.occupied;
+        }
+        slot = std::move(value);
+    }
+
+    void Erase(Position pos) {
+        std::shared_ptr<Tile>* tile_ptr = FindTilePtr(pos.row, pos.col);
+        if (!tile_ptr || !*tile_ptr) {
+            return;
+        }
+        if (!(**tile_ptr)(pos.row, pos.col)) {
+            return;
+        }
+        if ((*tile_ptr)->occupied == 1) {
+            tile_ptr->reset();
+            return;
+        }
+        MakeUnique(*tile_ptr);
+        (**tile_ptr)(pos.row, pos.col) = T{};
+        --(*tile_ptr)->occupied;
+    }
+
+    void Clear() {
+        tiles_.clear();
+    }
+
+    // Обходит занятые слоты построчно: func(Position, const T&)
+    template <typename Func>
+    void ForEach(Func&& func) const {
+        const int tile_rows = static_cast<int>(tiles_.size() / TILE_COLS);
+        for (int tile_row = 0; tile_row < tile_rows; ++tile_row) {
+            const auto* row_tiles = &tiles_[tile_row * TILE_COLS];
+            for (int row_in_tile = 0; row_in_tile < TILE_SIZE; ++row_in_tile) {
+                const int row = tile_row * TILE_SIZE + row_in_tile;
+                for (int tile_col = 0; tile_col < TILE_COLS; ++tile_col) {
+                    const auto& tile = row_tiles[tile_col];
+                    if (!tile) {
+                        continue;
+                    }
+                    const T* slot = &tile->slots[row_in_tile * TILE_SIZE];
+                    for (int col_in_tile = 0; col_in_tile < TILE_SIZE; ++col_in_tile) {
+                        if (slot[col_in_tile]) {
+                            func(Position{row, tile_col * TILE_SIZE + col_in_tile},
+                                 slot[col_in_tile]);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // Обходит занятые слоты диапазона построчно: func(Position, const T&)
+    template <typename Func>
+    void ForEachInRange(const Range& range, Func&& func) const {
+        const int tile_rows = static_cast<int>(tiles_.size() / TILE_COLS);
+        const int last_row = std::min(range.last.row, tile_rows * TILE_SIZE - 1);
+        const int first_tile_col = range.first.col >> TILE_BITS;
+        const int last_tile_col = range.last.col >> TILE_BITS;
+
+        for (int row = range.first.row; row <= last_row; ++row) {
+            const auto* row_tiles = &tiles_[(row >> TILE_BITS) * TILE_COLS];
+            for (int tile_col = first_tile_col; tile_col <= last_tile_col; ++tile_col) {
+                const auto& tile = row_tiles[tile_col];
+                if (!tile) {
+                    continue;
+                }
+                const int tile_left = tile_col * TILE_SIZE;
+                const int col_begin = std::max(range.first.col, tile_left);
+                const int col_end = std::min(range.last.col, tile_left + TILE_MASK);
+                const T* slot = &tile->slots[(row & TILE_MASK) * TILE_SIZE];
+                for (int col = col_begin; col <= col_end; ++col) {
+                    if (slot[col & TILE_MASK]) {
+                        func(Position{row, col}, slot[col & TILE_MASK]);
+                    }
+                }
+            }
+        }
+    }
+
+    // Обходит занятые блоки в произвольном порядке: func(Position левого верхнего угла, const Tile&)
+    template <typename Func>
+    void ForEachTile(Func&& func) const {
+        for (size_t i = 0; i < tiles_.size(); ++i) {
+            if (tiles_[i]) {
+                const int tile_row = static_cast<int>(i / TILE_COLS);
+                const int tile_col = static_cast<int>(i % TILE_COLS);
+                func(Position{tile_row * TILE_SIZE, tile_col * TILE_SIZE}, *tiles_[i]);
+            }
+        }
+    }
+
+private:
+    // Каталог блоков хранится построчно с фиксированным шагом TILE_COLS
+    // и растёт вниз по мере появления новых строк блоков.
+    std::vector<std::shared_ptr<Tile>> tiles_;
+
+    static size_t TileIndex(int row, int col) {
+        return static_cast<size_t>(row >> TILE_BITS) * TILE_COLS + (col >> TILE_BITS);
+    }
+
+    const Tile* FindTile(int row, int col) const {
+        const size_t index = TileIndex(row, col);
+        return index < tiles_.size() ? tiles_[index].get() : nullptr;
+    }
+
+    std::shared_ptr<Tile>* FindTilePtr(int row, int col) {
+        const size_t index = TileIndex(row, col);
+        return index < tiles_.size() ? &tiles_[index] : nullptr;
+    }
+
+    // Блок, разделяемый с другой копией хранилища, копируется перед изменением.
+    // Счётчик ссылок меняют только копирование хранилища и освобождение копий;
+    // барьер упорядочивает изменение блока после чтений копии, которая его освободила.
+    static void MakeUnique(std::shared_ptr<Tile>& tile) {
+        if (tile.use_count() > 1) {
+            tile = std::make_shared<Tile>(*tile);
+        } else {
+            std::atomic_thread_fence(std::memory_order_acquire);
+        }
+    }
+
+    Tile& GetOrCreateUniqueTile(int row, int col) {
+        const size_t index = TileIndex(row, col);
+        if (index >= tiles_.size()) {
+            tiles_.resize((index / TILE_COLS + 1) * TILE_COLS);
+        }
+        auto& tile = tiles_[index];
+        if (!tile) {
+            tile = std::make_shared<Tile>();
+        } else {
+            MakeUnique(tile);
+        }
+        return *tile;
+    }
+};